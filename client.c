@@ -1,13 +1,19 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <time.h>
 #include "libs/connection/connection.h"
+#include "libs/connection/client_api.h"
 #include "libs/commands/commands.h"
 #include "libs/yml_parser/yml_parser.h"
 
+#define MIN(x, y) (x < y ? x : y)
+
 /**
  * Arguments possible du programme client.
  */
@@ -23,16 +29,30 @@ enum {
  */
 void sig_disconnect(int signum);
 
+/**
+ * Affiche au fur et à mesure de leur arrivée les morceaux de la réponse à la 
+ * requête id.
+ * 
+ * @param {unsigned int} L'identifiant de la requête attendue.
+ * @return {int} 1 en cas de succès, 0 si le timeout a été atteint et une 
+ *               valeur négative en cas d'erreur.
+ */
+int print_response(unsigned int id);
+
 /*
  * Variables globales nécessaires au signaux.
  */
 
-request_fifo *req_fifo;
-response_fifo *res_fifo;
-server_queue *server_q;
+remote_client *client = NULL;
+session *client_session = NULL;
 yml_parser *config;
 int req_timeout = 5;
 int res_timeout = 5;
+int request_budget = 0;
+int transport = TRANSPORT_FIFO;
+int ring_size = 65536;
+int compression = 1;
+int pipeline_depth = 32;
 
 int main(int argc, char **argv) {
   if (argc >= NB_ARGS) {
@@ -57,6 +77,11 @@ int main(int argc, char **argv) {
   }
   get(config, "req_timeout", &req_timeout);
   get(config, "res_timeout", &res_timeout);
+  get(config, "request_budget", &request_budget);
+  get(config, "transport", &transport);
+  get(config, "ring_size", &ring_size);
+  get(config, "compression", &compression);
+  get(config, "pipeline_depth", &pipeline_depth);
   // Gestion des signaux
   struct sigaction action;
   action.sa_handler = sig_disconnect;
@@ -86,112 +111,119 @@ int main(int argc, char **argv) {
     perror("Erreur lors de l'association d'une action aux signaux ");
     return EXIT_FAILURE;
   }
-  // Connexion à la file de requêtes
-  server_q = connect(SHM_NAME);
-  if (server_q == NULL) {
-    perror("Impossible d'établir un lien avec la file de connexion ");
-    return EXIT_FAILURE;
-  }
-  // Création des noms des pipes
-  char request_pipe[NAME_MAX + 1];
-  sprintf(request_pipe, "./tmp/pipe_requete_%ld", (long) getpid());
-  char response_pipe[NAME_MAX + 1];
-  sprintf(response_pipe, "./tmp/pipe_reponse_%ld", (long) getpid());
-  // Création de la pipe de requête
-  if ((req_fifo = init_request_fifo(request_pipe)) == NULL) {
-    perror("Impossible d'initialiser le réseau de requête ");
-    return EXIT_FAILURE;
-  }
-  // Création de la pipe de réponse
-  if ((res_fifo = init_response_fifo(response_pipe)) == NULL) {
-    perror("Impossible d'initialiser le réseau de requête ");
-    return EXIT_FAILURE;
+  // Ouverture de la session avec le serveur
+  char shm_prefix[NAME_MAX + 1];
+  char shm_name[NAME_MAX + 1] = SHM_NAME;
+  if (get(config, "shm_name", shm_prefix) > 0) {
+    snprintf(shm_name, sizeof(shm_name), "/%.*s", NAME_MAX - 1, shm_prefix);
   }
-  // Envoie de la requête de connexion au serveur
   int r = EXIT_SUCCESS;
   int ret;
-  if ((ret = send_shm_request(server_q, request_pipe, response_pipe, res_timeout)) <= 0) {
-    if (ret == 0) {
+  char *line = NULL;
+  size_t line_size = 0;
+  client_options options = {
+    .shm_name = shm_name,
+    .tmp_dir = CLIENT_TMP_DIR,
+    .transport = transport,
+    .capabilities = compression != 0 ? CAPABILITY_COMPRESSION : 0,
+    .ring_size = (size_t) ring_size,
+    .timeout = (time_t) res_timeout
+  };
+  if ((client = client_open(&options)) == NULL) {
+    if (errno == ETIMEDOUT) {
       fprintf(stderr, 
         "Le serveur est surchargé, veuillez réessayer plus tard\n");
     } else {
-      perror("Impossible d'envoyer une requête à la file de connexion ");
+      perror("Impossible d'ouvrir la session avec le serveur ");
     }
     r = EXIT_FAILURE;
     goto free;
   }
-  char s[MAX_COMMAND_LENGTH + 1];
-  do {
-    char *res_buffer = NULL;
-    fprintf(stdout, "> ");
-    if (fgets(s, MAX_COMMAND_LENGTH, stdin) == NULL) {
-      fprintf(stderr, "Erreur lors de la lecture de la commande\n");
-      if (send_request(req_fifo, "exit", (time_t) req_timeout) <= 0 
-          || listen_response(res_fifo, &res_buffer, (time_t) res_timeout) <= 0) {
-        fprintf(stderr, "Impossible d'échanger une requête de fin de "
-            "transmission avec le serveur\n");
-      } else {
-        fprintf(stdout, "%s\n", res_buffer);
+  client_session = client_get_session(client);
+  // res_timeout borne l'attente de chaque morceau de réponse et non la 
+  // commande entière : le serveur n'abandonne une commande qu'au-delà du 
+  // budget configuré
+  if (request_budget > 0) {
+    session_set_request_deadline(client_session, (time_t) request_budget);
+  }
+  // Sur un terminal, chaque commande attend sa réponse avant l'invite
+  // suivante. Un script est envoyé sans attendre chaque aller-retour, dans
+  // la limite de la fenêtre.
+  int interactive = isatty(STDIN_FILENO);
+  size_t window = 1;
+  if (!interactive && pipeline_depth > 1) {
+    window = MIN((size_t) pipeline_depth, 
+        session_pipeline_depth(client_session));
+  }
+  unsigned int sent = 0;
+  unsigned int received = 0;
+  int stop = 0;
+  while (!stop || received != sent) {
+    if (!stop && sent - received < window) {
+      if (interactive) {
+        fprintf(stdout, "> ");
+        fflush(stdout);
       }
-      r = EXIT_FAILURE;
-      goto free;
-    }
-    // Enlève le \n à la fin de la commande
-    s[strlen(s) - 1] = '\0';
-    // Si la commande est vide on n'affiche pas de message d'erreur
-    if (strcmp(s, "") == 0) {
-      continue;
-    }
-    // Si la commande est invalide on affiche une erreur
-    if (!is_command_available(s)) {
-      fprintf(stderr, "Commande invalide : %s\n", s);
-      continue;
-    }
-    // Une fois connecté envoie la requête à exécuter
-    if ((ret = send_request(req_fifo, s, (time_t) req_timeout)) <= 0) {
-      if (ret == 0) {
-        fprintf(stderr, 
-          "Le serveur est trop surchargé pour recevoir la requête, vous avez "
-          "été déconnecté...\n");
-          if (res_buffer != NULL) {
-            free(res_buffer);
-          }
+      const char *cmd;
+      if (getline(&line, &line_size, stdin) < 0) {
+        // La fin d'un script termine normalement la session
+        if (interactive) {
+          fprintf(stderr, "Erreur lors de la lecture de la commande\n");
+          r = EXIT_FAILURE;
+        }
+        cmd = "exit";
       } else {
-        perror("Impossible d'envoyer la requête");
+        cmd = line;
+        // Enlève le \n à la fin de la commande
+        line[strcspn(line, "\n")] = '\0';
+        // Si la commande est vide on n'affiche pas de message d'erreur
+        if (strcmp(line, "") == 0) {
+          continue;
+        }
+        // Si la commande est invalide on affiche une erreur
+        if (!is_command_available(line)) {
+          fprintf(stderr, "Commande invalide : %s\n", line);
+          continue;
+        }
       }
-      r = EXIT_FAILURE;
-      goto free;
+      // Une fois connecté envoie la requête à exécuter
+      if ((ret = session_send_request(client_session, sent, cmd, 
+          (time_t) req_timeout)) == INVALID_REQUEST) {
+        fprintf(stderr, "Commande trop longue pour le serveur\n");
+        continue;
+      }
+      if (ret <= 0) {
+        if (ret == 0) {
+          fprintf(stderr, 
+            "Le serveur est trop surchargé pour recevoir la requête, vous "
+            "avez été déconnecté...\n");
+        } else {
+          perror("Impossible d'envoyer la requête");
+        }
+        r = EXIT_FAILURE;
+        goto free;
+      }
+      ++sent;
+      stop = strcmp(cmd, "exit") == 0;
+      continue;
     }
-    // Ecoute la réponse du serveur
-    if ((ret = listen_response(res_fifo, &res_buffer, (time_t) res_timeout)) <= 0) {
+    // Les réponses arrivent dans l'ordre d'envoi des requêtes
+    if ((ret = print_response(received)) <= 0) {
       if (ret < 0) {
         perror("Impossible de recevoir la réponse du serveur ");
       } else {
         fprintf(stdout, "Le serveur ne répond plus. Déconnexion...\n");
       }
-      if (res_buffer != NULL) {
-        free(res_buffer);
-      }
+      r = EXIT_FAILURE;
       break;
-    } else {
-      fprintf(stdout, "%s\n", res_buffer);
     }
-    if (res_buffer != NULL) {
-      free(res_buffer);
-    }
-  } while (strcmp(s, "exit") != 0);
+    ++received;
+  }
   // Libère les ressources en se déconnectant
 free:
-  if (disconnect(server_q) < 0) {
-    fprintf(stderr, "Une erreur est survenue lors de la déconnexion\n");
-    r = EXIT_FAILURE;
-  }
-  if (close_request_fifo(req_fifo) < 0) {
-    perror("Impossible de fermer la pipe de requête ");
-    r = EXIT_FAILURE;
-  }
-  if (close_response_fifo(res_fifo) < 0) {
-    perror("Impossible de fermer la pipe de réponse ");
+  free(line);
+  if (client != NULL && client_close(client) < 0) {
+    perror("Impossible de fermer la session ");
     r = EXIT_FAILURE;
   }
   if (free_parser(config) < 0) {
@@ -202,13 +234,41 @@ free:
   return r;
 }
 
+int print_response(unsigned int id) {
+  char *res_buffer;
+  size_t size;
+  unsigned int res_id;
+  int ret;
+  while ((ret = session_listen_chunk(client_session, &res_id, &res_buffer, 
+      &size, (time_t) res_timeout)) > 0) {
+    if (res_id != id) {
+      session_free_chunk(client_session, res_buffer);
+      errno = EPROTO;
+      return INVALID_CHUNK;
+    }
+    if (size == 0) {
+      break;
+    }
+    fwrite(res_buffer, 1, size, stdout);
+    fflush(stdout);
+    session_free_chunk(client_session, res_buffer);
+  }
+  if (ret > 0) {
+    fprintf(stdout, "\n");
+  }
+
+  return ret;
+}
+
 void sig_disconnect(int signum) {
   int r = EXIT_SUCCESS;  
   if (signum == SIGINT || signum == SIGQUIT || signum == SIGTERM) {
     fprintf(stdout, "\nInterruption de la connexion au serveur (Signal)...\n");
     char *s;
-    if (send_request(req_fifo, "exit", (time_t) req_timeout) <= 0 
-        || listen_response(res_fifo, &s, (time_t) res_timeout) <= 0) {
+    if (client_session == NULL
+        || session_send_request(client_session, 0, "exit", 
+        (time_t) req_timeout) <= 0 || session_listen_response(client_session,
+        NULL, &s, (time_t) res_timeout) <= 0) {
       fprintf(stderr, "Impossible d'échanger une requête de fin de "
           "transmission avec le serveur");
       r = EXIT_FAILURE;
@@ -222,16 +282,8 @@ void sig_disconnect(int signum) {
     fprintf(stderr, 
         "Envoi de la réponse trop long : Vous avez été déconnecté.\n");
   }
-  if (disconnect(server_q) < 0) {
-    fprintf(stderr, "Une erreur est survenue lors de la déconnexion\n");
-    r = EXIT_FAILURE;
-  }
-  if (close_request_fifo(req_fifo) < 0) {
-    perror("Impossible de fermer la pipe de requête ");
-    r = EXIT_FAILURE;
-  }
-  if (close_response_fifo(res_fifo) < 0) {
-    perror("Impossible de fermer la pipe de réponse ");
+  if (client != NULL && client_close(client) < 0) {
+    perror("Impossible de fermer la session ");
     r = EXIT_FAILURE;
   }
   if (free_parser(config) < 0) {
@@ -0,0 +1,597 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include "cache.h"
+
+/*
+ * Une surveillance inotify peut servir à plusieurs entrées : elle porte une
+ * génération, incrémentée à chaque modification du chemin. Une entrée
+ * retient la génération de chacune de ses surveillances lors de sa
+ * réservation et n'est valable que tant qu'elles n'ont pas changé. Les
+ * entrées périmées ne sont retirées que lorsqu'elles sont consultées ou
+ * évincées : une modification ne coûte qu'un incrément. Les événements en
+ * attente sont lus avant chaque consultation : une modification faite avant
+ * une requête est toujours prise en compte.
+ */
+
+// Modifications d'un chemin qui périment les entrées qui en dépendent
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF \
+    | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+// Nombre de listes de la table des surveillances
+#define WATCH_BUCKETS 256
+
+// Nombre minimum de listes de la table des entrées
+#define MIN_ENTRY_BUCKETS 64
+
+// Mémoire moyenne d'une entrée pour le dimensionnement de la table
+#define AVERAGE_ENTRY_SIZE 1024
+
+// Part maximale du cache que peut occuper une entrée
+#define MAX_ENTRY_SHARE 4
+
+// Taille du tampon de lecture des événements inotify
+#define EVENT_BUFFER_SIZE 4096
+
+#define MAX(x, y) (x > y ? x : y)
+
+/*
+ * Structures
+ */
+
+typedef struct cache_watch {
+  int wd;                   // -1 si le noyau a retiré la surveillance
+  unsigned long generation;
+  size_t refs;              // Entrées et réservations qui en dépendent
+  struct cache_watch *next; // Suivante dans la table des surveillances
+} cache_watch;
+
+struct cache_pending {
+  char *key;
+  size_t key_len;
+  size_t hash;
+  int has_ttl;
+  struct timespec expires;  // Fin de validité si has_ttl (CLOCK_MONOTONIC)
+  unsigned long epoch;      // Epoque du cache lors de la réservation
+  size_t nb_watches;
+  cache_watch *watches[CACHE_MAX_PATHS];
+  unsigned long generations[CACHE_MAX_PATHS];
+};
+
+typedef struct cache_entry {
+  cache_pending deps;
+  char *data;
+  size_t size;
+  struct cache_entry *next; // Suivante dans la table des entrées
+  struct cache_entry *lru_prev;
+  struct cache_entry *lru_next;
+} cache_entry;
+
+struct response_cache {
+  pthread_mutex_t mutex;
+  int inotify_fd;
+  int stop_fd; // Rendu lisible par cache_dispose pour arrêter le thread
+  pthread_t watcher;
+  size_t max_bytes;
+  long ttl_ms;
+  // Incrémentée si des événements ont été perdus : tout est périmé
+  unsigned long epoch;
+  cache_watch *watches[WATCH_BUCKETS];
+  cache_entry **entries;
+  size_t nb_buckets;
+  // Entrée la plus récemment utilisée en tête
+  cache_entry *lru_head;
+  cache_entry *lru_tail;
+  cache_stats stats;
+};
+
+/**
+ * Fonction run du thread lisant les modifications des chemins surveillés,
+ * jusqu'à ce que stop_fd devienne lisible.
+ */
+static void *run_watcher(void *arg);
+
+/**
+ * Lit sans attendre les événements inotify en attente et incrémente la
+ * génération des surveillances concernées. Le verrou doit être pris.
+ */
+static void drain_events(response_cache *cache);
+
+/**
+ * Calcule le hachage FNV-1a des n octets de key.
+ */
+static size_t hash_key(const char *key, size_t n);
+
+/**
+ * Surveille path (ou son dossier parent s'il n'existe pas) et renvoie la
+ * surveillance, dont une référence est prise. Le verrou doit être pris.
+ */
+static cache_watch *acquire_watch(response_cache *cache, const char *path);
+
+/**
+ * Rend une référence de watch, retirée lorsqu'elle n'est plus utilisée. Le
+ * verrou doit être pris.
+ */
+static void release_watch(response_cache *cache, cache_watch *watch);
+
+/**
+ * Renvoie la surveillance wd active, ou NULL. Le verrou doit être pris.
+ */
+static cache_watch *find_watch(response_cache *cache, int wd);
+
+/**
+ * Renvoie une valeur non nulle si les dépendances deps sont toujours
+ * valables. Le verrou doit être pris.
+ */
+static int deps_valid(const response_cache *cache, const cache_pending *deps);
+
+/**
+ * Rend les surveillances de deps puis libère sa clé. Le verrou doit être
+ * pris.
+ */
+static void release_deps(response_cache *cache, cache_pending *deps);
+
+/**
+ * Retire l'entrée e du cache et la libère. Le verrou doit être pris.
+ */
+static void remove_entry(response_cache *cache, cache_entry *e);
+
+/**
+ * Renvoie la mémoire comptée pour l'entrée e.
+ */
+static size_t entry_cost(const cache_entry *e);
+
+/*
+ * Fonctions de l'interface
+ */
+
+response_cache *cache_create(size_t max_bytes, long ttl_ms) {
+  response_cache *cache = calloc(1, sizeof *cache);
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->max_bytes = max_bytes;
+  cache->ttl_ms = ttl_ms > 0 ? ttl_ms : 0;
+  cache->nb_buckets = MIN_ENTRY_BUCKETS;
+  while (cache->nb_buckets < max_bytes / AVERAGE_ENTRY_SIZE) {
+    cache->nb_buckets *= 2;
+  }
+  if ((cache->entries = calloc(cache->nb_buckets, sizeof(cache_entry *)))
+      == NULL) {
+    free(cache);
+    return NULL;
+  }
+  if ((cache->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0) {
+    free(cache->entries);
+    free(cache);
+    return NULL;
+  }
+  if ((cache->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    close(cache->inotify_fd);
+    free(cache->entries);
+    free(cache);
+    return NULL;
+  }
+  if (pthread_mutex_init(&cache->mutex, NULL) != 0) {
+    close(cache->stop_fd);
+    close(cache->inotify_fd);
+    free(cache->entries);
+    free(cache);
+    return NULL;
+  }
+  if (pthread_create(&cache->watcher, NULL, run_watcher, cache) != 0) {
+    pthread_mutex_destroy(&cache->mutex);
+    close(cache->stop_fd);
+    close(cache->inotify_fd);
+    free(cache->entries);
+    free(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+int cache_lookup(response_cache *cache, const char *key, size_t key_len,
+    char **data, size_t *size) {
+  if (cache == NULL || key == NULL || data == NULL || size == NULL) {
+    return CACHE_INVALID_POINTER;
+  }
+  size_t hash = hash_key(key, key_len);
+  int r = 0;
+  pthread_mutex_lock(&cache->mutex);
+  drain_events(cache);
+  cache_entry *e = cache->entries[hash % cache->nb_buckets];
+  while (e != NULL && (e->deps.hash != hash || e->deps.key_len != key_len
+      || memcmp(e->deps.key, key, key_len) != 0)) {
+    e = e->next;
+  }
+  if (e != NULL && !deps_valid(cache, &e->deps)) {
+    ++cache->stats.invalidations;
+    remove_entry(cache, e);
+    e = NULL;
+  }
+  if (e == NULL) {
+    ++cache->stats.misses;
+    goto unlock;
+  }
+  // Copie la réponse : l'entrée peut être retirée dès le verrou rendu
+  if ((*data = malloc(MAX(e->size, 1))) == NULL) {
+    r = CACHE_MEMORY_ERROR;
+    goto unlock;
+  }
+  memcpy(*data, e->data, e->size);
+  *size = e->size;
+  ++cache->stats.hits;
+  r = 1;
+  // Remonte l'entrée en tête de la liste LRU
+  if (e != cache->lru_head) {
+    e->lru_prev->lru_next = e->lru_next;
+    if (e->lru_next != NULL) {
+      e->lru_next->lru_prev = e->lru_prev;
+    } else {
+      cache->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    cache->lru_head->lru_prev = e;
+    cache->lru_head = e;
+  }
+unlock:
+  pthread_mutex_unlock(&cache->mutex);
+
+  return r;
+}
+
+cache_pending *cache_begin(response_cache *cache, const char *key,
+    size_t key_len, const char **paths, size_t nb_paths) {
+  if (cache == NULL || key == NULL || nb_paths > CACHE_MAX_PATHS) {
+    errno = EINVAL;
+    return NULL;
+  }
+  cache_pending *p = calloc(1, sizeof *p);
+  if (p == NULL) {
+    return NULL;
+  }
+  if ((p->key = malloc(MAX(key_len, 1))) == NULL) {
+    free(p);
+    return NULL;
+  }
+  memcpy(p->key, key, key_len);
+  p->key_len = key_len;
+  p->hash = hash_key(key, key_len);
+  if (paths == NULL) {
+    // La durée court dès la réservation : la réponse n'est jamais plus
+    // ancienne que prévu
+    p->has_ttl = 1;
+    clock_gettime(CLOCK_MONOTONIC, &p->expires);
+    p->expires.tv_sec += cache->ttl_ms / 1000;
+    p->expires.tv_nsec += (cache->ttl_ms % 1000) * 1000000L;
+    if (p->expires.tv_nsec >= 1000000000L) {
+      ++p->expires.tv_sec;
+      p->expires.tv_nsec -= 1000000000L;
+    }
+  }
+  pthread_mutex_lock(&cache->mutex);
+  p->epoch = cache->epoch;
+  for (size_t i = 0; i < nb_paths && paths != NULL; ++i) {
+    cache_watch *w = acquire_watch(cache, paths[i]);
+    if (w == NULL) {
+      release_deps(cache, p);
+      pthread_mutex_unlock(&cache->mutex);
+      free(p);
+      return NULL;
+    }
+    p->watches[p->nb_watches] = w;
+    p->generations[p->nb_watches] = w->generation;
+    ++p->nb_watches;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  return p;
+}
+
+int cache_commit(response_cache *cache, cache_pending *pending,
+    const char *data, size_t size) {
+  if (cache == NULL || pending == NULL) {
+    return CACHE_INVALID_POINTER;
+  }
+  cache_entry *e = NULL;
+  if (data != NULL && size <= cache_max_entry(cache)
+      && (e = malloc(sizeof *e)) != NULL
+      && (e->data = malloc(MAX(size, 1))) == NULL) {
+    free(e);
+    e = NULL;
+  }
+  int r = 0;
+  pthread_mutex_lock(&cache->mutex);
+  drain_events(cache);
+  if (e == NULL || !deps_valid(cache, pending)) {
+    release_deps(cache, pending);
+    if (e != NULL) {
+      free(e->data);
+      free(e);
+    }
+    goto unlock;
+  }
+  memcpy(e->data, data, size);
+  e->size = size;
+  e->deps = *pending;
+  // Une réponse calculée en parallèle remplace la précédente
+  size_t bucket = e->deps.hash % cache->nb_buckets;
+  for (cache_entry *old = cache->entries[bucket]; old != NULL;
+      old = old->next) {
+    if (old->deps.hash == e->deps.hash && old->deps.key_len == e->deps.key_len
+        && memcmp(old->deps.key, e->deps.key, e->deps.key_len) == 0) {
+      remove_entry(cache, old);
+      break;
+    }
+  }
+  // Evince les entrées les moins récemment utilisées
+  while (cache->lru_tail != NULL
+      && cache->stats.bytes + entry_cost(e) > cache->max_bytes) {
+    ++cache->stats.evictions;
+    remove_entry(cache, cache->lru_tail);
+  }
+  e->next = cache->entries[bucket];
+  cache->entries[bucket] = e;
+  e->lru_prev = NULL;
+  e->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL) {
+    cache->lru_head->lru_prev = e;
+  } else {
+    cache->lru_tail = e;
+  }
+  cache->lru_head = e;
+  cache->stats.bytes += entry_cost(e);
+  ++cache->stats.entries;
+  r = 1;
+unlock:
+  pthread_mutex_unlock(&cache->mutex);
+  free(pending);
+
+  return r;
+}
+
+size_t cache_max_entry(const response_cache *cache) {
+  return cache == NULL ? 0 : cache->max_bytes / MAX_ENTRY_SHARE;
+}
+
+int cache_get_stats(response_cache *cache, cache_stats *stats) {
+  if (cache == NULL || stats == NULL) {
+    return CACHE_INVALID_POINTER;
+  }
+  pthread_mutex_lock(&cache->mutex);
+  *stats = cache->stats;
+  pthread_mutex_unlock(&cache->mutex);
+
+  return 1;
+}
+
+int cache_dispose(response_cache *cache) {
+  if (cache == NULL) {
+    return CACHE_INVALID_POINTER;
+  }
+  int r = 1;
+  // Réveille le thread, qui s'arrête sans tenir le verrou
+  uint64_t one = 1;
+  if (write(cache->stop_fd, &one, sizeof(one)) != (ssize_t) sizeof(one)
+      || pthread_join(cache->watcher, NULL) != 0) {
+    r = CACHE_WATCH_ERROR;
+  }
+  pthread_mutex_lock(&cache->mutex);
+  while (cache->lru_head != NULL) {
+    remove_entry(cache, cache->lru_head);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  if (close(cache->inotify_fd) < 0 || close(cache->stop_fd) < 0) {
+    r = CACHE_WATCH_ERROR;
+  }
+  pthread_mutex_destroy(&cache->mutex);
+  free(cache->entries);
+  free(cache);
+
+  return r;
+}
+
+/*
+ * Fonctions outils
+ */
+
+static void *run_watcher(void *arg) {
+  response_cache *cache = arg;
+  struct pollfd pfds[2] = {
+    { .fd = cache->inotify_fd, .events = POLLIN },
+    { .fd = cache->stop_fd, .events = POLLIN }
+  };
+  while (1) {
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno != EINTR) {
+        return NULL;
+      }
+      continue;
+    }
+    if (pfds[1].revents != 0) {
+      return NULL;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    drain_events(cache);
+    pthread_mutex_unlock(&cache->mutex);
+  }
+
+  return NULL;
+}
+
+static void drain_events(response_cache *cache) {
+  _Alignas(struct inotify_event) char buffer[EVENT_BUFFER_SIZE];
+  ssize_t n;
+  while ((n = read(cache->inotify_fd, buffer, sizeof(buffer))) > 0
+      || (n < 0 && errno == EINTR)) {
+    for (char *p = buffer; p < buffer + n; ) {
+      const struct inotify_event *event = (const struct inotify_event *) p;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Des événements ont été perdus
+        ++cache->epoch;
+      } else {
+        cache_watch *w = find_watch(cache, event->wd);
+        if (w != NULL) {
+          ++w->generation;
+          if (event->mask & IN_IGNORED) {
+            // Le chemin a disparu : le noyau a retiré la surveillance et
+            // pourra réutiliser son numéro
+            cache_watch **link = &cache->watches[(size_t) w->wd
+                % WATCH_BUCKETS];
+            while (*link != w) {
+              link = &(*link)->next;
+            }
+            *link = w->next;
+            w->wd = -1;
+          }
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+static size_t hash_key(const char *key, size_t n) {
+  size_t h = (size_t) 14695981039346656037ULL;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ (unsigned char) key[i]) * (size_t) 1099511628211ULL;
+  }
+
+  return h;
+}
+
+static cache_watch *acquire_watch(response_cache *cache, const char *path) {
+  int wd = inotify_add_watch(cache->inotify_fd, path, WATCH_MASK);
+  if (wd < 0 && errno == ENOENT) {
+    // Surveille le dossier parent pour constater la création du chemin
+    char parent[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+      strcpy(parent, ".");
+    } else if (slash == path) {
+      strcpy(parent, "/");
+    } else if ((size_t) (slash - path) < sizeof(parent)) {
+      memcpy(parent, path, (size_t) (slash - path));
+      parent[slash - path] = '\0';
+    } else {
+      return NULL;
+    }
+    wd = inotify_add_watch(cache->inotify_fd, parent, WATCH_MASK);
+  }
+  if (wd < 0) {
+    return NULL;
+  }
+  // Un même inode donne toujours la même surveillance
+  cache_watch *w = find_watch(cache, wd);
+  if (w == NULL) {
+    if ((w = malloc(sizeof *w)) == NULL) {
+      inotify_rm_watch(cache->inotify_fd, wd);
+      return NULL;
+    }
+    w->wd = wd;
+    w->generation = 0;
+    w->refs = 0;
+    w->next = cache->watches[(size_t) wd % WATCH_BUCKETS];
+    cache->watches[(size_t) wd % WATCH_BUCKETS] = w;
+  }
+  ++w->refs;
+
+  return w;
+}
+
+static void release_watch(response_cache *cache, cache_watch *watch) {
+  if (--watch->refs > 0) {
+    return;
+  }
+  if (watch->wd >= 0) {
+    cache_watch **link = &cache->watches[(size_t) watch->wd % WATCH_BUCKETS];
+    while (*link != watch) {
+      link = &(*link)->next;
+    }
+    *link = watch->next;
+    inotify_rm_watch(cache->inotify_fd, watch->wd);
+  }
+  free(watch);
+}
+
+static cache_watch *find_watch(response_cache *cache, int wd) {
+  if (wd < 0) {
+    return NULL;
+  }
+  cache_watch *w = cache->watches[(size_t) wd % WATCH_BUCKETS];
+  while (w != NULL && w->wd != wd) {
+    w = w->next;
+  }
+
+  return w;
+}
+
+static int deps_valid(const response_cache *cache, const cache_pending *deps) {
+  if (deps->epoch != cache->epoch) {
+    return 0;
+  }
+  for (size_t i = 0; i < deps->nb_watches; ++i) {
+    if (deps->watches[i]->wd < 0
+        || deps->watches[i]->generation != deps->generations[i]) {
+      return 0;
+    }
+  }
+  if (deps->has_ttl) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deps->expires.tv_sec || (now.tv_sec
+        == deps->expires.tv_sec && now.tv_nsec >= deps->expires.tv_nsec)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void release_deps(response_cache *cache, cache_pending *deps) {
+  for (size_t i = 0; i < deps->nb_watches; ++i) {
+    release_watch(cache, deps->watches[i]);
+  }
+  deps->nb_watches = 0;
+  free(deps->key);
+  deps->key = NULL;
+}
+
+static void remove_entry(response_cache *cache, cache_entry *e) {
+  cache_entry **link = &cache->entries[e->deps.hash % cache->nb_buckets];
+  while (*link != e) {
+    link = &(*link)->next;
+  }
+  *link = e->next;
+  if (e->lru_prev != NULL) {
+    e->lru_prev->lru_next = e->lru_next;
+  } else {
+    cache->lru_head = e->lru_next;
+  }
+  if (e->lru_next != NULL) {
+    e->lru_next->lru_prev = e->lru_prev;
+  } else {
+    cache->lru_tail = e->lru_prev;
+  }
+  cache->stats.bytes -= entry_cost(e);
+  --cache->stats.entries;
+  release_deps(cache, &e->deps);
+  free(e->data);
+  free(e);
+}
+
+static size_t entry_cost(const cache_entry *e) {
+  return sizeof(*e) + e->deps.key_len + e->size;
+}
@@ -0,0 +1,132 @@
+/**
+ * Cache thread-safe des réponses des commandes sans effet de bord. Une
+ * entrée reste valable tant que les chemins dont elle dépend ne changent pas
+ * (inotify) ou, pour les sorties calculées depuis /proc, pendant une courte
+ * durée. Les entrées les moins récemment utilisées sont évincées au-delà de
+ * la mémoire allouée au cache.
+ *
+ * @author Jordan ELIE.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/types.h>
+
+/*
+ * Codes d'erreur
+ */
+
+#define CACHE_INVALID_POINTER -1
+#define CACHE_MEMORY_ERROR -2
+#define CACHE_WATCH_ERROR -3
+
+// Nombre maximum de chemins surveillés pour une entrée
+#define CACHE_MAX_PATHS 8
+
+typedef struct response_cache response_cache;
+
+/**
+ * Entrée en cours de calcul, réservée par cache_begin. Les modifications des
+ * chemins survenues depuis sa réservation empêchent son enregistrement.
+ */
+typedef struct cache_pending cache_pending;
+
+/**
+ * Compteurs du cache depuis sa création.
+ */
+typedef struct cache_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;     // Entrées évincées faute de mémoire
+  unsigned long invalidations; // Entrées périmées (chemins modifiés, durée)
+  size_t entries;
+  size_t bytes;                // Mémoire occupée par les entrées
+} cache_stats;
+
+/**
+ * Créé un cache occupant au plus max_bytes octets, dont les entrées à durée
+ * limitée restent valables ttl_ms millisecondes. Un thread lit les
+ * modifications des chemins surveillés.
+ *
+ * @param {size_t} La mémoire maximale des entrées.
+ * @param {long} La durée de validité des entrées à durée limitée.
+ * @return {response_cache *} Le cache ou NULL en cas d'erreur.
+ */
+response_cache *cache_create(size_t max_bytes, long ttl_ms);
+
+/**
+ * Cherche l'entrée key de taille key_len et en copie la réponse dans *data,
+ * qui devra être libéré par l'appelant.
+ *
+ * @param {response_cache *} Le cache.
+ * @param {const char *} La clé.
+ * @param {size_t} La taille de la clé.
+ * @param {char **} L'adresse où stocker la copie de la réponse.
+ * @param {size_t *} L'adresse où stocker la taille de la réponse.
+ * @return {int} 1 si l'entrée est valable, 0 sinon et une valeur négative en
+ *               cas d'erreur.
+ */
+int cache_lookup(response_cache *cache, const char *key, size_t key_len,
+    char **data, size_t *size);
+
+/**
+ * Réserve l'entrée key, qui dépendra des nb_paths chemins paths ou, si
+ * paths vaut NULL, expirera après la durée de validité du cache. La
+ * surveillance commence avant le calcul de la réponse : une modification
+ * concurrente n'est pas perdue. Un chemin absent est remplacé par son
+ * dossier parent.
+ *
+ * @param {response_cache *} Le cache.
+ * @param {const char *} La clé.
+ * @param {size_t} La taille de la clé.
+ * @param {const char **} Les chemins, NULL pour une durée limitée.
+ * @param {size_t} Le nombre de chemins (au plus CACHE_MAX_PATHS).
+ * @return {cache_pending *} La réservation ou NULL si l'entrée ne peut pas
+ *                           être mise en cache.
+ */
+cache_pending *cache_begin(response_cache *cache, const char *key,
+    size_t key_len, const char **paths, size_t nb_paths);
+
+/**
+ * Enregistre les size octets de data comme réponse de la réservation
+ * pending, puis la libère. Si data vaut NULL, ou si un chemin a changé
+ * depuis la réservation, rien n'est enregistré.
+ *
+ * @param {response_cache *} Le cache.
+ * @param {cache_pending *} La réservation.
+ * @param {const char *} La réponse, copiée.
+ * @param {size_t} Sa taille.
+ * @return {int} 1 si la réponse est enregistrée, 0 sinon et une valeur
+ *               négative en cas d'erreur.
+ */
+int cache_commit(response_cache *cache, cache_pending *pending,
+    const char *data, size_t size);
+
+/**
+ * Renvoie la taille maximale d'une réponse pouvant être mise en cache.
+ *
+ * @param {const response_cache *} Le cache.
+ * @return {size_t} La taille maximale.
+ */
+size_t cache_max_entry(const response_cache *cache);
+
+/**
+ * Copie dans stats les compteurs du cache.
+ *
+ * @param {response_cache *} Le cache.
+ * @param {cache_stats *} Les compteurs à remplir.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int cache_get_stats(response_cache *cache, cache_stats *stats);
+
+/**
+ * Arrête la surveillance des chemins et libère le cache et ses entrées.
+ * Aucune réservation ne doit être en cours.
+ *
+ * @param {response_cache *} Le cache.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int cache_dispose(response_cache *cache);
+
+#endif
@@ -25,12 +25,16 @@
 #define USUAL_CMD 1
 #define CUSTOM_CMD 2
 
+// Taille maximale d'un message d'erreur de print_error
+#define LINE_MAX_ERROR 255
+
+// Taille du tampon des fiches utilisateur et groupe (getpwuid_r, getgrgid_r)
+#define ENTRY_BUFFER_SIZE 4096
+
 /*
  * Variables externes
  */
 
-extern char *optarg;
-extern int optind, optopt;
 extern int errno;
 
 /**
@@ -56,27 +60,83 @@ static const int TYPES[] = {
   CUSTOM_CMD, CUSTOM_CMD, CUSTOM_CMD, CUSTOM_CMD, CUSTOM_CMD
 };
 
+/**
+ * Politique de mise en cache de COMMANDS[i] pour tout i allant de 0 à 
+ * |COMMAND|. Les chemins dont dépendent ls et lsl sont leurs arguments.
+ */
+static const int CACHE_POLICIES[] = {
+  CACHE_POLICY_NEVER,
+  // Commandes usuelles
+  CACHE_POLICY_PATHS, CACHE_POLICY_TTL, CACHE_POLICY_PATHS, CACHE_POLICY_NEVER,
+  CACHE_POLICY_NEVER, CACHE_POLICY_NEVER, CACHE_POLICY_NEVER,
+  // Commandes personnalisées
+  CACHE_POLICY_PATHS, CACHE_POLICY_TTL, CACHE_POLICY_NEVER, CACHE_POLICY_PATHS,
+  CACHE_POLICY_TTL
+};
+
+/**
+ * Vaut 1 si COMMANDS[i] peut s'exécuter dans le processus appelant pour tout
+ * i allant de 0 à |COMMAND|. ccp copie une source de taille quelconque (un 
+ * tube, /dev/zero...) : elle reste dans un processus fils, interrompu à 
+ * l'échéance de la requête.
+ */
+static const int IN_PROCESS[] = {
+  0,
+  // Commandes usuelles
+  0, 0, 0, 0, 0, 0, 0,
+  // Commandes personnalisées
+  1, 1, 0, 1, 1
+};
+
 /*
- * Fonctions de traitement des commandes personnalisées.
+ * Fonctions de traitement des commandes personnalisées. Elles écrivent leur
+ * sortie et leurs erreurs sur out et peuvent s'exécuter en parallèle dans 
+ * les threads d'un même processus.
  */
 
-static int exec_help(shm_request *shm_req, size_t argc, const char **argv);
-static int exec_info(shm_request *shm_req, size_t argc, const char **argv);
-static int exec_ccp(shm_request *shm_req, size_t argc, const char **argv);
-static int exec_lsl(shm_request *shm_req, size_t argc, const char **argv);
-static int exec_uinfo(shm_request *shm_req, size_t argc, const char **argv);
+static int exec_help(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv);
+static int exec_info(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv);
+static int exec_ccp(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv);
+static int exec_lsl(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv);
+static int exec_uinfo(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv);
 
 /**
  * Fonctions de COMMANDS[i] pour tout i allant de 0 à |COMMAND|.
  */
-static int (* FUNCTIONS[])(shm_request *, size_t, const char **) = {
+static int (* FUNCTIONS[])(shm_request *, FILE *, size_t, const char **) = {
   NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   exec_help, exec_info, exec_ccp, exec_lsl, exec_uinfo
 };
 
+/*
+ * Ecrit sur out la liste des commandes disponibles.
+ */
+static void write_commands(FILE *out);
+
+/*
+ * Découpe la commande cmd, modifiée, en mots stockés dans tokens et terminés
+ * par NULL. Renvoie le nombre de mots.
+ */
+static size_t split_command(char *cmd, char **tokens);
+
+/*
+ * Equivalent de perror écrivant sur out, utilisable depuis plusieurs 
+ * threads.
+ */
+static void print_error(FILE *out, const char *msg);
+
 void print_commands() {
-  fprintf(stdout,
+  write_commands(stdout);
+}
+
+static void write_commands(FILE *out) {
+  fprintf(out,
     "Liste des commandes usuelles disponibles :\n"
     "    - \033[0;36mls ...\033[0m : Toutes les variantes de ls.\n"
     "    - \033[0;36mps ...\033[0m : Toutes les variantes de ps.\n"
@@ -105,7 +165,8 @@ int is_command_available(const char *cmd) {
   // On récupère la prefixe de la commande à exécuter
   char cmd_cpy[strlen(cmd) + 1];
   strcpy(cmd_cpy, cmd);
-  char *prefix = strtok(cmd_cpy, " ");
+  char *cmd_p = cmd_cpy;
+  char *prefix = strtok_r(cmd_p, " ", &cmd_p);
   if (prefix == NULL) {
     return 0;
   }
@@ -127,15 +188,8 @@ int exec_cmd(const char *cmd, shm_request *shm_req) {
   // Construit le tableau des arguments de la commande 
   char cmd_cpy[strlen(cmd) + 1];
   strcpy(cmd_cpy, cmd);
-  char *cmd_p = cmd_cpy;
   char *tokens[strlen(cmd) + 1];
-  char *token;
-  size_t i = 0;
-  while ((token = strtok_r(cmd_p, " ", &cmd_p))) {
-    tokens[i] = token;
-    ++i;
-  }
-  tokens[i] = NULL;
+  size_t i = split_command(cmd_cpy, tokens);
   if (TYPES[cmd_id] == USUAL_CMD) {
     // Utilise execvp en cas de commande usuelle
     switch (fork()) {
@@ -149,17 +203,107 @@ int exec_cmd(const char *cmd, shm_request *shm_req) {
     }
   } else {
     // Execute la fonction correspondante à la commande personnalisée
-    return FUNCTIONS[cmd_id](shm_req, i, (const char **) tokens);
+    return FUNCTIONS[cmd_id](shm_req, stdout, i, (const char **) tokens);
   }
         
   return 1;
 }
 
+int is_custom_command(const char *cmd) {
+  int cmd_id = is_command_available(cmd);
+
+  return cmd_id > 0 && TYPES[cmd_id] == CUSTOM_CMD && IN_PROCESS[cmd_id];
+}
+
+int exec_custom_cmd(const char *cmd, shm_request *shm_req, FILE *out) {
+  if (cmd == NULL || shm_req == NULL || out == NULL) {
+    return INVALID_POINTER_COMMANDS;
+  }
+  int cmd_id = is_command_available(cmd);
+  if (cmd_id <= 0 || TYPES[cmd_id] != CUSTOM_CMD || !IN_PROCESS[cmd_id]) {
+    return INVALID_COMMAND;
+  }
+  char cmd_cpy[strlen(cmd) + 1];
+  strcpy(cmd_cpy, cmd);
+  char *tokens[strlen(cmd) + 1];
+  size_t argc = split_command(cmd_cpy, tokens);
+
+  return FUNCTIONS[cmd_id](shm_req, out, argc, (const char **) tokens);
+}
+
+int command_cache_policy(const char *cmd, char *tokens, const char **paths, 
+    size_t max, size_t *nb_paths) {
+  if (cmd == NULL || tokens == NULL || paths == NULL || nb_paths == NULL) {
+    return CACHE_POLICY_NEVER;
+  }
+  *nb_paths = 0;
+  int cmd_id = is_command_available(cmd);
+  if (cmd_id <= 0) {
+    return CACHE_POLICY_NEVER;
+  }
+  strcpy(tokens, cmd);
+  char *cmd_p = tokens;
+  const char *name = strtok_r(cmd_p, " ", &cmd_p);
+  const char *arg = strtok_r(cmd_p, " ", &cmd_p);
+  // info sans argument décrit le processus du client
+  if (strcmp(name, "info") == 0 && arg == NULL) {
+    return CACHE_POLICY_NEVER;
+  }
+  if (strcmp(name, "lsl") == 0) {
+    paths[(*nb_paths)++] = arg != NULL ? arg : ".";
+  } else if (strcmp(name, "ls") == 0) {
+    for (; arg != NULL; arg = strtok_r(cmd_p, " ", &cmd_p)) {
+      if (arg[0] != '-') {
+        if (*nb_paths == max) {
+          return CACHE_POLICY_NEVER;
+        }
+        paths[(*nb_paths)++] = arg;
+      } else if (strcmp(arg, "--recursive") == 0 
+          || (arg[1] != '-' && strchr(arg, 'R') != NULL)) {
+        // Les sous-dossiers ne sont pas surveillés
+        return CACHE_POLICY_NEVER;
+      }
+    }
+    if (*nb_paths == 0) {
+      paths[(*nb_paths)++] = ".";
+    }
+  }
+  if (*nb_paths > max) {
+    *nb_paths = 0;
+    return CACHE_POLICY_NEVER;
+  }
+
+  return CACHE_POLICIES[cmd_id];
+}
+
+static size_t split_command(char *cmd, char **tokens) {
+  char *cmd_p = cmd;
+  char *token;
+  size_t i = 0;
+  while ((token = strtok_r(cmd_p, " ", &cmd_p))) {
+    tokens[i] = token;
+    ++i;
+  }
+  tokens[i] = NULL;
+
+  return i;
+}
+
+static void print_error(FILE *out, const char *msg) {
+  int e = errno;
+  char error[LINE_MAX_ERROR + 1];
+  if (strerror_r(e, error, sizeof(error)) != 0) {
+    snprintf(error, sizeof(error), "Erreur %d", e);
+  }
+  fprintf(out, "%s: %s\n", msg, error);
+}
+
 // ---------- Commande : help ----------
 
-static int exec_help(shm_request *shm_req, size_t argc, const char **argv) {
+static int exec_help(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv) {
   if (shm_req && argc && argv[0]) { /* Enlève le warn à la compilation */ }
-  print_commands();
+  write_commands(out);
   return 1;
 }
 
@@ -168,14 +312,16 @@ static int exec_help(shm_request *shm_req, size_t argc, const char **argv) {
 #define PID_NB_NUMBER 7
 #define LINE_MAX_LENGTH 255
 
-static int exec_info(shm_request *shm_req, size_t argc, const char **argv) {
+static int exec_info(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv) {
   char pid[PID_NB_NUMBER + 1];
   if (argc < 2) {
     snprintf(pid, PID_NB_NUMBER, "%d", shm_req->pid);
   } else {
     strncpy(pid, argv[1], PID_NB_NUMBER);
+    pid[PID_NB_NUMBER] = '\0';
   }
-	fprintf(stdout, "----- Caractéristiques du programme %s -----\n", pid);
+	fprintf(out, "----- Caractéristiques du programme %s -----\n", pid);
 
 	/*
 	 * cmdline
@@ -184,7 +330,7 @@ static int exec_info(shm_request *shm_req, size_t argc, const char **argv) {
 	// Créé le nom de fichier à trouver pour cmdline
 	char *str = malloc(sizeof("/proc//cmdline") + strlen(pid) * sizeof(char));
 	if (str == NULL) {
-		fprintf(stdout, "Pas assez d'espace mémoire\n");
+		fprintf(out, "Pas assez d'espace mémoire\n");
 		return EXEC_ERROR;
 	}
 	sprintf(str, "/proc/%s/cmdline", pid);
@@ -192,21 +338,18 @@ static int exec_info(shm_request *shm_req, size_t argc, const char **argv) {
 	FILE *cmd = fopen(str, "r");
 	if (cmd == NULL) {
 		free(str);
-		fprintf(stdout, "Impossible d'ouvrir le fichier cmdline\n");
+		fprintf(out, "Impossible d'ouvrir le fichier cmdline\n");
 		return EXEC_ERROR;
 	}
 	char line[LINE_MAX_LENGTH + 1];
 	if (fgets(line, LINE_MAX_LENGTH, cmd) == NULL) {
-    fprintf(stdout, 
-        "Une erreur est survenue lors de la lecture du fichier\n");
-  }
-	if (line == NULL) {
+		fclose(cmd);
 		free(str);
-		fprintf(stdout, "Impossible de lire le fichier cmdline\n");
+		fprintf(out, "Impossible de lire le fichier cmdline\n");
 		return EXEC_ERROR;
 	}
 	// Affiche la commande ayant executé le fichier
-	fprintf(stdout, "[%s] Command : %s\n", pid, line);
+	fprintf(out, "[%s] Command : %s\n", pid, line);
 	fclose(cmd);
 	free(str);
 	
@@ -215,32 +358,28 @@ static int exec_info(shm_request *shm_req, size_t argc, const char **argv) {
 	 */
 	str = malloc(sizeof("/proc//status") + strlen(pid) * sizeof(char));
 	if (str == NULL) {
-		fprintf(stdout, "Pas assez d'espace mémoire\n");
+		fprintf(out, "Pas assez d'espace mémoire\n");
 		return EXEC_ERROR;
 	}
 	sprintf(str, "/proc/%s/status", pid);
 	FILE *status = fopen(str, "r");
 	if (status == NULL) {
 		free(str);
-		fprintf(stdout, "Impossible d'ouvrir le fichier status\n");
+		fprintf(out, "Impossible d'ouvrir le fichier status\n");
 		return EXEC_ERROR;
 	}
 	for (size_t i = 0; i < 7; ++i) {
 		if (fgets(line, LINE_MAX_LENGTH, status) == NULL) {
-      fprintf(stdout, 
-          "Une erreur est survenue lors de la lecture du fichier\n");
-    }
-		if (line == NULL) {
 			free(str);
 			fclose(status);
-			fprintf(stdout, "Impossible de lire le fichier status\n");
+			fprintf(out, "Impossible de lire le fichier status\n");
 			return EXEC_ERROR;
 		}
 		switch(i) {
 			case 2:
 			case 3:
 			case 6:
-				fprintf(stdout, "[%s] %s", pid, line);
+				fprintf(out, "[%s] %s", pid, line);
 				break;
 			default:
 				break;
@@ -269,15 +408,19 @@ static int exec_info(shm_request *shm_req, size_t argc, const char **argv) {
 // Nombre maximum de caractères pour la date de modification.
 #define MAX_MODIF_STR_SIZE 50
 
+// Nombre maximum de caractères affichés pour un nom d'utilisateur ou de 
+// groupe.
+#define MAX_ID_STR_SIZE 32
+
 // Taille d'un code couleur dans le terminal. Utilisé dans get_color.
 #define COLOR_SIZE 9
 
 /*
- * Ecrit les informations d'un fichier sur la sortie standard. La liste de ses
- * informations est donnée sur la question 1 du TP6. Renvoie 0 si tout
- * se passe bien et FILE_NOT_FOUND si le fichier est introuvable.
+ * Ecrit les informations d'un fichier sur out. La liste de ses informations
+ * est donnée sur la question 1 du TP6. Renvoie 0 si tout se passe bien et 
+ * FILE_NOT_FOUND si le fichier est introuvable.
  */
-static int print_file_info(const char *filepath);
+static int print_file_info(FILE *out, const char *filepath);
 
 /*
  * Ecrit la représentation textuelle du mode dans buffer. Ecrit au maximum
@@ -292,28 +435,28 @@ static int strmode(mode_t mode, char *buffer, size_t n);
  */
 static void get_color(char *buffer, size_t n, char t);
 
-static int exec_lsl(shm_request *shm_req, size_t argc, const char **argv) {
+static int exec_lsl(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv) {
   if (shm_req) { /* Enlève le warn à la compilation */ }
   char dir_path[PATH_MAX + 1];
   // Détermine le dossier sur lequel éxecuter 
   if (argc == 1) {
     strncpy(dir_path, ".", PATH_MAX);
   } else {
-    if (argv[1][strlen(argv[1]) - 1] == '/') {
-      strncpy(dir_path, argv[1], PATH_MAX + 1);
-    } else {
-      strncpy(dir_path, argv[1], PATH_MAX);
+    // Vérifie que le dossier et le '/' final tiennent dans dir_path
+    size_t length = strlen(argv[1]);
+    if (length >= PATH_MAX) {
+      fprintf(out, "Erreur : Le chemin spécifié est trop long\n");
+      return EXEC_ERROR;
+    }
+    strcpy(dir_path, argv[1]);
+    if (argv[1][length - 1] != '/') {
       strcat(dir_path, "/");
-      // Vérifie que le dossier n'ai pas été tronqué
-      if (dir_path[PATH_MAX] != '\0') {
-        fprintf(stdout, "Erreur : Le chemin spécifié est trop long\n");
-        return EXEC_ERROR;
-      }
     }
   }
   DIR *dir = opendir(dir_path);
   if (dir == NULL) {
-    perror("Impossible d'ouvrir le dossier ");
+    print_error(out, "Impossible d'ouvrir le dossier ");
     return EXEC_ERROR;
   }
   errno = 0;
@@ -329,51 +472,71 @@ static int exec_lsl(shm_request *shm_req, size_t argc, const char **argv) {
       strcpy(fullname, (argc > 1) ? dir_path : "");
       strncat(fullname, entry->d_name, PATH_MAX + 1);
       if (strlen(fullname) > PATH_MAX + 1) {
-        fprintf(stdout, "Erreur : Chemin invalide\n");
+        fprintf(out, "Erreur : Chemin invalide\n");
         r = EXEC_ERROR;
         goto close;
       }
-      if (print_file_info(fullname) == FILE_NOT_FOUND) {
-        fprintf(stdout, "Erreur : Fichier innatendu %s\n", fullname);
+      if (print_file_info(out, fullname) == FILE_NOT_FOUND) {
+        fprintf(out, "Erreur : Fichier innatendu %s\n", fullname);
         r = EXEC_ERROR;
         goto close;
       }
     }
   }
   if (errno != 0) {
-    perror("Erreur lors de la lecture ");
+    print_error(out, "Erreur lors de la lecture ");
     r = EXEC_ERROR;
     goto close;
   }
 close:
   if (closedir(dir) == -1) {
-    perror("Erreur lors de la fermeture du dossier ");
+    print_error(out, "Erreur lors de la fermeture du dossier ");
     return EXEC_ERROR;
   }
 
   return r;
 }
 
-static int print_file_info(const char *filepath) {
+static int print_file_info(FILE *out, const char *filepath) {
   struct stat stats;
   if (lstat(filepath, &stats) < 0) {
     return FILE_NOT_FOUND;
   }
   char mode_str[MODE_STR_LENGTH + 1];
   if (strmode(stats.st_mode, mode_str, MODE_STR_LENGTH + 1) != 0) {
-    fprintf(stdout, "Warning : Mode tronqué\n");
+    fprintf(out, "Warning : Mode tronqué\n");
+  }
+  // Infos utilisateur et groupe. Un identifiant sans fiche est affiché tel 
+  // quel.
+  struct passwd user_entry;
+  struct passwd *user_info;
+  char user_buffer[ENTRY_BUFFER_SIZE];
+  char user_name[MAX_ID_STR_SIZE + 1];
+  if (getpwuid_r(stats.st_uid, &user_entry, user_buffer, 
+      sizeof(user_buffer), &user_info) != 0 || user_info == NULL) {
+    snprintf(user_name, sizeof(user_name), "%u", stats.st_uid);
+  } else {
+    snprintf(user_name, sizeof(user_name), "%s", user_info->pw_name);
+  }
+  struct group group_entry;
+  struct group *group_info;
+  char group_buffer[ENTRY_BUFFER_SIZE];
+  char group_name[MAX_ID_STR_SIZE + 1];
+  if (getgrgid_r(stats.st_gid, &group_entry, group_buffer, 
+      sizeof(group_buffer), &group_info) != 0 || group_info == NULL) {
+    snprintf(group_name, sizeof(group_name), "%u", stats.st_gid);
+  } else {
+    snprintf(group_name, sizeof(group_name), "%s", group_info->gr_name);
   }
-  // Infos utilisateur et groupe
-  struct passwd *user_info = getpwuid(stats.st_uid);
-  struct group *group_info = getgrgid(stats.st_gid);
   // Formate la date
+  struct tm modif_tm;
   char last_modif[MAX_MODIF_STR_SIZE + 1];
   size_t modif_writed = strftime(
     last_modif, MAX_MODIF_STR_SIZE + 1, 
-    "%b.  %d %R", gmtime(&stats.st_mtim.tv_sec)
+    "%b.  %d %R", gmtime_r(&stats.st_mtim.tv_sec, &modif_tm)
   );
   if (modif_writed == 0) {
-    fprintf(stdout, "Erreur : Impossible d'écrire la date de dernière "
+    fprintf(out, "Erreur : Impossible d'écrire la date de dernière "
         "modification\n");
     return PRINT_ERROR;
   }
@@ -383,10 +546,10 @@ static int print_file_info(const char *filepath) {
   get_color(color, COLOR_SIZE + 1, mode_str[0]);
   // Affichage
   fprintf(
-    stdout, 
+    out, 
     "%-8lu %s %-4lu %-8s %-8s %-10lu %s %s%s\033[0m\n",
-    stats.st_ino, mode_str, stats.st_nlink, user_info->pw_name, 
-    group_info->gr_name, stats.st_size, last_modif, color, filepath
+    stats.st_ino, mode_str, stats.st_nlink, user_name, 
+    group_name, stats.st_size, last_modif, color, filepath
   );
   
   return 0;
@@ -488,93 +651,110 @@ static void get_color(char *buffer, size_t n, char t) {
  */
 static int ccp(int fd_src, int fd_dest, long max);
 
-static int exec_ccp(shm_request *shm_req, size_t argc, const char **argv) {
+static int exec_ccp(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv) {
   if (shm_req) { /* Enlève le warn */ }
-	if (argc == 1) {
-		fprintf(stderr, 
-        "Arguments manquants, tapez help pour plus d'information\n");
-		return EXEC_ERROR;
-	}
-	// Analyse des arguments
-	char *src_file;
-	char *dest_file;
+	// Analyse des arguments. getopt n'est pas utilisé : son état est global 
+	// au processus.
+	const char *src_file = NULL;
+	const char *dest_file = NULL;
 	int src_mode = 0;
 	int dest_mode = O_TRUNC;
 	long bvalue = 0;
-	long evalue = -1;	
-	char c;
-	while (
-    (c = (char) getopt((int) argc, (char *const *) argv, "f:d:vab:e:")) != -1
-  ) {
-		switch (c) {
-			case 'f':
-				src_file = optarg;
-				break;
-			case 'd':
-				dest_file = optarg;
-				break;
-			case 'v':
-				src_mode = O_EXCL;
-				break;
-			case 'a':
-				dest_mode = O_APPEND;
-				break;
-			case 'b':
-				bvalue = atol(optarg);
-				if (bvalue < 0) {
-					fprintf(stderr, "Value of -b must be positive.\n");
+	long evalue = -1;
+	for (size_t i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-') {
+			continue;
+		}
+		for (const char *opt = argv[i] + 1; *opt != '\0'; ++opt) {
+			char c = *opt;
+			// La valeur suit l'option ou forme l'argument suivant
+			const char *value = NULL;
+			if (strchr("fdbe", c) != NULL) {
+				if (opt[1] != '\0') {
+					value = opt + 1;
+				} else if (i + 1 < argc) {
+					value = argv[++i];
+				} else {
+					fprintf(out, "Option -%c need value.\n", c);
 					return EXEC_ERROR;
 				}
-				break;
-			case 'e':
-				evalue = atol(optarg);
-				if (evalue < bvalue) {
-					fprintf(stderr, 
-              "Value of -e must be positive and greater than -b.\n");
+			}
+			switch (c) {
+				case 'f':
+					src_file = value;
+					break;
+				case 'd':
+					dest_file = value;
+					break;
+				case 'v':
+					src_mode = O_EXCL;
+					break;
+				case 'a':
+					dest_mode = O_APPEND;
+					break;
+				case 'b':
+					bvalue = atol(value);
+					if (bvalue < 0) {
+						fprintf(out, "Value of -b must be positive.\n");
+						return EXEC_ERROR;
+					}
+					break;
+				case 'e':
+					evalue = atol(value);
+					if (evalue < bvalue) {
+						fprintf(out, 
+                "Value of -e must be positive and greater than -b.\n");
+						return EXEC_ERROR;
+					}
+					break;
+				default:
+					if (isprint(c)) {
+						fprintf(out, "Unknown option `-%c'.\n", c);
+					} else {
+						fprintf(out, "Unknown option, use -h for help");
+					}
 					return EXEC_ERROR;
-				}
+			}
+			if (value != NULL) {
 				break;
-			case '?':
-				if (optopt == 'f' || optopt == 'd' || optopt == 'b' || optopt == 'e') {
-					fprintf(stderr, "Option -%c need value.\n", optopt);
-				} else if (isprint(optopt)) {
-					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
-				} else {
-					fprintf(stderr, "Unknown option, use -h for help");
-				}
-				return EXEC_ERROR;
-				break;
-			default:
-				abort();
+			}
 		}
 	}
+	if (src_file == NULL || dest_file == NULL) {
+		fprintf(out, 
+        "Arguments manquants, tapez help pour plus d'information\n");
+		return EXEC_ERROR;
+	}
 	// Ouvre le fichier source et seek
 	int src_fd;
-	if ((src_fd = open(src_file, O_CREAT | src_mode, S_IRWXU)) == -1) {
-		fprintf(stderr, "Cannot open %s.\n", src_file);
+	if ((src_fd = open(src_file, O_CREAT | O_CLOEXEC | src_mode, S_IRWXU)) 
+      == -1) {
+		fprintf(out, "Cannot open %s.\n", src_file);
 		return EXEC_ERROR;
 	}
 	if (lseek(src_fd, (off_t) bvalue, SEEK_SET) == -1) {
-		fprintf(stderr, "Cannot seek file to value %ld", bvalue);
+		fprintf(out, "Cannot seek file to value %ld", bvalue);
 		close(src_fd);
 		return EXEC_ERROR;
 	}
 	// Ouvre le fichier de destination
 	int dest_fd;
 	if (
-    (dest_fd = open(dest_file, O_CREAT | O_WRONLY | dest_mode, S_IRWXU)) == -1
+    (dest_fd = open(dest_file, O_CREAT | O_WRONLY | O_CLOEXEC | dest_mode, 
+        S_IRWXU)) == -1
   ) {
-		fprintf(stderr, "Cannot open %s.\n", dest_file);
+		fprintf(out, "Cannot open %s.\n", dest_file);
 		close(src_fd);
 		return EXEC_ERROR;
 	}
 	// Lance la copie
 	int ccp_r = ccp(src_fd, dest_fd, (off_t) evalue);
+	close(src_fd);
+	close(dest_fd);
 	if (ccp_r != 0) {
-		fprintf(stderr, 
+		fprintf(out, 
 		  (ccp_r == READ_ERROR) ? "Read error.\n" : "Write error.\n");
-		close(src_fd);
-		close(dest_fd);
 		return EXEC_ERROR;
 	}
 	
@@ -600,16 +780,21 @@ static int ccp(int fd_src, int fd_dest, off_t max) {
 
 // ---------- Commande : uinfo ----------
 
-static int exec_uinfo(shm_request *shm_req, size_t argc, const char **argv) {
+static int exec_uinfo(shm_request *shm_req, FILE *out, size_t argc, 
+    const char **argv) {
   if (argc && argv) { /* Enlève le warn */ }
+  struct passwd entry;
   struct passwd *result;
+  char buffer[ENTRY_BUFFER_SIZE];
   // Récupère les données de l'utilisateur
-  if ((result = getpwuid(shm_req->uid)) == NULL) {
-    fprintf(stderr, 
+  if (getpwuid_r(shm_req->uid, &entry, buffer, sizeof(buffer), &result) != 0
+      || result == NULL) {
+    fprintf(out, 
         "Une erreur est survenue lors de la récupération de vos données\n");
+    return EXEC_ERROR;
   }
   // Affiche les données
-  fprintf(stdout, 
+  fprintf(out, 
       "Nom d'utilisateur : %s\n"
       "UID : %d\n"
       "GID : %d\n"
@@ -620,4 +805,4 @@ static int exec_uinfo(shm_request *shm_req, size_t argc, const char **argv) {
   );
 
   return 1;
-}
\ No newline at end of file
+}
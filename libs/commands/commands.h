@@ -9,6 +9,7 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <stdio.h>
 #include "../connection/connection.h"
 
 /*
@@ -18,6 +19,18 @@
 #define EXEC_ERROR -2
 #define INVALID_POINTER_COMMANDS -3
 
+/*
+ * Politiques de mise en cache de la sortie d'une commande
+ */
+
+// La commande modifie le système ou sa sortie varie à chaque exécution
+#define CACHE_POLICY_NEVER 0
+// La sortie, calculée depuis /proc, reste valable un court instant
+#define CACHE_POLICY_TTL 1
+// La sortie reste valable tant que les chemins dont elle dépend ne changent
+// pas (aucun chemin : sortie invariable)
+#define CACHE_POLICY_PATHS 2
+
 /**
  * Affiche sur la sortie standard la liste des commandes pouvant être exécutées
  * par cette interface.
@@ -43,4 +56,46 @@ int is_command_available(const char *cmd);
  */
 int exec_cmd(const char *cmd, shm_request *shm_req);
 
+/**
+ * Renvoie 1 si cmd est une commande personnalisée exécutable dans le 
+ * processus appelant par exec_custom_cmd, et 0 sinon. ccp, dont la durée 
+ * n'est pas bornée, doit passer par exec_cmd dans un processus fils.
+ * 
+ * @param {const char *} La commande.
+ * @return {int} 1 si la commande peut s'exécuter dans le processus appelant
+ *               et 0 sinon.
+ */
+int is_custom_command(const char *cmd);
+
+/**
+ * Exécute la commande personnalisée cmd dans le thread appelant, sans créer
+ * de processus, en écrivant sa sortie et ses erreurs sur out. Plusieurs 
+ * commandes peuvent s'exécuter en parallèle. cmd doit vérifier 
+ * is_custom_command.
+ * 
+ * @param {const char *} La commande à exécuter.
+ * @param {shm_request *} La requête shm du client.
+ * @param {FILE *} Le flux recevant la sortie.
+ * @return {int} 1 en cas de succès et un nombre négatif en cas d'erreur.
+ */
+int exec_custom_cmd(const char *cmd, shm_request *shm_req, FILE *out);
+
+/**
+ * Indique si la sortie de la commande cmd peut être réutilisée pour une 
+ * commande identique et, pour CACHE_POLICY_PATHS, découpe dans tokens les 
+ * chemins dont elle dépend. Les commandes modifiant le système (rm, touch, 
+ * mkdir, ccp) ne le sont jamais.
+ * 
+ * @param {const char *} La commande.
+ * @param {char *} Un tampon d'au moins strlen(cmd) + 1 octets.
+ * @param {const char **} Le tableau où stocker les chemins, pointant dans 
+ *                        tokens.
+ * @param {size_t} La taille du tableau.
+ * @param {size_t *} L'adresse où stocker le nombre de chemins.
+ * @return {int} La politique (CACHE_POLICY_*). CACHE_POLICY_NEVER si la 
+ *               commande est invalide ou dépend de plus de max chemins.
+ */
+int command_cache_policy(const char *cmd, char *tokens, const char **paths, 
+    size_t max, size_t *nb_paths);
+
 #endif
\ No newline at end of file
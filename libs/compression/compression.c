@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <string.h>
+#include "compression.h"
+
+/*
+ * Format d'un bloc : une suite de séquences. Chaque séquence commence par un
+ * jeton dont les 4 bits de poids fort donnent le nombre de littéraux et les
+ * 4 bits de poids faible la longueur de la copie moins LZ_MIN_MATCH. Une 
+ * valeur de 15 est prolongée par des octets ajoutés jusqu'au premier octet 
+ * différent de 255. Suivent les littéraux puis le décalage de la copie sur 2
+ * octets (petit-boutiste). La dernière séquence ne contient que des 
+ * littéraux.
+ */
+
+// Longueur minimale d'une copie
+#define LZ_MIN_MATCH 4
+
+// Décalage maximal d'une copie
+#define LZ_MAX_OFFSET 65535
+
+// Valeur d'un demi-jeton indiquant une longueur prolongée
+#define LZ_RUN_MASK 15
+
+// Nombre de bits de la table de hachage des positions
+#define LZ_HASH_LOG 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_LOG)
+
+/**
+ * Lit 4 octets non alignés.
+ */
+static uint32_t read32(const unsigned char *p);
+
+/**
+ * Renvoie l'entrée de la table de hachage associée à la séquence seq.
+ */
+static uint32_t hash32(uint32_t seq);
+
+/**
+ * Ecrit la longueur prolongée len (déjà diminuée de LZ_RUN_MASK) à partir de
+ * dst[*op]. Renvoie 0 en cas de succès et -1 si capacity est dépassée.
+ */
+static int write_length(unsigned char *dst, size_t *op, size_t capacity, 
+    size_t len);
+
+/**
+ * Lit une longueur prolongée à partir de src[*ip] et l'ajoute à *len. 
+ * Renvoie 0 en cas de succès et -1 si le bloc se termine prématurément.
+ */
+static int read_length(const unsigned char *src, size_t *ip, size_t n, 
+    size_t *len);
+
+/**
+ * Ecrit une séquence de lit_len littéraux lits suivie d'une copie de 
+ * longueur match_len au décalage offset (match_len nul pour la dernière 
+ * séquence). Renvoie 0 en cas de succès et -1 si capacity est dépassée.
+ */
+static int write_sequence(unsigned char *dst, size_t *op, size_t capacity,
+    const unsigned char *lits, size_t lit_len, size_t offset, 
+    size_t match_len);
+
+size_t lz_compress_bound(size_t n) {
+  // Pire cas : un seul jeton, n littéraux et leur longueur prolongée
+  return n + n / 255 + 16;
+}
+
+ssize_t lz_compress(const char *src, size_t n, char *dst, size_t capacity) {
+  if (src == NULL || dst == NULL) {
+    return LZ_INVALID_POINTER;
+  }
+  const unsigned char *in = (const unsigned char *) src;
+  unsigned char *out = (unsigned char *) dst;
+  // La table stocke la position + 1 de la dernière occurrence de chaque 
+  // séquence de 4 octets (0 si aucune)
+  uint32_t table[LZ_HASH_SIZE];
+  memset(table, 0, sizeof(table));
+  size_t ip = 0;
+  size_t anchor = 0;
+  size_t op = 0;
+  while (n >= LZ_MIN_MATCH && ip <= n - LZ_MIN_MATCH) {
+    uint32_t seq = read32(in + ip);
+    uint32_t h = hash32(seq);
+    size_t ref = table[h];
+    table[h] = (uint32_t) (ip + 1);
+    if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET 
+        || read32(in + ref - 1) != seq) {
+      ++ip;
+      continue;
+    }
+    --ref;
+    // Prolonge la copie autant que possible
+    size_t len = LZ_MIN_MATCH;
+    while (ip + len < n && in[ref + len] == in[ip + len]) {
+      ++len;
+    }
+    if (write_sequence(out, &op, capacity, in + anchor, ip - anchor, 
+        ip - ref, len) < 0) {
+      return LZ_OUTPUT_TOO_SMALL;
+    }
+    ip += len;
+    anchor = ip;
+  }
+  // Dernière séquence : les littéraux restants
+  if (write_sequence(out, &op, capacity, in + anchor, n - anchor, 0, 0) < 0) {
+    return LZ_OUTPUT_TOO_SMALL;
+  }
+
+  return (ssize_t) op;
+}
+
+ssize_t lz_decompress(const char *src, size_t n, char *dst, size_t capacity) {
+  if (src == NULL || dst == NULL) {
+    return LZ_INVALID_POINTER;
+  }
+  const unsigned char *in = (const unsigned char *) src;
+  unsigned char *out = (unsigned char *) dst;
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < n) {
+    unsigned char token = in[ip++];
+    // Littéraux
+    size_t lit_len = (size_t) (token >> 4);
+    if (lit_len == LZ_RUN_MASK && read_length(in, &ip, n, &lit_len) < 0) {
+      return LZ_CORRUPTED_INPUT;
+    }
+    if (lit_len > n - ip) {
+      return LZ_CORRUPTED_INPUT;
+    }
+    if (lit_len > capacity - op) {
+      return LZ_OUTPUT_TOO_SMALL;
+    }
+    memcpy(out + op, in + ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    // La dernière séquence ne contient pas de copie
+    if (ip == n) {
+      break;
+    }
+    // Copie
+    if (n - ip < 2) {
+      return LZ_CORRUPTED_INPUT;
+    }
+    size_t offset = (size_t) in[ip] | ((size_t) in[ip + 1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return LZ_CORRUPTED_INPUT;
+    }
+    size_t match_len = (size_t) (token & LZ_RUN_MASK);
+    if (match_len == LZ_RUN_MASK 
+        && read_length(in, &ip, n, &match_len) < 0) {
+      return LZ_CORRUPTED_INPUT;
+    }
+    match_len += LZ_MIN_MATCH;
+    if (match_len > capacity - op) {
+      return LZ_OUTPUT_TOO_SMALL;
+    }
+    // Copie octet par octet car la source peut chevaucher la destination
+    const unsigned char *from = out + op - offset;
+    for (size_t i = 0; i < match_len; ++i) {
+      out[op + i] = from[i];
+    }
+    op += match_len;
+  }
+
+  return (ssize_t) op;
+}
+
+/*
+ * Fonctions outils
+ */
+
+static uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static uint32_t hash32(uint32_t seq) {
+  return (seq * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+static int write_length(unsigned char *dst, size_t *op, size_t capacity, 
+    size_t len) {
+  while (len >= 255) {
+    if (*op >= capacity) {
+      return -1;
+    }
+    dst[(*op)++] = 255;
+    len -= 255;
+  }
+  if (*op >= capacity) {
+    return -1;
+  }
+  dst[(*op)++] = (unsigned char) len;
+
+  return 0;
+}
+
+static int read_length(const unsigned char *src, size_t *ip, size_t n, 
+    size_t *len) {
+  unsigned char b;
+  do {
+    if (*ip >= n) {
+      return -1;
+    }
+    b = src[(*ip)++];
+    *len += b;
+  } while (b == 255);
+
+  return 0;
+}
+
+static int write_sequence(unsigned char *dst, size_t *op, size_t capacity,
+    const unsigned char *lits, size_t lit_len, size_t offset, 
+    size_t match_len) {
+  if (*op >= capacity) {
+    return -1;
+  }
+  size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+  dst[(*op)++] = (unsigned char) 
+      ((lit_len < LZ_RUN_MASK ? lit_len : LZ_RUN_MASK) << 4
+      | (match_code < LZ_RUN_MASK ? match_code : LZ_RUN_MASK));
+  if (lit_len >= LZ_RUN_MASK 
+      && write_length(dst, op, capacity, lit_len - LZ_RUN_MASK) < 0) {
+    return -1;
+  }
+  if (lit_len > capacity - *op) {
+    return -1;
+  }
+  memcpy(dst + *op, lits, lit_len);
+  *op += lit_len;
+  if (match_len == 0) {
+    return 0;
+  }
+  if (capacity - *op < 2) {
+    return -1;
+  }
+  dst[(*op)++] = (unsigned char) (offset & 0xFF);
+  dst[(*op)++] = (unsigned char) (offset >> 8);
+  if (match_code >= LZ_RUN_MASK 
+      && write_length(dst, op, capacity, match_code - LZ_RUN_MASK) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * Interface de compression rapide par blocs de la famille LZ77 (format
+ * proche de LZ4). Chaque bloc est compressé et décompressé indépendamment,
+ * ce qui permet de les transmettre comme des morceaux distincts.
+ * 
+ * @author Jordan ELIE.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <sys/types.h>
+
+/*
+ * Codes d'erreur
+ */
+
+#define LZ_INVALID_POINTER -1
+#define LZ_OUTPUT_TOO_SMALL -2
+#define LZ_CORRUPTED_INPUT -3
+
+/**
+ * Renvoie la taille maximale que peut occuper la compression de n octets.
+ * 
+ * @param {size_t} La taille des données à compresser.
+ * @return {size_t} La taille maximale des données compressées.
+ */
+size_t lz_compress_bound(size_t n);
+
+/**
+ * Compresse les n octets de src dans dst qui peut contenir capacity octets.
+ * 
+ * @param {const char *} Les données à compresser.
+ * @param {size_t} La taille des données à compresser.
+ * @param {char *} Le tampon où écrire le bloc compressé.
+ * @param {size_t} La taille du tampon dst.
+ * @return {ssize_t} La taille du bloc compressé, LZ_OUTPUT_TOO_SMALL si dst
+ *                   est trop petit ou LZ_INVALID_POINTER.
+ */
+ssize_t lz_compress(const char *src, size_t n, char *dst, size_t capacity);
+
+/**
+ * Décompresse le bloc de n octets src dans dst qui peut contenir capacity
+ * octets.
+ * 
+ * @param {const char *} Le bloc compressé.
+ * @param {size_t} La taille du bloc compressé.
+ * @param {char *} Le tampon où écrire les données décompressées.
+ * @param {size_t} La taille du tampon dst.
+ * @return {ssize_t} La taille des données décompressées, LZ_OUTPUT_TOO_SMALL
+ *                   si dst est trop petit, LZ_CORRUPTED_INPUT si le bloc est 
+ *                   invalide ou LZ_INVALID_POINTER.
+ */
+ssize_t lz_decompress(const char *src, size_t n, char *dst, size_t capacity);
+
+#endif
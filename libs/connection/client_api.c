@@ -0,0 +1,812 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include "client_api.h"
+
+#ifndef NAME_MAX
+
+#define NAME_MAX 255
+
+#endif
+
+// Nombre maximum d'événements traités par attente de client_loop_run
+#define LOOP_MAX_EVENTS 64
+
+// Nombre maximum de morceaux lus d'affilée sur une même session, afin de ne
+// pas affamer les autres
+#define LOOP_CHUNK_BUDGET 64
+
+/*
+ * Session d'un client
+ */
+
+typedef struct async_op {
+  unsigned int handle;
+  unsigned int id;
+  char *cmd; // Copie de la commande, libérée à l'envoi
+  int flags;
+  client_callback callback;
+  void *arg;
+  time_t timeout;
+  struct timespec deadline; // Echéance du prochain morceau, une fois envoyée
+  char *data; // Réponse concaténée (sans CLIENT_STREAM)
+  size_t size;
+  struct async_op *next;
+} async_op;
+
+struct remote_client {
+  session *s;
+  request_fifo *req_fifo;
+  response_fifo *res_fifo;
+  // Identifiant de la prochaine requête
+  unsigned int next_id;
+  // La session est désynchronisée ou rompue et ne doit plus servir
+  int broken;
+  int transport;
+  // Requêtes asynchrones, dans l'ordre de soumission : les in_flight
+  // premières ont été envoyées, à partir de unsent elles attendent leur tour
+  client_loop *loop;
+  async_op *first_op;
+  async_op *last_op;
+  async_op *unsent;
+  size_t in_flight;
+  int registered_fd; // Descripteur surveillé par la boucle (-1 si aucun)
+  remote_client *prev;
+  remote_client *next;
+};
+
+struct client_loop {
+  int epoll_fd;
+  unsigned int next_handle;
+  size_t pending;
+  remote_client *clients;
+};
+
+// Premier délai de nouvelle tentative d'une requête de connexion refusée, 
+// doublé à chaque refus
+#define BACKOFF_BASE_MS 10
+
+// Délai maximum entre deux tentatives, hors délai suggéré par le serveur
+#define BACKOFF_MAX_MS 2000
+
+// Distingue les sessions d'un même processus
+static atomic_uint session_counter = 0;
+
+/**
+ * Envoie au serveur de la file server_q la requête de connexion d'une 
+ * session de transport transport, identifiée par name (tube de requête, 
+ * segment ou socket) et response_pipe pour TRANSPORT_FIFO. Tant que le 
+ * serveur la refuse (SERVER_IS_FULL), elle est renvoyée après un délai
+ * croissant, tiré au hasard pour que les clients refusés ensemble ne 
+ * reviennent pas ensemble, et au moins égal au délai suggéré par le serveur.
+ *
+ * @param {server_queue *} La file du serveur.
+ * @param {int} Le transport de la session.
+ * @param {const char *} Le nom de la session.
+ * @param {const char *} Le tube de réponse (TRANSPORT_FIFO).
+ * @param {int} Les capacités du client.
+ * @param {time_t} Un timeout pour l'ensemble des tentatives.
+ * @return {int} Le retour de la dernière tentative, 0 si la requête n'a pas
+ *               été acceptée avant le timeout.
+ */
+static int send_with_backoff(server_queue *server_q, int transport,
+    const char *name, const char *response_pipe, int capabilities,
+    time_t timeout);
+
+/**
+ * Renvoie le nombre de millisecondes écoulées depuis start (CLOCK_MONOTONIC).
+ *
+ * @param {const struct timespec *} L'instant de départ.
+ * @return {long} La durée écoulée.
+ */
+static long elapsed_ms(const struct timespec *start);
+
+/**
+ * Envoie les requêtes en attente du client c dans la limite de la fenêtre de
+ * sa session, puis inscrit la session auprès de sa boucle. Les commandes
+ * trop longues sont terminées sans être envoyées.
+ *
+ * @param {remote_client *} Le client.
+ * @param {int *} Le compteur des requêtes terminées à incrémenter.
+ * @return {int} 1 en cas de succès, 0 si le timeout a été atteint et une
+ *               valeur négative en cas d'erreur.
+ */
+static int flush_ops(remote_client *c, int *done);
+
+/**
+ * Lit les morceaux disponibles sur la session du client c et termine les
+ * requêtes concernées.
+ *
+ * @param {remote_client *} Le client.
+ * @return {int} Le nombre de requêtes terminées.
+ */
+static int read_ops(remote_client *c);
+
+/**
+ * Fait échouer avec status toutes les requêtes du client c, le détache de sa
+ * boucle et le marque comme inutilisable.
+ *
+ * @param {remote_client *} Le client.
+ * @param {int} L'état transmis aux fonctions des requêtes.
+ * @return {int} Le nombre de requêtes terminées.
+ */
+static int fail_ops(remote_client *c, int status);
+
+/**
+ * Termine la requête op de la boucle loop, déjà retirée de son client, en
+ * appelant sa fonction puis la libère.
+ *
+ * @param {client_loop *} La boucle.
+ * @param {async_op *} La requête.
+ * @param {int} L'état transmis à la fonction.
+ * @param {const char *} Les données transmises à la fonction.
+ * @param {size_t} Leur taille.
+ */
+static void finish_op(client_loop *loop, async_op *op, int status,
+    const char *data, size_t size);
+
+remote_client *client_open(const client_options *options) {
+  if (options == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  const char *shm_name = options->shm_name != NULL
+      ? options->shm_name : SHM_NAME;
+  const char *tmp_dir = options->tmp_dir != NULL
+      ? options->tmp_dir : CLIENT_TMP_DIR;
+  size_t ring_size = options->ring_size != 0
+      ? options->ring_size : DEFAULT_RING_SIZE;
+  remote_client *c = malloc(sizeof *c);
+  if (c == NULL) {
+    return NULL;
+  }
+  c->s = NULL;
+  c->req_fifo = NULL;
+  c->res_fifo = NULL;
+  c->next_id = 0;
+  c->broken = 1;
+  c->transport = options->transport;
+  c->loop = NULL;
+  c->first_op = NULL;
+  c->last_op = NULL;
+  c->unsent = NULL;
+  c->in_flight = 0;
+  c->registered_fd = -1;
+  c->prev = NULL;
+  c->next = NULL;
+  server_queue *server_q = connect(shm_name);
+  if (server_q == NULL) {
+    free(c);
+    return NULL;
+  }
+  long pid = (long) getpid();
+  unsigned int n = atomic_fetch_add(&session_counter, 1);
+  int capabilities = options->capabilities;
+  int ret;
+  if (options->transport == TRANSPORT_SOCKET) {
+    capabilities |= CAPABILITY_FD_PASSING;
+    char socket_path[NAME_MAX + 1];
+    snprintf(socket_path, sizeof(socket_path), "%s/socket_%ld_%u", tmp_dir,
+        pid, n);
+    if ((c->s = create_socket_session(socket_path)) == NULL) {
+      goto error;
+    }
+    ret = send_with_backoff(server_q, TRANSPORT_SOCKET, socket_path, NULL,
+        capabilities, options->timeout);
+  } else if (options->transport == TRANSPORT_SHM_RING) {
+    char session_shm[NAME_MAX + 1];
+    snprintf(session_shm, sizeof(session_shm), "/shm_session_%ld_%u", pid,
+        n);
+    if ((c->s = create_ring_session(session_shm, ring_size)) == NULL) {
+      goto error;
+    }
+    ret = send_with_backoff(server_q, TRANSPORT_SHM_RING, session_shm, NULL,
+        capabilities, options->timeout);
+  } else {
+    char request_pipe[NAME_MAX + 1];
+    snprintf(request_pipe, sizeof(request_pipe), "%s/pipe_requete_%ld_%u",
+        tmp_dir, pid, n);
+    char response_pipe[NAME_MAX + 1];
+    snprintf(response_pipe, sizeof(response_pipe), "%s/pipe_reponse_%ld_%u",
+        tmp_dir, pid, n);
+    if ((c->req_fifo = init_request_fifo(request_pipe)) == NULL) {
+      goto error;
+    }
+    if ((c->res_fifo = init_response_fifo(response_pipe)) == NULL) {
+      goto error;
+    }
+    ret = send_with_backoff(server_q, TRANSPORT_FIFO, request_pipe,
+        response_pipe, capabilities, options->timeout);
+  }
+  if (ret <= 0) {
+    if (ret == 0) {
+      errno = ETIMEDOUT;
+    }
+    goto error;
+  }
+  if (c->s == NULL && (c->s = open_session(c->req_fifo, c->res_fifo,
+      options->timeout)) == NULL) {
+    goto error;
+  }
+  // Les commandes ne sont pas tronquées : le serveur annonce leur taille
+  // maximale dans sa file
+  session_set_request_max(c->s, get_request_max(server_q));
+  c->broken = 0;
+  disconnect(server_q);
+
+  return c;
+
+error:
+  {
+    int errnum = errno;
+    client_close(c);
+    disconnect(server_q);
+    errno = errnum;
+  }
+  return NULL;
+}
+
+session *client_get_session(remote_client *c) {
+  return c == NULL ? NULL : c->s;
+}
+
+int client_execute(remote_client *c, const char *cmd, char **output,
+    time_t timeout) {
+  if (c == NULL || cmd == NULL || output == NULL) {
+    return INVALID_POINTER;
+  }
+  if (c->broken || c->first_op != NULL) {
+    errno = c->broken ? EPIPE : EBUSY;
+    return PIPE_CLOSED;
+  }
+  unsigned int id = c->next_id++;
+  // Le serveur n'exécute pas la commande au-delà de l'attente du client
+  session_set_request_deadline(c->s, timeout);
+  int r = session_send_request(c->s, id, cmd, timeout);
+  if (r == INVALID_REQUEST) {
+    // Rien n'a été envoyé : la session reste utilisable
+    return r;
+  }
+  if (r > 0) {
+    unsigned int res_id;
+    r = session_listen_response(c->s, &res_id, output, timeout);
+    if (r > 0 && res_id != id) {
+      free(*output);
+      errno = EPROTO;
+      r = INVALID_CHUNK;
+    }
+  }
+  if (r <= 0) {
+    // Une réponse partielle peut encore arriver : la session n'est plus
+    // synchronisée
+    c->broken = 1;
+  }
+
+  return r;
+}
+
+int client_close(remote_client *c) {
+  if (c == NULL) {
+    return INVALID_POINTER;
+  }
+  if (c->loop != NULL) {
+    fail_ops(c, PIPE_CLOSED);
+  }
+  // La fermeture de la session suffit à la terminer côté serveur
+  int r = 1;
+  if (c->s != NULL && close_session(c->s) < 0) {
+    r = PIPE_ERROR;
+  }
+  if (c->req_fifo != NULL && close_request_fifo(c->req_fifo) < 0) {
+    r = PIPE_ERROR;
+  }
+  if (c->res_fifo != NULL && close_response_fifo(c->res_fifo) < 0) {
+    r = PIPE_ERROR;
+  }
+  free(c);
+
+  return r;
+}
+
+/*
+ * Pool de sessions
+ */
+
+struct client_pool {
+  pthread_mutex_t mutex;
+  // Signalé lorsqu'une session est rendue ou qu'une place se libère
+  pthread_cond_t available;
+  client_options options;
+  // Nombre de sessions ouvertes ou en cours d'ouverture
+  size_t opened;
+  size_t size;
+  // Pile des sessions libres
+  size_t nb_idle;
+  remote_client *idle[];
+};
+
+client_pool *client_pool_create(const client_options *options, size_t size) {
+  if (options == NULL || size == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  client_pool *pool = malloc(sizeof *pool + size * sizeof(remote_client *));
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+    free(pool);
+    return NULL;
+  }
+  if (pthread_cond_init(&pool->available, NULL) != 0) {
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+    return NULL;
+  }
+  pool->options = *options;
+  pool->opened = 0;
+  pool->size = size;
+  pool->nb_idle = 0;
+
+  return pool;
+}
+
+int client_pool_execute(client_pool *pool, const char *cmd, char **output,
+    time_t timeout) {
+  if (pool == NULL || cmd == NULL || output == NULL) {
+    return INVALID_POINTER;
+  }
+  // Prend une session libre, ou la place d'une nouvelle session
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->nb_idle == 0 && pool->opened == pool->size) {
+    pthread_cond_wait(&pool->available, &pool->mutex);
+  }
+  remote_client *c = NULL;
+  if (pool->nb_idle > 0) {
+    c = pool->idle[--pool->nb_idle];
+  } else {
+    ++pool->opened;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  // L'ouverture se fait hors du verrou : elle attend le serveur
+  if (c == NULL && (c = client_open(&pool->options)) == NULL) {
+    int r = errno == ETIMEDOUT ? 0 : PIPE_ERROR;
+    pthread_mutex_lock(&pool->mutex);
+    --pool->opened;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->mutex);
+    return r;
+  }
+  int r = client_execute(c, cmd, output, timeout);
+  if (c->broken) {
+    // La session est remplacée lors d'une prochaine exécution
+    int errnum = errno;
+    client_close(c);
+    errno = errnum;
+    c = NULL;
+  }
+  pthread_mutex_lock(&pool->mutex);
+  if (c != NULL) {
+    pool->idle[pool->nb_idle++] = c;
+  } else {
+    --pool->opened;
+  }
+  pthread_cond_signal(&pool->available);
+  pthread_mutex_unlock(&pool->mutex);
+
+  return r;
+}
+
+int client_pool_dispose(client_pool *pool) {
+  if (pool == NULL) {
+    return INVALID_POINTER;
+  }
+  int r = 1;
+  while (pool->nb_idle > 0) {
+    if (client_close(pool->idle[--pool->nb_idle]) < 0) {
+      r = PIPE_ERROR;
+    }
+  }
+  pthread_cond_destroy(&pool->available);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool);
+
+  return r;
+}
+
+/*
+ * Exécution asynchrone
+ */
+
+client_loop *client_loop_create(void) {
+  client_loop *loop = malloc(sizeof *loop);
+  if (loop == NULL) {
+    return NULL;
+  }
+  if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    free(loop);
+    return NULL;
+  }
+  loop->next_handle = 0;
+  loop->pending = 0;
+  loop->clients = NULL;
+
+  return loop;
+}
+
+int client_loop_fd(const client_loop *loop) {
+  return loop == NULL ? -1 : loop->epoll_fd;
+}
+
+int client_submit(client_loop *loop, remote_client *c, const char *cmd,
+    int flags, client_callback callback, void *arg, time_t timeout,
+    unsigned int *handle) {
+  if (loop == NULL || c == NULL || cmd == NULL || callback == NULL) {
+    return INVALID_POINTER;
+  }
+  if (c->broken || (c->loop != NULL && c->loop != loop)) {
+    errno = c->broken ? EPIPE : EBUSY;
+    return PIPE_CLOSED;
+  }
+  if (c->transport == TRANSPORT_SHM_RING) {
+    errno = EOPNOTSUPP;
+    return PIPE_ERROR;
+  }
+  async_op *op = malloc(sizeof *op);
+  if (op == NULL) {
+    return MEMORY_ERROR;
+  }
+  if ((op->cmd = strdup(cmd)) == NULL) {
+    free(op);
+    return MEMORY_ERROR;
+  }
+  op->handle = loop->next_handle++;
+  op->id = c->next_id++;
+  op->flags = flags;
+  op->callback = callback;
+  op->arg = arg;
+  op->timeout = timeout;
+  op->data = NULL;
+  op->size = 0;
+  op->next = NULL;
+  if (c->loop == NULL) {
+    // Rattache le client à la boucle
+    c->loop = loop;
+    c->prev = NULL;
+    c->next = loop->clients;
+    if (loop->clients != NULL) {
+      loop->clients->prev = c;
+    }
+    loop->clients = c;
+  }
+  if (c->last_op == NULL) {
+    c->first_op = op;
+  } else {
+    c->last_op->next = op;
+  }
+  c->last_op = op;
+  if (c->unsent == NULL) {
+    c->unsent = op;
+  }
+  ++loop->pending;
+  if (handle != NULL) {
+    *handle = op->handle;
+  }
+  int done = 0;
+  int r = flush_ops(c, &done);
+  if (r <= 0) {
+    // Les requêtes précédentes sont perdues avec la session. L'échec de
+    // celle-ci est signalé par le retour.
+    int errnum = errno;
+    op->callback = NULL;
+    fail_ops(c, r);
+    errno = errnum;
+    return r;
+  }
+
+  return 1;
+}
+
+int client_loop_run(client_loop *loop, int timeout) {
+  if (loop == NULL) {
+    return INVALID_POINTER;
+  }
+  // Réveille la boucle à la première échéance des requêtes envoyées
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int wait = timeout;
+  for (remote_client *c = loop->clients; c != NULL; c = c->next) {
+    if (c->in_flight == 0) {
+      continue;
+    }
+    const struct timespec *d = &c->first_op->deadline;
+    long long ms = (long long) (d->tv_sec - now.tv_sec) * 1000
+        + (d->tv_nsec - now.tv_nsec) / 1000000 + 1;
+    if (ms < 0) {
+      ms = 0;
+    }
+    if (wait < 0 || ms < wait) {
+      wait = (int) ms;
+    }
+  }
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  int n = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, wait);
+  if (n < 0) {
+    return errno == EINTR ? 0 : PIPE_ERROR;
+  }
+  int done = 0;
+  for (int i = 0; i < n; ++i) {
+    remote_client *c = events[i].data.ptr;
+    // Le client a pu échouer lors d'un appel précédent
+    if (c->loop == loop && c->registered_fd >= 0) {
+      done += read_ops(c);
+    }
+  }
+  // Les requêtes dont le morceau attendu a expiré échouent avec leur session
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  remote_client *c = loop->clients;
+  while (c != NULL) {
+    remote_client *next = c->next;
+    if (c->in_flight > 0 && (c->first_op->deadline.tv_sec < now.tv_sec
+        || (c->first_op->deadline.tv_sec == now.tv_sec
+        && c->first_op->deadline.tv_nsec <= now.tv_nsec))) {
+      errno = ETIMEDOUT;
+      done += fail_ops(c, 0);
+    }
+    c = next;
+  }
+
+  return done;
+}
+
+size_t client_loop_pending(const client_loop *loop) {
+  return loop == NULL ? 0 : loop->pending;
+}
+
+int client_loop_dispose(client_loop *loop) {
+  if (loop == NULL) {
+    return INVALID_POINTER;
+  }
+  while (loop->clients != NULL) {
+    fail_ops(loop->clients, PIPE_CLOSED);
+  }
+  int r = close(loop->epoll_fd) < 0 ? PIPE_ERROR : 1;
+  free(loop);
+
+  return r;
+}
+
+static int flush_ops(remote_client *c, int *done) {
+  size_t window = session_pipeline_depth(c->s);
+  while (c->unsent != NULL && c->in_flight < window) {
+    async_op *op = c->unsent;
+    session_set_request_deadline(c->s, op->timeout);
+    int r = session_send_request(c->s, op->id, op->cmd, op->timeout);
+    if (r == INVALID_REQUEST) {
+      // Rien n'a été envoyé : seule cette requête échoue
+      async_op *prev = NULL;
+      for (async_op *p = c->first_op; p != op; p = p->next) {
+        prev = p;
+      }
+      if (prev == NULL) {
+        c->first_op = op->next;
+      } else {
+        prev->next = op->next;
+      }
+      if (c->last_op == op) {
+        c->last_op = prev;
+      }
+      c->unsent = op->next;
+      finish_op(c->loop, op, r, NULL, 0);
+      ++*done;
+      continue;
+    }
+    if (r <= 0) {
+      return r;
+    }
+    free(op->cmd);
+    op->cmd = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &op->deadline);
+    op->deadline.tv_sec += op->timeout;
+    c->unsent = op->next;
+    ++c->in_flight;
+  }
+  if (c->registered_fd < 0 && c->in_flight > 0) {
+    // Le socket n'est connecté qu'après le premier envoi
+    int fd = session_response_fd(c->s);
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.ptr = c;
+    if (fd < 0 || epoll_ctl(c->loop->epoll_fd, EPOLL_CTL_ADD, fd, 
+        &event) < 0) {
+      return PIPE_ERROR;
+    }
+    c->registered_fd = fd;
+  }
+
+  return 1;
+}
+
+static int read_ops(remote_client *c) {
+  int done = 0;
+  for (size_t budget = LOOP_CHUNK_BUDGET; budget > 0; --budget) {
+    if (c->in_flight == 0) {
+      // Aucune réponse n'est attendue : seule la fermeture par le serveur
+      // peut rendre le descripteur lisible
+      errno = EPIPE;
+      return done + fail_ops(c, PIPE_CLOSED);
+    }
+    async_op *op = c->first_op;
+    unsigned int id;
+    char *chunk;
+    size_t size;
+    int r = session_listen_chunk(c->s, &id, &chunk, &size, op->timeout);
+    if (r > 0 && id != op->id) {
+      if (size > 0) {
+        session_free_chunk(c->s, chunk);
+      }
+      errno = EPROTO;
+      r = INVALID_CHUNK;
+    }
+    if (r <= 0) {
+      return done + fail_ops(c, r);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &op->deadline);
+    op->deadline.tv_sec += op->timeout;
+    if (size > 0) {
+      if (op->flags & CLIENT_STREAM) {
+        op->callback(op->arg, op->handle, 1, chunk, size);
+      } else {
+        char *data = realloc(op->data, op->size + size + 1);
+        if (data == NULL) {
+          session_free_chunk(c->s, chunk);
+          return done + fail_ops(c, MEMORY_ERROR);
+        }
+        memcpy(data + op->size, chunk, size);
+        op->size += size;
+        data[op->size] = '\0';
+        op->data = data;
+      }
+      session_free_chunk(c->s, chunk);
+    } else {
+      // Dernier morceau : la requête est terminée
+      c->first_op = op->next;
+      if (c->last_op == op) {
+        c->last_op = NULL;
+      }
+      --c->in_flight;
+      if (op->flags & CLIENT_STREAM) {
+        finish_op(c->loop, op, 1, NULL, 0);
+      } else {
+        finish_op(c->loop, op, 1, op->data != NULL ? op->data : "", 
+            op->size);
+      }
+      ++done;
+      // La fonction a pu faire échouer le client en lui soumettant une
+      // requête
+      if (c->loop == NULL) {
+        return done;
+      }
+      int f = flush_ops(c, &done);
+      if (f <= 0) {
+        return done + fail_ops(c, f);
+      }
+    }
+    // Continue tant que des morceaux sont déjà arrivés
+    struct pollfd pfd = { .fd = c->registered_fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) {
+      break;
+    }
+  }
+
+  return done;
+}
+
+static int fail_ops(remote_client *c, int status) {
+  client_loop *loop = c->loop;
+  c->broken = 1;
+  c->in_flight = 0;
+  c->unsent = NULL;
+  if (c->registered_fd >= 0) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, c->registered_fd, NULL);
+    c->registered_fd = -1;
+  }
+  // Détache le client de la boucle
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  } else {
+    loop->clients = c->next;
+  }
+  if (c->next != NULL) {
+    c->next->prev = c->prev;
+  }
+  c->loop = NULL;
+  c->prev = NULL;
+  c->next = NULL;
+  int done = 0;
+  while (c->first_op != NULL) {
+    async_op *op = c->first_op;
+    c->first_op = op->next;
+    if (op->callback != NULL) {
+      ++done;
+    }
+    finish_op(loop, op, status, NULL, 0);
+  }
+  c->last_op = NULL;
+
+  return done;
+}
+
+static void finish_op(client_loop *loop, async_op *op, int status,
+    const char *data, size_t size) {
+  --loop->pending;
+  if (op->callback != NULL) {
+    op->callback(op->arg, op->handle, status, data, size);
+  }
+  free(op->cmd);
+  free(op->data);
+  free(op);
+}
+
+static long elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (long) (now.tv_sec - start->tv_sec) * 1000
+      + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int send_with_backoff(server_queue *server_q, int transport,
+    const char *name, const char *response_pipe, int capabilities,
+    time_t timeout) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long budget_ms = (long) timeout * 1000;
+  unsigned int seed = (unsigned int) getpid() ^ (unsigned int) start.tv_nsec;
+  long ceiling_ms = BACKOFF_BASE_MS;
+  while (1) {
+    // Chaque tentative dispose du temps restant, arrondi à la seconde
+    long remaining_ms = budget_ms - elapsed_ms(&start);
+    time_t attempt_timeout = (time_t) (remaining_ms > 0
+        ? (remaining_ms + 999) / 1000 : 0);
+    int r;
+    if (transport == TRANSPORT_SOCKET) {
+      r = send_shm_socket_request(server_q, name, capabilities,
+          attempt_timeout);
+    } else if (transport == TRANSPORT_SHM_RING) {
+      r = send_shm_ring_request(server_q, name, capabilities,
+          attempt_timeout);
+    } else {
+      r = send_shm_request(server_q, name, response_pipe, capabilities,
+          attempt_timeout);
+    }
+    if (r != SERVER_IS_FULL) {
+      return r;
+    }
+    // Attend entre la moitié et la totalité du plus grand du palier courant
+    // et du délai suggéré par le serveur
+    long retry_ms = get_retry_after(server_q);
+    long base_ms = retry_ms > ceiling_ms ? retry_ms : ceiling_ms;
+    long delay_ms = base_ms / 2 + (long) (rand_r(&seed) % (base_ms / 2 + 1));
+    if (ceiling_ms < BACKOFF_MAX_MS) {
+      ceiling_ms *= 2;
+    }
+    // Inutile d'attendre si la requête ne peut plus aboutir à temps
+    if (delay_ms >= budget_ms - elapsed_ms(&start)) {
+      return 0;
+    }
+    struct timespec delay = {
+      .tv_sec = delay_ms / 1000,
+      .tv_nsec = (delay_ms % 1000) * 1000000
+    };
+    nanosleep(&delay, NULL);
+  }
+}
@@ -0,0 +1,234 @@
+/**
+ * Interface cliente non interactive. Un remote_client garde une session
+ * ouverte avec le serveur pour y exécuter autant de commandes que voulu, sans
+ * repayer la connexion à la file, la création des tubes et la requête de
+ * connexion. Un client_pool partage un ensemble de sessions entre plusieurs
+ * threads et une client_loop attend sans bloquer les réponses de nombreuses
+ * sessions.
+ *
+ * @author Jordan ELIE.
+ */
+
+#ifndef CLIENT_API_H
+#define CLIENT_API_H
+
+#include <stddef.h>
+#include <time.h>
+#include "connection.h"
+
+// Répertoire par défaut des tubes et sockets des sessions
+#define CLIENT_TMP_DIR "./tmp"
+
+// Taille par défaut des anneaux d'une session TRANSPORT_SHM_RING
+#define DEFAULT_RING_SIZE 65536
+
+/**
+ * Paramètres d'ouverture d'une session. Les chaînes doivent rester valides
+ * tant qu'elles peuvent servir (durée de vie du pool qui les utilise).
+ */
+typedef struct client_options {
+  const char *shm_name; // File de connexion du serveur (SHM_NAME si NULL)
+  const char *tmp_dir;  // Répertoire des tubes et sockets (CLIENT_TMP_DIR
+                        // si NULL)
+  int transport;        // TRANSPORT_*
+  int capabilities;     // CAPABILITY_*. CAPABILITY_NO_SIGNALS évite que le
+                        // serveur n'interrompe le processus appelant.
+  size_t ring_size;     // Taille des anneaux (0 pour DEFAULT_RING_SIZE)
+  time_t timeout;       // Timeout de la connexion au serveur
+} client_options;
+
+typedef struct remote_client remote_client;
+
+/**
+ * Ouvre une session avec le serveur selon options. Plusieurs sessions
+ * peuvent être ouvertes par un même processus. Tant que le serveur refuse la
+ * connexion faute de pouvoir l'accepter à temps, elle est retentée après un
+ * délai aléatoire croissant, dans la limite du timeout.
+ *
+ * @param {const client_options *} Les paramètres de la session.
+ * @return {remote_client *} Le client ou NULL en cas d'erreur. errno vaut
+ *                           ETIMEDOUT si le serveur est surchargé.
+ */
+remote_client *client_open(const client_options *options);
+
+/**
+ * Renvoie la session du client c, pour un usage direct (réponses reçues
+ * morceau par morceau, requêtes en pipeline).
+ *
+ * @param {remote_client *} Le client.
+ * @return {session *} La session.
+ */
+session *client_get_session(remote_client *c);
+
+/**
+ * Exécute la commande cmd sur la session du client c et stocke sa sortie,
+ * terminée par '\0', dans *output qui devra être libéré par l'appelant. La
+ * commande exit ne doit pas être envoyée : client_close termine la session.
+ * Un même client ne doit pas être utilisé par plusieurs threads à la fois.
+ *
+ * @param {remote_client *} Le client.
+ * @param {const char *} La commande à exécuter.
+ * @param {char **} L'adresse où stocker la sortie de la commande.
+ * @param {time_t} Un timeout d'envoi puis de réception de chaque morceau, 
+ *                 également transmis au serveur comme délai d'exécution.
+ * @return {int} 1 en cas de succès, 0 si le timeout a été atteint et une
+ *               valeur négative en cas d'erreur (codes de connection.h).
+ *               Après une erreur autre que INVALID_REQUEST, la session doit
+ *               être fermée.
+ */
+int client_execute(remote_client *c, const char *cmd, char **output,
+    time_t timeout);
+
+/**
+ * Ferme la session du client c, supprime ses tubes et libère c. Ses requêtes
+ * asynchrones non terminées échouent (PIPE_CLOSED).
+ *
+ * @param {remote_client *} Le client.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int client_close(remote_client *c);
+
+/*
+ * Pool de sessions
+ */
+
+typedef struct client_pool client_pool;
+
+/**
+ * Créé un pool d'au plus size sessions ouvertes selon options. Les sessions
+ * sont ouvertes à la demande puis réutilisées.
+ *
+ * @param {const client_options *} Les paramètres des sessions, copiés.
+ * @param {size_t} Le nombre maximum de sessions ouvertes.
+ * @return {client_pool *} Le pool ou NULL en cas d'erreur.
+ */
+client_pool *client_pool_create(const client_options *options, size_t size);
+
+/**
+ * Exécute la commande cmd sur une session libre du pool, en attendant qu'une
+ * se libère si elles sont toutes occupées. Peut être appelée par plusieurs
+ * threads à la fois. Une session en erreur est fermée puis remplacée.
+ *
+ * @param {client_pool *} Le pool.
+ * @param {const char *} La commande à exécuter.
+ * @param {char **} L'adresse où stocker la sortie de la commande.
+ * @param {time_t} Un timeout.
+ * @return {int} Mêmes retours que client_execute. PIPE_ERROR si aucune
+ *               session n'a pu être ouverte (0 si le serveur est surchargé).
+ */
+int client_pool_execute(client_pool *pool, const char *cmd, char **output,
+    time_t timeout);
+
+/**
+ * Ferme les sessions du pool et le libère. Aucune exécution ne doit être en
+ * cours.
+ *
+ * @param {client_pool *} Le pool.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int client_pool_dispose(client_pool *pool);
+
+/*
+ * Exécution asynchrone
+ */
+
+typedef struct client_loop client_loop;
+
+// Les morceaux de la réponse sont transmis au fur et à mesure de leur arrivée
+// au lieu d'être concaténés
+#define CLIENT_STREAM 0x1
+
+/**
+ * Fonction appelée lors de l'avancement de la requête handle. Avec
+ * CLIENT_STREAM, elle est appelée pour chaque morceau (status 1 et size non
+ * nul) puis une dernière fois avec size nul. Sinon, elle est appelée une
+ * seule fois avec la réponse complète, terminée par '\0'. En cas d'échec,
+ * elle est appelée une dernière fois avec data NULL et status valant 0 si le
+ * timeout a été atteint ou une valeur négative (codes de connection.h).
+ * data n'est valide que pendant l'appel. La fonction peut soumettre de
+ * nouvelles requêtes mais ne doit fermer aucun client ni la boucle.
+ *
+ * @param {void *} L'argument donné à client_submit.
+ * @param {unsigned int} L'identifiant renvoyé par client_submit.
+ * @param {int} L'état de la requête.
+ * @param {const char *} Le morceau ou la réponse reçu.
+ * @param {size_t} Sa taille.
+ */
+typedef void (*client_callback)(void *arg, unsigned int handle, int status,
+    const char *data, size_t size);
+
+/**
+ * Créé une boucle d'événements multiplexant les réponses des sessions de
+ * clients, éventuellement connectés à des serveurs différents. Une boucle et
+ * ses clients ne doivent être manipulés que par un seul thread.
+ *
+ * @return {client_loop *} La boucle ou NULL en cas d'erreur.
+ */
+client_loop *client_loop_create(void);
+
+/**
+ * Renvoie un descripteur lisible (poll, epoll) lorsque client_loop_run a des
+ * réponses à traiter, afin d'intégrer loop à une boucle existante.
+ *
+ * @param {const client_loop *} La boucle.
+ * @return {int} Le descripteur.
+ */
+int client_loop_fd(const client_loop *loop);
+
+/**
+ * Soumet la commande cmd sur la session du client c sans attendre sa réponse,
+ * qui sera transmise à callback par client_loop_run. Les requêtes d'un même
+ * client sont envoyées en pipeline dans la limite de session_pipeline_depth
+ * et complétées dans l'ordre. Le client ne doit plus être utilisé par
+ * client_execute. Les sessions TRANSPORT_SHM_RING n'ont pas de descripteur
+ * et ne sont pas supportées.
+ *
+ * @param {client_loop *} La boucle.
+ * @param {remote_client *} Le client.
+ * @param {const char *} La commande à exécuter, copiée.
+ * @param {int} 0 ou CLIENT_STREAM.
+ * @param {client_callback} La fonction appelée lors de l'avancement.
+ * @param {void *} Son argument.
+ * @param {time_t} Un timeout d'attente de chaque morceau, également 
+ *                 transmis au serveur comme délai d'exécution.
+ * @param {unsigned int *} Si non NULL, l'adresse où stocker l'identifiant
+ *                         de la requête.
+ * @return {int} 1 en cas de succès, 0 si le timeout d'envoi a été atteint et
+ *               une valeur négative en cas d'erreur. callback n'est appelée
+ *               qu'en cas de succès, éventuellement avant le retour (avec
+ *               INVALID_REQUEST si la commande est trop longue).
+ */
+int client_submit(client_loop *loop, remote_client *c, const char *cmd,
+    int flags, client_callback callback, void *arg, time_t timeout,
+    unsigned int *handle);
+
+/**
+ * Attend au plus timeout millisecondes l'arrivée de réponses sur les clients
+ * de loop et appelle les fonctions associées. Les requêtes dont un morceau
+ * se fait attendre au-delà de leur timeout échouent avec leur client.
+ *
+ * @param {client_loop *} La boucle.
+ * @param {int} Un timeout en millisecondes, -1 pour attendre indéfiniment.
+ * @return {int} Le nombre de requêtes terminées (0 si aucune) et une valeur
+ *               négative en cas d'erreur.
+ */
+int client_loop_run(client_loop *loop, int timeout);
+
+/**
+ * Renvoie le nombre de requêtes soumises à loop et non terminées.
+ *
+ * @param {const client_loop *} La boucle.
+ * @return {size_t} Le nombre de requêtes.
+ */
+size_t client_loop_pending(const client_loop *loop);
+
+/**
+ * Détache les clients de loop, en faisant échouer leurs requêtes non
+ * terminées (PIPE_CLOSED), puis libère loop. Les clients ne sont pas fermés.
+ *
+ * @param {client_loop *} La boucle.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int client_loop_dispose(client_loop *loop);
+
+#endif
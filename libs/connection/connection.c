@@ -1,4 +1,8 @@
-#define _POSIX_C_SOURCE 200801L
+#define _POSIX_C_SOURCE 200809L
+// Nécessaire à syscall pour l'utilisation des futex
+#define _DEFAULT_SOURCE
+// Nécessaire à splice
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,16 +10,22 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/select.h>
-#include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
-#include <semaphore.h>
+#include <stdint.h>
 #include <limits.h>
 #include <string.h>
 #include <signal.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
 #include "connection.h"
+#include "socket_endpoint.h"
+#include "../compression/compression.h"
 
 extern int errno;
 
@@ -26,313 +36,1296 @@ extern int errno;
 #endif
 
 #define MIN(x, y) (x < y ? x : y)
+#define MAX(x, y) (x > y ? x : y)
+
+// Délai (en nanosecondes) entre deux tentatives d'ouverture d'un tube dont
+// le lecteur n'est pas encore présent.
+#define OPEN_RETRY_DELAY 1000000L
+
+// Taille d'une ligne de cache. Sépare les index des producteurs et des 
+// consommateurs des files et des anneaux.
+#define CACHE_LINE 64
+
+// Bornes et valeur initiale du nombre d'itérations d'attente active avant 
+// de s'endormir sur un futex de la file de connexion
+#define SPIN_MIN 16
+#define SPIN_INITIAL 256
+#define SPIN_MAX 16384
+
+// Un sommeil plus court que cette durée (en nanosecondes) aurait été évité 
+// par une attente active plus longue
+#define SHORT_PARK_NS 50000L
+
+// Indique au processeur une boucle d'attente active
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CPU_RELAX() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+/**
+ * Calcule dans deadline l'instant absolu (horloge CLOCK_MONOTONIC) situé 
+ * timeout secondes dans le futur.
+ * 
+ * @param {time_t} Le timeout en secondes.
+ * @param {struct timespec *} L'échéance calculée.
+ * @return {struct timespec *} deadline.
+ */
+static struct timespec *deadline_after(time_t timeout, 
+    struct timespec *deadline);
+
+/**
+ * Attend que le descripteur fd soit prêt pour les évènements events, au plus
+ * tard jusqu'à l'échéance absolue deadline.
+ * 
+ * @param {int} Le descripteur.
+ * @param {short} Les évènements attendus (POLLIN, POLLOUT).
+ * @param {const struct timespec *} L'échéance (NULL pour une attente 
+ *                                  infinie).
+ * @return {int} Les évènements survenus (revents de poll), 0 si l'échéance a
+ *               été atteinte et -1 en cas d'erreur.
+ */
+static int wait_fd(int fd, short events, const struct timespec *deadline);
+
+/**
+ * Lit exactement n octets sur le descripteur non bloquant fd et les stocke 
+ * dans buffer.
+ * 
+ * @param {int} Le descripteur.
+ * @param {void *} Le tampon où stocker les octets lus.
+ * @param {size_t} Le nombre d'octets à lire.
+ * @param {const struct timespec *} L'échéance (NULL pour une attente 
+ *                                  infinie).
+ * @return {int} 1 en cas de succès, 0 si l'échéance a été atteinte, 
+ *               PIPE_CLOSED si l'écrivain a fermé le tube et PIPE_ERROR en 
+ *               cas d'erreur.
+ */
+static int read_full(int fd, void *buffer, size_t n, 
+    const struct timespec *deadline);
+
+/**
+ * Ecrit exactement n octets de buffer sur le descripteur non bloquant fd.
+ * 
+ * @param {int} Le descripteur.
+ * @param {const void *} Les octets à écrire.
+ * @param {size_t} Le nombre d'octets à écrire.
+ * @param {const struct timespec *} L'échéance.
+ * @return {int} 1 en cas de succès, 0 si l'échéance a été atteinte et 
+ *               PIPE_ERROR en cas d'erreur.
+ */
+static int write_full(int fd, const void *buffer, size_t n, 
+    const struct timespec *deadline);
+
+/**
+ * Ouvre le tube path en écriture non bloquante en attendant, au plus tard
+ * jusqu'à deadline, que son autre extrémité soit ouverte en lecture.
+ * 
+ * @param {const char *} Le chemin du tube.
+ * @param {const struct timespec *} L'échéance.
+ * @return {int} Le descripteur du tube ou -1 en cas d'erreur. errno vaut
+ *               ETIMEDOUT si l'échéance a été atteinte.
+ */
+static int open_fifo_writer(const char *path, 
+    const struct timespec *deadline);
+
+/**
+ * Se connecte au socket path en réessayant, au plus tard jusqu'à deadline, 
+ * tant que sa file d'attente est pleine.
+ * 
+ * @param {const char *} Le chemin du socket.
+ * @param {const struct timespec *} L'échéance.
+ * @return {int} Le descripteur de la connexion ou -1 en cas d'erreur. errno 
+ *               vaut ETIMEDOUT si l'échéance a été atteinte.
+ */
+static int connect_socket(const char *path, const struct timespec *deadline);
+
+/**
+ * Endort l'appelant tant que le mot partagé *seq vaut observed, au plus tard
+ * jusqu'à l'échéance absolue deadline (NULL pour une attente infinie).
+ * 
+ * @param {atomic_uint *} Le mot surveillé.
+ * @param {unsigned int} La valeur observée avant de s'endormir.
+ * @param {const struct timespec *} L'échéance.
+ * @return {int} 1 si l'appelant a été réveillé ou si *seq a changé, 0 si 
+ *               l'échéance a été atteinte et -1 en cas d'erreur.
+ */
+static int futex_wait_until(atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline);
+
+/**
+ * Réveille tous les processus endormis sur seq.
+ * 
+ * @param {atomic_uint *} Le mot surveillé.
+ */
+static void futex_wake_all(atomic_uint *seq);
+
+/**
+ * Attend activement, au plus *budget itérations, que le mot partagé *seq ne
+ * vaille plus observed. Le budget se rapproche du double du nombre 
+ * d'itérations nécessaires lorsque l'attente aboutit.
+ * 
+ * @param {atomic_uint *} Le mot surveillé.
+ * @param {unsigned int} La valeur observée.
+ * @param {atomic_uint *} Le budget d'itérations, partagé par les attentes 
+ *                        d'un même côté de la file.
+ * @param {atomic_ulong *} Le compteur des attentes abouties à incrémenter.
+ * @return {int} 1 si *seq a changé et 0 si le budget a été épuisé.
+ */
+static int spin_until_changed(atomic_uint *seq, unsigned int observed, 
+    atomic_uint *budget, atomic_ulong *spins);
+
+/**
+ * Comme futex_wait_until, en adaptant *budget à la durée du sommeil : un 
+ * sommeil court double le budget d'attente active, un sommeil long le 
+ * réduit.
+ * 
+ * @param {atomic_uint *} Le mot surveillé.
+ * @param {unsigned int} La valeur observée.
+ * @param {const struct timespec *} L'échéance.
+ * @param {atomic_uint *} Le budget d'itérations à adapter.
+ * @param {atomic_ulong *} Le compteur des sommeils à incrémenter.
+ * @return {int} Le retour de futex_wait_until.
+ */
+static int park_until_changed(atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline, atomic_uint *budget, 
+    atomic_ulong *parks);
 
 /**
- * Quitte le processus courant avec le code 1 si signum vaut SIGALRM.
- * Quitte avec le code SIG_ERROR sinon.
+ * Indique si l'échéance deadline est dépassée.
  * 
- * @param {int} Le signal.
+ * @param {const struct timespec *} L'échéance.
+ * @return {int} Une valeur non nulle si l'échéance est dépassée et 0 sinon.
  */
-static void exit_sig(int signum);
+static int deadline_passed(const struct timespec *deadline);
 
 /*
  * Manipulation de la queue de connexion au serveur
  */
 
-struct server_queue {
-  int shm_fd;
+/**
+ * Case de la file. sequence indique à qui appartient la case : elle vaut la
+ * position d'ajout attendue quand la case est libre et cette position + 1 
+ * quand elle contient une requête prête à être retirée.
+ */
+typedef struct queue_slot {
+  atomic_size_t sequence;
+  struct timespec enqueued; // Instant de l'ajout (CLOCK_MONOTONIC)
+  shm_request request;
+} queue_slot;
+
+/**
+ * Voie de priorité d'une partition : file bornée multi-producteurs / 
+ * multi-consommateurs sans verrou.
+ */
+typedef struct queue_lane {
+  _Alignas(CACHE_LINE) atomic_size_t head; // Position d'ajout dans le tampon
+  atomic_uint not_full_seq;                // Incrémenté après chaque retrait
+  atomic_uint producers_waiting;
+  atomic_uint producer_spin;               // Budget d'attente active
+  _Alignas(CACHE_LINE) atomic_size_t tail; // Position de suppression
+  atomic_size_t length;                    // Le nombre d'éléments
+  atomic_uint credit;  // Retraits restant à la voie dans le tour courant
+  atomic_ulong dequeued;
+  atomic_ullong wait_ns; // Attente cumulée des requêtes retirées
+  atomic_ullong max_wait_ns;
+  atomic_ulong expired;  // Requêtes écartées à l'échéance de leur client
+} queue_lane;
+
+/**
+ * Partition de la file, dans son propre segment. Elle contient nb_lanes 
+ * voies de nb_slots cases, vidées à tour de rôle selon leur poids, la voie 0
+ * étant la plus prioritaire. Lorsque la partition est vide ou une voie 
+ * pleine, les processus attendent activement un temps adapté aux attentes 
+ * récentes avant de s'endormir (futex).
+ */
+typedef struct queue_shard {
+  atomic_uint ready;  // Non nul une fois l'en-tête rempli, publié en dernier
   size_t nb_slots;
-  sem_t mutex;
-  sem_t empty;
-  sem_t full;
-  size_t length; // Le nombre d'éléments dans le tampon
-  size_t head;   // Position d'ajout dans le tampon
-  size_t tail;   // Position de suppression dans le tampon
-  shm_request buffer[];
+  size_t nb_lanes;
+  size_t nb_shards;   // Nombre de partitions de la file
+  size_t request_max; // Taille maximale des commandes des sessions
+  // Affectation et poids des voies, publiés par le serveur
+  unsigned int lane_weights[MAX_LANES];
+  size_t default_lane;
+  size_t nb_rules;
+  lane_rule rules[MAX_LANE_RULES];
+  _Alignas(CACHE_LINE) atomic_uint not_empty_seq; // Incrémenté après chaque
+                                                  // ajout
+  atomic_uint consumers_waiting;
+  atomic_uint consumer_spin;
+  // Issue des attentes (voir get_wait_stats)
+  _Alignas(CACHE_LINE) atomic_ulong consumer_spins;
+  atomic_ulong consumer_parks;
+  atomic_ulong producer_spins;
+  atomic_ulong producer_parks;
+  // Charge du serveur, publiée dans la partition 0 (voir get_queue_load)
+  _Alignas(CACHE_LINE) atomic_size_t active_sessions;
+  atomic_size_t max_sessions;
+  atomic_ullong service_ns;
+  atomic_ulong rejected;
+  queue_lane lanes[MAX_LANES];
+  queue_slot buffer[]; // Cases de la voie i à partir de i * nb_slots
+} queue_shard;
+
+/**
+ * Projection locale des partitions de la file. La partition i est le 
+ * segment <shm_name>_i.
+ */
+struct server_queue {
+  char shm_name[NAME_MAX + 1];
+  size_t nb_shards;
+  atomic_int paused; // Retrait suspendu dans ce processus (pause_fetching)
+  queue_shard *shards[];
 };
 
-server_queue *init_server_queue(size_t max_slot) {
-  // Création du SHM
-  int shm_fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL,
-      S_IRUSR | S_IWUSR);
+/**
+ * Renvoie la taille du segment d'une partition de nb_lanes voies de nb_slots
+ * cases.
+ */
+static size_t shard_size(size_t nb_lanes, size_t nb_slots) {
+  return sizeof(queue_shard) + sizeof(queue_slot) * nb_lanes * nb_slots;
+}
+
+/**
+ * Ecrit dans name le nom du segment de la partition i de la file shm_name.
+ * 
+ * @return {int} 1 en cas de succès et -1 si le nom est trop long.
+ */
+static int shard_name(const char *shm_name, size_t i, 
+    char name[NAME_MAX + 1]) {
+  int n = snprintf(name, NAME_MAX + 1, "%s_%zu", shm_name, i);
+  if (n < 0 || n > NAME_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 1;
+}
+
+/**
+ * Crée et initialise le segment name d'une partition de nb_lanes voies de 
+ * max_slot cases.
+ * 
+ * @return {queue_shard *} La partition ou NULL en cas d'erreur.
+ */
+static queue_shard *create_shard(const char *name, size_t nb_lanes, 
+    size_t max_slot, size_t nb_shards) {
+  int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
   if (shm_fd < 0) {
     return NULL;
   }
-  if (ftruncate(shm_fd, 
-      (off_t) (sizeof(server_queue) + sizeof(shm_request) * max_slot)) < 0) {
-    goto err;
+  queue_shard *shard = MAP_FAILED;
+  size_t size = shard_size(nb_lanes, max_slot);
+  if (ftruncate(shm_fd, (off_t) size) == 0) {
+    shard = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+        MAP_SHARED, shm_fd, 0);
   }
-  server_queue *server_q = mmap(NULL, 
-      sizeof(server_queue) + sizeof(shm_request) * max_slot, 
-      PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-  if (server_q == MAP_FAILED) {
-    goto err;
+  // La projection reste valide après la fermeture du descripteur
+  close(shm_fd);
+  if (shard == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
   }
   // Remplissage de la mémoire
-  server_q->shm_fd = shm_fd;
-  if (sem_init(&server_q->mutex, 1, 1) == -1) {
+  shard->nb_slots = max_slot;
+  shard->nb_lanes = nb_lanes;
+  shard->nb_shards = nb_shards;
+  shard->request_max = DEFAULT_REQUEST_MAX;
+  // Sans règle, toutes les requêtes passent par la voie 0
+  shard->default_lane = 0;
+  shard->nb_rules = 0;
+  atomic_init(&shard->not_empty_seq, 0);
+  atomic_init(&shard->consumers_waiting, 0);
+  atomic_init(&shard->consumer_spin, SPIN_INITIAL);
+  atomic_init(&shard->consumer_spins, 0);
+  atomic_init(&shard->consumer_parks, 0);
+  atomic_init(&shard->producer_spins, 0);
+  atomic_init(&shard->producer_parks, 0);
+  for (size_t l = 0; l < MAX_LANES; ++l) {
+    queue_lane *lane = &shard->lanes[l];
+    shard->lane_weights[l] = 1;
+    atomic_init(&lane->head, 0);
+    atomic_init(&lane->not_full_seq, 0);
+    atomic_init(&lane->producers_waiting, 0);
+    atomic_init(&lane->producer_spin, SPIN_INITIAL);
+    atomic_init(&lane->tail, 0);
+    atomic_init(&lane->length, 0);
+    atomic_init(&lane->credit, 1);
+    atomic_init(&lane->dequeued, 0);
+    atomic_init(&lane->wait_ns, 0);
+    atomic_init(&lane->max_wait_ns, 0);
+    atomic_init(&lane->expired, 0);
+  }
+  for (size_t l = 0; l < nb_lanes; ++l) {
+    for (size_t i = 0; i < max_slot; ++i) {
+      atomic_init(&shard->buffer[l * max_slot + i].sequence, i);
+    }
+  }
+  // Le segment est visible dès sa création : les clients attendent ce 
+  // drapeau avant de lire l'en-tête
+  atomic_store_explicit(&shard->ready, 1, memory_order_release);
+
+  return shard;
+}
+
+/**
+ * Projette le segment name d'une partition existante.
+ * 
+ * @return {queue_shard *} La partition ou NULL en cas d'erreur.
+ */
+static queue_shard *map_shard(const char *name) {
+  int shm_fd = shm_open(name, O_RDWR, S_IRUSR | S_IWUSR);
+  if (shm_fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(shm_fd, &st) < 0) {
+    close(shm_fd);
+    return NULL;
+  }
+  if ((size_t) st.st_size < sizeof(queue_shard)) {
+    close(shm_fd);
+    errno = EAGAIN;
+    return NULL;
+  }
+  // Effectue une première projection afin de connaître le nombre de slots
+  queue_shard *shard = mmap(NULL, sizeof(queue_shard), 
+      PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (shard == MAP_FAILED) {
+    close(shm_fd);
     return NULL;
   }
-  if (sem_init(&server_q->empty, 1, (unsigned int) max_slot) == -1) {
+  // Une partition en cours de création est refusée, et son en-tête est 
+  // vérifié avant de servir à calculer la taille de la projection
+  int ready = atomic_load_explicit(&shard->ready, memory_order_acquire) != 0;
+  size_t nb_lanes = shard->nb_lanes;
+  size_t nb_slots = shard->nb_slots;
+  size_t nb_shards = shard->nb_shards;
+  munmap(shard, sizeof(queue_shard));
+  if (!ready) {
+    close(shm_fd);
+    errno = EAGAIN;
     return NULL;
   }
-  if (sem_init(&server_q->full, 1, 0) == -1) {
+  if (nb_shards == 0 || nb_lanes == 0 || nb_lanes > MAX_LANES 
+      || nb_slots == 0 || nb_slots > (SIZE_MAX - sizeof(queue_shard)) 
+      / sizeof(queue_slot) / nb_lanes 
+      || (size_t) st.st_size < shard_size(nb_lanes, nb_slots)) {
+    close(shm_fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  size_t size = shard_size(nb_lanes, nb_slots);
+  // Effectue la projection complète
+  shard = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  // Ferme le descripteur car il ne sera plus utile après
+  if (close(shm_fd) < 0 && shard != MAP_FAILED) {
+    munmap(shard, size);
     return NULL;
   }
-  server_q->nb_slots = max_slot;
-  server_q->length = 0;
-  server_q->head = 0;
-  server_q->tail = 0;
 
-  return server_q;
+  return shard == MAP_FAILED ? NULL : shard;
+}
 
-err:
-  if (close(shm_fd) < 0) {
-    fprintf(stderr, "init_server_queue: Impossible de fermer le fichier shm");
-    perror(" ");
-    errno = 0;
-  }
-  if (shm_unlink(SHM_NAME) < 0) {
-    fprintf(stderr, 
-        "init_server_queue: Impossible de supprimer le fichier /dev/shm%s",
-        SHM_NAME);
-    perror(" ");
-    errno = 0;
+/**
+ * Libère la projection des partitions de server_q puis server_q. Si destroy
+ * est non nul, les segments sont aussi supprimés.
+ * 
+ * @return {int} 1 si tout se passe bien et SHM_ERROR sinon.
+ */
+static int release_shards(server_queue *server_q, int destroy) {
+  int r = 1;
+  for (size_t i = 0; i < server_q->nb_shards; ++i) {
+    if (server_q->shards[i] == NULL) {
+      continue;
+    }
+    if (munmap(server_q->shards[i], shard_size(server_q->shards[i]->nb_lanes,
+        server_q->shards[i]->nb_slots)) < 0) {
+      r = SHM_ERROR;
+    }
+    char name[NAME_MAX + 1];
+    if (destroy && shard_name(server_q->shm_name, i, name) > 0 
+        && shm_unlink(name) < 0) {
+      r = SHM_ERROR;
+    }
   }
+  free(server_q);
 
-  return NULL;
+  return r;
 }
 
-server_queue *connect(const char *shm_name) {
-  // Connexion au SHM
-  int shm_fd = shm_open(shm_name, O_RDWR, S_IRUSR | S_IWUSR);
-  if (shm_fd < 0) {
+server_queue *init_server_queue(const char *shm_name, size_t nb_shards, 
+    size_t nb_lanes, size_t max_slot) {
+  if (shm_name == NULL || nb_shards == 0 || nb_lanes == 0 
+      || nb_lanes > MAX_LANES || max_slot == 0 
+      || strlen(shm_name) > NAME_MAX) {
+    errno = EINVAL;
     return NULL;
   }
-  // Effectue une première projection afin de connaître le nombre de slots
-  server_queue *server_q = mmap(NULL, sizeof(server_queue), 
-      PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-  if (server_q == MAP_FAILED) {
-    if (close(shm_fd) < 0) {
+  server_queue *server_q = malloc(sizeof(server_queue) 
+      + nb_shards * sizeof(queue_shard *));
+  if (server_q == NULL) {
+    return NULL;
+  }
+  strcpy(server_q->shm_name, shm_name);
+  server_q->nb_shards = nb_shards;
+  atomic_init(&server_q->paused, 0);
+  for (size_t i = 0; i < nb_shards; ++i) {
+    server_q->shards[i] = NULL;
+  }
+  // La partition 0 est créée en dernier : un client qui la trouve trouvera 
+  // aussi toutes les autres
+  for (size_t i = nb_shards; i-- > 0; ) {
+    char name[NAME_MAX + 1];
+    if (shard_name(shm_name, i, name) < 0 
+        || (server_q->shards[i] = create_shard(name, nb_lanes, max_slot, 
+        nb_shards)) == NULL) {
+      int err = errno;
+      release_shards(server_q, 1);
+      errno = err;
       return NULL;
     }
+  }
+
+  return server_q;
+}
 
+server_queue *connect(const char *shm_name) {
+  if (shm_name == NULL) {
+    errno = EINVAL;
     return NULL;
   }
-  size_t nb_slots = server_q->nb_slots;
-  if (munmap(server_q, sizeof(server_queue)) < 0) {
+  // La partition 0 donne le nombre de partitions
+  char name[NAME_MAX + 1];
+  if (shard_name(shm_name, 0, name) < 0) {
     return NULL;
   }
-  // Effectue la projection complète
-  server_q = mmap(NULL, sizeof(server_queue) + sizeof(shm_request) * nb_slots, 
-      PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-  if (server_q == MAP_FAILED) {
-    if (close(shm_fd) < 0) {
-      return NULL;
-    }
-
+  queue_shard *first = map_shard(name);
+  if (first == NULL) {
     return NULL;
   }
-  // Ferme le descripteur car il ne sera plus utile après
-  if (close(shm_fd) < 0) {
+  size_t nb_shards = first->nb_shards;
+  server_queue *server_q = malloc(sizeof(server_queue) 
+      + nb_shards * sizeof(queue_shard *));
+  if (server_q == NULL) {
+    munmap(first, shard_size(first->nb_lanes, first->nb_slots));
     return NULL;
   }
+  strcpy(server_q->shm_name, shm_name);
+  server_q->nb_shards = nb_shards;
+  atomic_init(&server_q->paused, 0);
+  server_q->shards[0] = first;
+  for (size_t i = 1; i < nb_shards; ++i) {
+    server_q->shards[i] = NULL;
+  }
+  for (size_t i = 1; i < nb_shards; ++i) {
+    if (shard_name(shm_name, i, name) < 0 
+        || (server_q->shards[i] = map_shard(name)) == NULL) {
+      int err = errno;
+      release_shards(server_q, 0);
+      errno = err;
+      return NULL;
+    }
+    // Toutes les partitions doivent appartenir à la même file
+    if (server_q->shards[i]->nb_shards != nb_shards) {
+      release_shards(server_q, 0);
+      errno = EINVAL;
+      return NULL;
+    }
+  }
 
   return server_q;
 }
 
-int disconnect(server_queue *queue_p) {
-  // Libère la projection mémoire
-  if (munmap(queue_p, 
-      sizeof(server_queue) + sizeof(shm_request) * queue_p->nb_slots) < 0) {
-    return SHM_ERROR;
+void set_request_max(server_queue *queue_p, size_t max) {
+  if (queue_p != NULL) {
+    queue_p->shards[0]->request_max = MIN(MAX(max, MAX_COMMAND_LENGTH), 
+        REQUEST_MAX_LIMIT);
   }
+}
 
-  return 1;
+size_t get_request_max(const server_queue *queue_p) {
+  return queue_p == NULL ? DEFAULT_REQUEST_MAX 
+      : queue_p->shards[0]->request_max;
 }
 
-int free_server_queue(server_queue *queue_p) {
-  // Attend la fin des modifications
-  if (sem_wait(&queue_p->mutex) == -1) {
-    return SEMAPHORE_ERROR;
+size_t get_nb_shards(const server_queue *queue_p) {
+  return queue_p == NULL ? 0 : queue_p->nb_shards;
+}
+
+int get_wait_stats(const server_queue *queue_p, queue_wait_stats *stats) {
+  if (queue_p == NULL || stats == NULL) {
+    return INVALID_POINTER;
   }
-  // Ferme le fichier
-  if (close(queue_p->shm_fd) < 0) {
-    return SHM_ERROR;
+  *stats = (queue_wait_stats) { 0 };
+  for (size_t i = 0; i < queue_p->nb_shards; ++i) {
+    queue_shard *shard = queue_p->shards[i];
+    stats->consumer_spins += atomic_load(&shard->consumer_spins);
+    stats->consumer_parks += atomic_load(&shard->consumer_parks);
+    stats->producer_spins += atomic_load(&shard->producer_spins);
+    stats->producer_parks += atomic_load(&shard->producer_parks);
   }
-  // Libère la projection mémoire
-  if (munmap(queue_p, 
-      sizeof(server_queue) + sizeof(shm_request) * queue_p->nb_slots) < 0) {
-    return SHM_ERROR;
+
+  return 1;
+}
+
+int set_queue_mode(server_queue *queue_p, mode_t mode) {
+  if (queue_p == NULL) {
+    return INVALID_POINTER;
   }
-  // Supprime le fichier shm
-  if (shm_unlink(SHM_NAME) < 0) {
-    return SHM_ERROR;
+  for (size_t i = 0; i < queue_p->nb_shards; ++i) {
+    char name[NAME_MAX + 1];
+    if (shard_name(queue_p->shm_name, i, name) < 0) {
+      return SHM_ERROR;
+    }
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+      return SHM_ERROR;
+    }
+    int r = fchmod(fd, mode);
+    close(fd);
+    if (r < 0) {
+      return SHM_ERROR;
+    }
   }
 
   return 1;
 }
 
-/*
- * Manipulation de la requête de connexion au serveur.
- */
+size_t get_nb_lanes(const server_queue *queue_p) {
+  return queue_p == NULL ? 0 : queue_p->shards[0]->nb_lanes;
+}
 
-int send_shm_request(server_queue *server_q, const char request_pipe_name[], 
-    const char response_pipe_name[], time_t timeout) {
-  if (server_q == NULL) {
+int set_lane_weights(server_queue *queue_p, const unsigned int weights[], 
+    size_t nb) {
+  if (queue_p == NULL || weights == NULL) {
     return INVALID_POINTER;
   }
-  struct timespec ts;
-  if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
+  if (nb != queue_p->shards[0]->nb_lanes) {
+    errno = EINVAL;
     return SHM_ERROR;
   }
-  ts.tv_sec += timeout;
-  // Attend au cas où la file soit en train d'être modifiée.
-  if (sem_timedwait(&server_q->empty, &ts) == -1) {
-    if (errno == ETIMEDOUT) {
-      return 0;
+  for (size_t i = 0; i < queue_p->nb_shards; ++i) {
+    queue_shard *shard = queue_p->shards[i];
+    for (size_t l = 0; l < nb; ++l) {
+      // Une voie de poids nul ne serait jamais vidée
+      shard->lane_weights[l] = MAX(weights[l], 1);
+      atomic_store(&shard->lanes[l].credit, shard->lane_weights[l]);
     }
-    return SEMAPHORE_ERROR;
   }
-  if (sem_timedwait(&server_q->mutex, &ts) == -1) {
-    if (errno == ETIMEDOUT) {
-      return 0;
-    }
-    return SEMAPHORE_ERROR;
+
+  return 1;
+}
+
+int set_lane_rules(server_queue *queue_p, const lane_rule rules[], 
+    size_t nb_rules, size_t default_lane) {
+  if (queue_p == NULL || (rules == NULL && nb_rules > 0)) {
+    return INVALID_POINTER;
   }
-  // Créé la requête à la volée
-  shm_request request = {
-    .request_pipe = "",
-    .response_pipe = "",
-    .pid = getpid(),
-    .uid = getuid()
-  };
-  // Remplit la requête en copiant les informations passées en paramètre
-  strncpy(request.request_pipe, request_pipe_name, NAME_MAX);
-  strncpy(request.response_pipe, response_pipe_name, NAME_MAX);
-  // Ajoute la requête à la file des connexions entrantes
-  server_q->buffer[server_q->head] = request;
-  server_q->head = (server_q->head + 1) % server_q->nb_slots;
-  server_q->length += 1;
-  // Donne le feu vert aux autres processus
-  if (sem_post(&server_q->mutex) == -1) {
-    return SEMAPHORE_ERROR;
+  queue_shard *first = queue_p->shards[0];
+  if (nb_rules > MAX_LANE_RULES || default_lane >= first->nb_lanes) {
+    errno = EINVAL;
+    return SHM_ERROR;
   }
-  if (sem_post(&server_q->full) == -1) {
-    return SEMAPHORE_ERROR;
+  for (size_t i = 0; i < nb_rules; ++i) {
+    if (rules[i].lane >= first->nb_lanes) {
+      errno = EINVAL;
+      return SHM_ERROR;
+    }
   }
+  // Les clients ne lisent que la partition 0
+  memcpy(first->rules, rules, nb_rules * sizeof(lane_rule));
+  first->nb_rules = nb_rules;
+  first->default_lane = default_lane;
 
   return 1;
 }
 
-int fetch_shm_request(server_queue *server_q, int (*apply)(shm_request *)) {
-  if (server_q == NULL || apply == NULL) {
+int get_lane_stats(const server_queue *queue_p, size_t lane, 
+    lane_stats *stats) {
+  if (queue_p == NULL || stats == NULL) {
     return INVALID_POINTER;
   }
-  // Attend que les autres processus finissent le traitement d'une réponse
-  if (sem_wait(&server_q->full) == -1) {
-    return SEMAPHORE_ERROR;
-  }
-  if (sem_wait(&server_q->mutex) == -1) {
-    return SEMAPHORE_ERROR;
+  if (lane >= queue_p->shards[0]->nb_lanes) {
+    errno = EINVAL;
+    return SHM_ERROR;
   }
-  // Applique la fonction apply sur la requête la plus ancienne
-  int r = apply(&server_q->buffer[server_q->tail]);
-  // Change le pointeur de queue de la file
-  server_q->tail = (server_q->tail + 1) % server_q->nb_slots;
-  server_q->length -= 1;
-  // Donne le feu vert aux autres processus
-  if (sem_post(&server_q->mutex) == -1) {
-    return SEMAPHORE_ERROR;
+  *stats = (lane_stats) { 0 };
+  for (size_t i = 0; i < queue_p->nb_shards; ++i) {
+    queue_lane *l = &queue_p->shards[i]->lanes[lane];
+    stats->depth += atomic_load(&l->length);
+    stats->dequeued += atomic_load(&l->dequeued);
+    stats->wait_ns += atomic_load(&l->wait_ns);
+    stats->max_wait_ns = MAX(stats->max_wait_ns, 
+        atomic_load(&l->max_wait_ns));
+    stats->expired += atomic_load(&l->expired);
   }
-  if (sem_post(&server_q->empty) == -1) {
-    return SEMAPHORE_ERROR;
+
+  return 1;
+}
+
+/**
+ * Renvoie le nombre de requêtes en attente dans la file server_q, toutes 
+ * voies et partitions confondues.
+ */
+static size_t queue_length(const server_queue *server_q) {
+  size_t length = 0;
+  for (size_t i = 0; i < server_q->nb_shards; ++i) {
+    queue_shard *shard = server_q->shards[i];
+    for (size_t l = 0; l < shard->nb_lanes; ++l) {
+      length += atomic_load(&shard->lanes[l].length);
+    }
   }
 
-  return r;
+  return length;
 }
 
-/*
- * Manipulation de la requête à écrire sur le tube.
+/**
+ * Estime le temps qu'attendrait une nouvelle requête de la file server_q 
+ * avant que le serveur n'en ouvre la session : les sessions en cours et les
+ * requêtes en attente au-delà de la capacité du serveur doivent d'abord se
+ * terminer. Sans limite de sessions, la capacité n'est connue que lorsque 
+ * la file est pleine (full) : ce sont alors les sessions en cours.
+ * 
+ * @param {const server_queue *} La file.
+ * @param {int} Une valeur non nulle si la voie du client est pleine.
+ * @return {unsigned long long} L'attente estimée en nanosecondes, 0 si la
+ *                              requête serait acceptée sans attendre ou si
+ *                              aucune session ne s'est encore terminée.
  */
+static unsigned long long estimate_wait_ns(const server_queue *server_q, 
+    int full) {
+  queue_shard *first = server_q->shards[0];
+  size_t active = atomic_load(&first->active_sessions);
+  size_t capacity = atomic_load(&first->max_sessions);
+  if (capacity == 0) {
+    if (!full) {
+      return 0;
+    }
+    capacity = MAX(active, 1);
+  }
+  size_t ahead = active + queue_length(server_q) + 1;
+  if (ahead <= capacity) {
+    return 0;
+  }
 
-struct request_fifo {
-  char id[NAME_MAX + 1];
-};
+  return atomic_load(&first->service_ns) * (ahead - capacity) / capacity;
+}
 
-typedef struct request {
-  char cmd[MAX_COMMAND_LENGTH + 1];
-} request;
+int get_queue_load(const server_queue *queue_p, queue_load *load) {
+  if (queue_p == NULL || load == NULL) {
+    return INVALID_POINTER;
+  }
+  queue_shard *first = queue_p->shards[0];
+  load->length = queue_length(queue_p);
+  load->active_sessions = atomic_load(&first->active_sessions);
+  load->max_sessions = atomic_load(&first->max_sessions);
+  load->service_ns = atomic_load(&first->service_ns);
+  load->rejected = atomic_load(&first->rejected);
 
-request_fifo *init_request_fifo(const char *id) {
-  request_fifo *req = malloc(sizeof *req);
-  if (req == NULL) {
-    return NULL;
+  return 1;
+}
+
+void set_max_sessions(server_queue *queue_p, size_t max) {
+  if (queue_p != NULL) {
+    atomic_store(&queue_p->shards[0]->max_sessions, max);
   }
-  // Créé le tube
-  if (mkfifo(id, S_IRUSR | S_IWUSR) < 0) {
-    return NULL;
+}
+
+size_t add_active_session(server_queue *queue_p) {
+  if (queue_p == NULL) {
+    return 0;
   }
-  strncpy(req->id, id, NAME_MAX);
 
-  return req;
+  return atomic_fetch_add(&queue_p->shards[0]->active_sessions, 1) + 1;
 }
 
-int send_request(request_fifo *req_fifo, const char *cmd, time_t timeout) {
-  if (req_fifo == NULL || cmd == NULL) {
+size_t remove_active_session(server_queue *queue_p, 
+    unsigned long long service_ns) {
+  if (queue_p == NULL) {
+    return 0;
+  }
+  queue_shard *first = queue_p->shards[0];
+  // Moyenne glissante de poids 1/8 : la première session donne la mesure
+  unsigned long long avg = atomic_load(&first->service_ns);
+  unsigned long long next;
+  do {
+    next = avg == 0 ? service_ns : avg - avg / 8 + service_ns / 8;
+  } while (service_ns > 0 
+      && !atomic_compare_exchange_weak(&first->service_ns, &avg, next));
+
+  return atomic_fetch_sub(&first->active_sessions, 1) - 1;
+}
+
+long get_retry_after(const server_queue *queue_p) {
+  if (queue_p == NULL) {
     return INVALID_POINTER;
   }
-  // Créé la requête
-  request req = { .cmd = "" };
-  strncpy(req.cmd, cmd, MAX_COMMAND_LENGTH);
-  // Gestion du timeout
-  int pipe_fd = 0;
-  int r = 0;
-  struct sigaction action;
-  switch (fork()) {
-    case -1:
-      return PROC_ERROR;
-    case 0:
-      // Mise en place d'une alarme
-      action.sa_handler = exit_sig;
-      action.sa_flags = 0;
-      if (sigfillset(&action.sa_mask) == -1) {
-        perror("Erreur lors de la création du masque des signaux bloqués ");
-        exit(SIG_ERROR);
-      }
-      // On associe l'action au signal d'alarme
-      if (sigaction(SIGALRM, &action, NULL) == -1) {
-        perror("Erreur lors de l'association d'une action aux signaux ");
-        exit(SIG_ERROR);
-      }
-      alarm((unsigned int) timeout);
-      // Ouvre le tube du réseau
-      if ((pipe_fd = open(req_fifo->id, O_WRONLY)) < 0) {
-        return PIPE_ERROR;
-      }
-      // Envoie la requête
-      if (write(pipe_fd, &req, sizeof(request)) < 0) {
-        return PIPE_ERROR;
-      }
-      // Ferme le tube
-      if (close(pipe_fd) < 0) {
-        return PIPE_ERROR;
-      }
-      exit(EXIT_SUCCESS);
-    default:
-      wait(&r);
-      if (r < 0) {
-        return r;
-      } else if (r > 0) {
-        return 0;
-      }
+  unsigned long long wait_ms = estimate_wait_ns(queue_p, 1) / 1000000ULL;
+
+  return wait_ms > LONG_MAX ? LONG_MAX 
+      : MAX((long) wait_ms, RETRY_AFTER_MIN_MS);
+}
+
+int disconnect(server_queue *queue_p) {
+  if (queue_p == NULL) {
+    return INVALID_POINTER;
   }
 
-  return 1;
+  return release_shards(queue_p, 0);
 }
 
-int listen_request(const char *id, char *buffer) {
-  if (id == NULL || buffer == NULL) {
+int free_server_queue(server_queue *queue_p) {
+  if (queue_p == NULL) {
+    return INVALID_POINTER;
+  }
+
+  return release_shards(queue_p, 1);
+}
+
+/*
+ * Manipulation de la requête de connexion au serveur.
+ */
+
+/**
+ * Tente d'ajouter la requête request à la voie lane de la partition shard 
+ * sans attendre.
+ * 
+ * @param {queue_shard *} La partition.
+ * @param {size_t} La voie.
+ * @param {const shm_request *} La requête à ajouter.
+ * @return {int} 1 si la requête a été ajoutée et 0 si la voie est pleine.
+ */
+static int try_enqueue(queue_shard *shard, size_t lane, 
+    const shm_request *request) {
+  queue_lane *l = &shard->lanes[lane];
+  queue_slot *buffer = &shard->buffer[lane * shard->nb_slots];
+  size_t pos = atomic_load_explicit(&l->head, memory_order_relaxed);
+  while (1) {
+    queue_slot *slot = &buffer[pos % shard->nb_slots];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if (diff == 0) {
+      // La case est libre : la réserve en avançant la tête
+      if (atomic_compare_exchange_weak_explicit(&l->head, &pos, pos + 1, 
+          memory_order_relaxed, memory_order_relaxed)) {
+        slot->request = *request;
+        clock_gettime(CLOCK_MONOTONIC, &slot->enqueued);
+        atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+        return 1;
+      }
+    } else if (diff < 0) {
+      // La case n'a pas encore été libérée par un consommateur
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&l->head, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * Tente de retirer la requête la plus ancienne de la voie lane de la 
+ * partition shard sans attendre et la copie dans request. Son attente est 
+ * ajoutée aux statistiques de la voie.
+ * 
+ * @param {queue_shard *} La partition.
+ * @param {size_t} La voie.
+ * @param {shm_request *} L'adresse où copier la requête.
+ * @return {int} 1 si une requête a été retirée et 0 si la voie est vide.
+ */
+static int try_dequeue(queue_shard *shard, size_t lane, 
+    shm_request *request) {
+  queue_lane *l = &shard->lanes[lane];
+  queue_slot *buffer = &shard->buffer[lane * shard->nb_slots];
+  size_t pos = atomic_load_explicit(&l->tail, memory_order_relaxed);
+  while (1) {
+    queue_slot *slot = &buffer[pos % shard->nb_slots];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&l->tail, &pos, pos + 1, 
+          memory_order_relaxed, memory_order_relaxed)) {
+        // Copie la requête avant de rendre la case aux producteurs
+        *request = slot->request;
+        struct timespec enqueued = slot->enqueued;
+        atomic_store_explicit(&slot->sequence, pos + shard->nb_slots, 
+            memory_order_release);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long ns = (long long) (now.tv_sec - enqueued.tv_sec) 
+            * 1000000000LL + (now.tv_nsec - enqueued.tv_nsec);
+        unsigned long long wait = ns > 0 ? (unsigned long long) ns : 0;
+        atomic_fetch_add_explicit(&l->dequeued, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&l->wait_ns, wait, memory_order_relaxed);
+        unsigned long long max = atomic_load_explicit(&l->max_wait_ns, 
+            memory_order_relaxed);
+        while (wait > max && !atomic_compare_exchange_weak_explicit(
+            &l->max_wait_ns, &max, wait, memory_order_relaxed, 
+            memory_order_relaxed)) {
+        }
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&l->tail, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * Tente de retirer une requête de la partition shard en respectant le poids
+ * des voies : dans un tour, la voie i cède au plus lane_weights[i] requêtes,
+ * les voies prioritaires d'abord. Un nouveau tour commence dès que les voies 
+ * non vides ont épuisé leur part, une voie chargée ne bloquant ainsi jamais
+ * les autres.
+ * 
+ * @param {queue_shard *} La partition.
+ * @param {shm_request *} L'adresse où copier la requête.
+ * @return {ssize_t} La voie de la requête retirée ou -1 si la partition est
+ *                   vide.
+ */
+static ssize_t try_dequeue_weighted(queue_shard *shard, 
+    shm_request *request) {
+  for (int round = 0; round < 2; ++round) {
+    for (size_t lane = 0; lane < shard->nb_lanes; ++lane) {
+      queue_lane *l = &shard->lanes[lane];
+      unsigned int credit = atomic_load(&l->credit);
+      if (credit == 0 || !try_dequeue(shard, lane, request)) {
+        continue;
+      }
+      // Les autres consommateurs de la partition ont pu entamer le crédit
+      while (credit > 0 && !atomic_compare_exchange_weak(&l->credit, &credit,
+          credit - 1)) {
+      }
+      return (ssize_t) lane;
+    }
+    // Les voies qui ont encore du crédit sont vides : nouveau tour
+    for (size_t lane = 0; lane < shard->nb_lanes; ++lane) {
+      atomic_store(&shard->lanes[lane].credit, shard->lane_weights[lane]);
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Renvoie la voie de la partition first dans laquelle un client de 
+ * l'utilisateur uid doit envoyer sa requête : la première règle portant sur
+ * uid, sur son groupe ou sur l'un de ses groupes supplémentaires, et à défaut
+ * la voie par défaut.
+ * 
+ * @param {const queue_shard *} La partition 0 de la file.
+ * @param {uid_t} L'utilisateur.
+ * @return {size_t} La voie.
+ */
+static size_t select_lane(const queue_shard *first, uid_t uid) {
+  size_t lane = first->default_lane < first->nb_lanes 
+      ? first->default_lane : 0;
+  gid_t *groups = NULL;
+  int nb_groups = -1;
+  for (size_t i = 0; i < first->nb_rules; ++i) {
+    const lane_rule *rule = &first->rules[i];
+    if (rule->kind == LANE_RULE_UID && rule->id == uid) {
+      lane = rule->lane;
+      break;
+    }
+    if (rule->kind != LANE_RULE_GID) {
+      continue;
+    }
+    // Les groupes ne sont lus qu'en présence de règles les concernant
+    if (nb_groups < 0) {
+      int n = getgroups(0, NULL);
+      groups = malloc((size_t) (MAX(n, 0) + 1) * sizeof(gid_t));
+      if (groups == NULL) {
+        break;
+      }
+      groups[0] = getgid();
+      n = n > 0 ? getgroups(n, groups + 1) : 0;
+      nb_groups = MAX(n, 0) + 1;
+    }
+    int match = 0;
+    for (int k = 0; k < nb_groups && !match; ++k) {
+      match = groups[k] == rule->id;
+    }
+    if (match) {
+      lane = rule->lane;
+      break;
+    }
+  }
+  free(groups);
+
+  return lane;
+}
+
+/**
+ * Signale l'ajout d'une requête dans la voie lane de la partition shard et 
+ * réveille un éventuel consommateur endormi.
+ */
+static void notify_enqueued(queue_shard *shard, size_t lane) {
+  atomic_fetch_add(&shard->lanes[lane].length, 1);
+  atomic_fetch_add(&shard->not_empty_seq, 1);
+  if (atomic_load(&shard->consumers_waiting) > 0) {
+    futex_wake_all(&shard->not_empty_seq);
+  }
+}
+
+/**
+ * Ajoute la requête request à la file server_q en attendant au plus timeout
+ * secondes qu'une place se libère. La voie est choisie d'après les règles 
+ * publiées par le serveur et la partition d'après le pid du client ; si la 
+ * voie de cette partition est pleine, celles des suivantes sont essayées 
+ * avant d'attendre sur la première. La requête est refusée sans attendre si
+ * la charge publiée par le serveur ne permet pas de l'accepter à temps.
+ * 
+ * @param {server_queue *} La file de requêtes.
+ * @param {shm_request *} La requête à ajouter, dont l'échéance est fixée au
+ *                        timeout.
+ * @param {time_t} Un timeout.
+ * @return {int} 1 si tout se passe bien, 0 si le timeout a été atteint, 
+ *               SERVER_IS_FULL si la requête est refusée et une valeur 
+ *               négative en cas d'erreur.
+ */
+static int enqueue_shm_request(server_queue *server_q, 
+    shm_request *request, time_t timeout) {
+  // Le client renonce s'il n'est pas accepté avant le timeout : au-delà, le
+  // serveur écarte la requête sans ouvrir la session
+  deadline_after(timeout, &request->deadline);
+  // Hachage multiplicatif : des pid consécutifs tombent sur des partitions
+  // différentes
+  size_t home = (size_t) ((uint32_t) request->pid * 2654435761u) 
+      % server_q->nb_shards;
+  size_t lane = select_lane(server_q->shards[0], request->uid);
+  // Admission : une requête qui ne serait pas acceptée avant son timeout est
+  // refusée tout de suite plutôt que d'occuper une place jusqu'à l'échéance
+  unsigned long long limit_ns = (unsigned long long) MAX(timeout, 0) 
+      * 1000000000ULL;
+  if (estimate_wait_ns(server_q, 0) > limit_ns) {
+    goto reject;
+  }
+  for (size_t i = 0; i < server_q->nb_shards; ++i) {
+    queue_shard *shard = server_q->shards[(home + i) % server_q->nb_shards];
+    if (try_enqueue(shard, lane, request)) {
+      notify_enqueued(shard, lane);
+      return 1;
+    }
+  }
+  if (estimate_wait_ns(server_q, 1) > limit_ns) {
+    goto reject;
+  }
+  queue_shard *shard = server_q->shards[home];
+  queue_lane *l = &shard->lanes[lane];
+  const struct timespec *deadline = &request->deadline;
+  while (1) {
+    // Le compteur est lu avant l'essai : un retrait ultérieur le modifie
+    unsigned int seq = atomic_load(&l->not_full_seq);
+    if (try_enqueue(shard, lane, request)) {
+      break;
+    }
+    // Un consommateur actif libère souvent une place en quelques 
+    // microsecondes
+    if (spin_until_changed(&l->not_full_seq, seq, &l->producer_spin,
+        &shard->producer_spins)) {
+      if (deadline_passed(deadline)) {
+        return 0;
+      }
+      continue;
+    }
+    // La voie est pleine : s'annonce puis revérifie avant de s'endormir
+    atomic_fetch_add(&l->producers_waiting, 1);
+    int full = !try_enqueue(shard, lane, request);
+    int r = full ? park_until_changed(&l->not_full_seq, seq, deadline, 
+        &l->producer_spin, &shard->producer_parks) : 1;
+    atomic_fetch_sub(&l->producers_waiting, 1);
+    if (!full) {
+      break;
+    }
+    if (r < 0) {
+      return SHM_ERROR;
+    }
+    if (r == 0 || deadline_passed(deadline)) {
+      return 0;
+    }
+  }
+  notify_enqueued(shard, lane);
+
+  return 1;
+
+reject:
+  atomic_fetch_add(&server_q->shards[0]->rejected, 1);
+  errno = EAGAIN;
+  return SERVER_IS_FULL;
+}
+
+int send_shm_request(server_queue *server_q, const char request_pipe_name[], 
+    const char response_pipe_name[], int capabilities, time_t timeout) {
+  if (server_q == NULL) {
+    return INVALID_POINTER;
+  }
+  // Créé la requête à la volée
+  shm_request request = {
+    .request_pipe = "",
+    .response_pipe = "",
+    .session_shm = "",
+    .socket_path = "",
+    .transport = TRANSPORT_FIFO,
+    .capabilities = capabilities,
+    .pid = getpid(),
+    .uid = getuid()
+  };
+  // Remplit la requête en copiant les informations passées en paramètre
+  strncpy(request.request_pipe, request_pipe_name, NAME_MAX);
+  strncpy(request.response_pipe, response_pipe_name, NAME_MAX);
+
+  return enqueue_shm_request(server_q, &request, timeout);
+}
+
+int send_shm_ring_request(server_queue *server_q, 
+    const char session_shm_name[], int capabilities, time_t timeout) {
+  if (server_q == NULL || session_shm_name == NULL) {
+    return INVALID_POINTER;
+  }
+  shm_request request = {
+    .request_pipe = "",
+    .response_pipe = "",
+    .session_shm = "",
+    .socket_path = "",
+    .transport = TRANSPORT_SHM_RING,
+    .capabilities = capabilities,
+    .pid = getpid(),
+    .uid = getuid()
+  };
+  strncpy(request.session_shm, session_shm_name, NAME_MAX);
+
+  return enqueue_shm_request(server_q, &request, timeout);
+}
+
+int send_shm_socket_request(server_queue *server_q, 
+    const char socket_path[], int capabilities, time_t timeout) {
+  if (server_q == NULL || socket_path == NULL) {
+    return INVALID_POINTER;
+  }
+  shm_request request = {
+    .request_pipe = "",
+    .response_pipe = "",
+    .session_shm = "",
+    .socket_path = "",
+    .transport = TRANSPORT_SOCKET,
+    .capabilities = capabilities,
+    .pid = getpid(),
+    .uid = getuid()
+  };
+  strncpy(request.socket_path, socket_path, NAME_MAX);
+
+  return enqueue_shm_request(server_q, &request, timeout);
+}
+
+/**
+ * Retire de la partition shard au plus max requêtes et les copie dans batch,
+ * en respectant le poids des voies. Attend tant que la partition est vide 
+ * puis prend toutes les requêtes présentes sans se rendormir, hormis celles
+ * dont l'échéance est dépassée. Les producteurs de chaque voie sont réveillés
+ * une seule fois.
+ * 
+ * @param {queue_shard *} La partition.
+ * @param {const atomic_int *} Non nul si le retrait est suspendu.
+ * @param {shm_request *} Le tableau où copier les requêtes.
+ * @param {size_t} La taille du tableau.
+ * @return {ssize_t} Le nombre de requêtes retirées, 0 si le retrait a été 
+ *                   suspendu et une valeur négative en cas d'erreur.
+ */
+static ssize_t dequeue_batch(queue_shard *shard, const atomic_int *paused,
+    shm_request *batch, size_t max) {
+  while (1) {
+    size_t taken[MAX_LANES] = { 0 };
+    ssize_t lane;
+    // Attend tant que la partition est vide
+    while (1) {
+      // Le compteur est lu avant l'essai : un ajout ultérieur le modifie
+      unsigned int seq = atomic_load(&shard->not_empty_seq);
+      if (atomic_load(paused)) {
+        return 0;
+      }
+      if ((lane = try_dequeue_weighted(shard, &batch[0])) >= 0) {
+        break;
+      }
+      if (spin_until_changed(&shard->not_empty_seq, seq, 
+          &shard->consumer_spin, &shard->consumer_spins)) {
+        continue;
+      }
+      atomic_fetch_add(&shard->consumers_waiting, 1);
+      lane = try_dequeue_weighted(shard, &batch[0]);
+      int empty = lane < 0;
+      int r = empty ? park_until_changed(&shard->not_empty_seq, seq, NULL, 
+          &shard->consumer_spin, &shard->consumer_parks) : 1;
+      atomic_fetch_sub(&shard->consumers_waiting, 1);
+      if (!empty) {
+        break;
+      }
+      if (r < 0) {
+        return SHM_ERROR;
+      }
+    }
+    // Prend les requêtes déjà en attente. Celles dont le client a déjà 
+    // renoncé sont écartées : le serveur attendrait en vain leurs tubes.
+    size_t n = 0;
+    do {
+      ++taken[lane];
+      const struct timespec *deadline = &batch[n].deadline;
+      if ((deadline->tv_sec != 0 || deadline->tv_nsec != 0) 
+          && deadline_passed(deadline)) {
+        atomic_fetch_add(&shard->lanes[lane].expired, 1);
+      } else {
+        ++n;
+      }
+    } while (n < max && (lane = try_dequeue_weighted(shard, &batch[n])) >= 0);
+    // Libère les éventuels producteurs endormis avant de traiter les 
+    // requêtes
+    for (size_t i = 0; i < shard->nb_lanes; ++i) {
+      if (taken[i] == 0) {
+        continue;
+      }
+      queue_lane *l = &shard->lanes[i];
+      atomic_fetch_sub(&l->length, taken[i]);
+      atomic_fetch_add(&l->not_full_seq, 1);
+      if (atomic_load(&l->producers_waiting) > 0) {
+        futex_wake_all(&l->not_full_seq);
+      }
+    }
+    if (n > 0) {
+      return (ssize_t) n;
+    }
+  }
+}
+
+int fetch_shm_request(server_queue *server_q, size_t shard, 
+    int (*apply)(shm_request *)) {
+  if (server_q == NULL || apply == NULL) {
+    return INVALID_POINTER;
+  }
+  if (shard >= server_q->nb_shards) {
+    errno = EINVAL;
+    return SHM_ERROR;
+  }
+  shm_request request;
+  ssize_t n = dequeue_batch(server_q->shards[shard], &server_q->paused, 
+      &request, 1);
+  if (n <= 0) {
+    return (int) n;
+  }
+
+  // Applique la fonction apply sur la copie de la requête, hors de la file
+  return apply(&request);
+}
+
+int fetch_shm_requests(server_queue *server_q, size_t shard, 
+    int (*apply)(shm_request *, size_t), size_t max_batch) {
+  if (server_q == NULL || apply == NULL) {
+    return INVALID_POINTER;
+  }
+  if (shard >= server_q->nb_shards) {
+    errno = EINVAL;
+    return SHM_ERROR;
+  }
+  // Un lot ne peut pas dépasser la capacité de la partition
+  size_t max = MIN(MAX(max_batch, 1), server_q->shards[shard]->nb_lanes 
+      * server_q->shards[shard]->nb_slots);
+  shm_request batch[max];
+  ssize_t n = dequeue_batch(server_q->shards[shard], &server_q->paused, 
+      batch, max);
+  if (n <= 0) {
+    return (int) n;
+  }
+
+  return apply(batch, (size_t) n);
+}
+
+void pause_fetching(server_queue *server_q, int paused) {
+  if (server_q == NULL) {
+    return;
+  }
+  atomic_store(&server_q->paused, paused != 0);
+  // Réveille les threads qui attendent une requête pour qu'ils constatent 
+  // la suspension
+  for (size_t i = 0; i < server_q->nb_shards; ++i) {
+    queue_shard *shard = server_q->shards[i];
+    atomic_fetch_add(&shard->not_empty_seq, 1);
+    futex_wake_all(&shard->not_empty_seq);
+  }
+}
+
+/*
+ * Manipulation de la requête à écrire sur le tube.
+ */
+
+struct request_fifo {
+  char id[NAME_MAX + 1];
+};
+
+typedef struct request {
+  unsigned int id; // Identifiant repris par les morceaux de la réponse
+  char cmd[MAX_COMMAND_LENGTH + 1];
+} request;
+
+/**
+ * En-tête d'une requête de session, suivi de length octets de commande sans
+ * '\0' final.
+ */
+typedef struct request_header {
+  unsigned char version; // REQUEST_VERSION
+  unsigned char type;    // REQUEST_COMMAND
+  unsigned short flags;  // Réservé, 0
+  unsigned int id;       // Identifiant repris par les morceaux de la réponse
+  unsigned int length;
+  unsigned long long deadline; // Echéance de la réponse en ns 
+                               // (CLOCK_MONOTONIC), 0 si aucune
+} request_header;
+
+// Taille de référence d'une requête pour le calcul de la profondeur de 
+// pipeline
+#define REQUEST_NOMINAL_SIZE (sizeof(request_header) + MAX_COMMAND_LENGTH)
+
+request_fifo *init_request_fifo(const char *id) {
+  request_fifo *req = malloc(sizeof *req);
+  if (req == NULL) {
+    return NULL;
+  }
+  // Créé le tube
+  if (mkfifo(id, S_IRUSR | S_IWUSR) < 0) {
+    return NULL;
+  }
+  strncpy(req->id, id, NAME_MAX);
+
+  return req;
+}
+
+int send_request(request_fifo *req_fifo, const char *cmd, time_t timeout) {
+  if (req_fifo == NULL || cmd == NULL) {
+    return INVALID_POINTER;
+  }
+  // Créé la requête
+  request req = { .id = 0, .cmd = "" };
+  strncpy(req.cmd, cmd, MAX_COMMAND_LENGTH);
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  // Ouvre le tube du réseau dès que le serveur l'écoute
+  int pipe_fd = open_fifo_writer(req_fifo->id, &deadline);
+  if (pipe_fd < 0) {
+    return errno == ETIMEDOUT ? 0 : PIPE_ERROR;
+  }
+  // Envoie la requête
+  int r = write_full(pipe_fd, &req, sizeof(request), &deadline);
+  if (close(pipe_fd) < 0 && r > 0) {
+    return PIPE_ERROR;
+  }
+
+  return r;
+}
+
+int listen_request(const char *id, char *buffer) {
+  if (id == NULL || buffer == NULL) {
     return INVALID_POINTER;
   }
   // Ouvre le tube
@@ -397,79 +1390,32 @@ int send_response(const char *id, const char *msg, ssize_t max_size,
   if (id == NULL || msg == NULL) {
     return INVALID_POINTER;
   }
-  // Crée la réponse
+  // Calcule la taille de la réponse
   size_t size = strlen(msg) + 1;
   if (max_size >= 0) {
     size = MIN(size, (size_t) max_size);
   }
-  response *res = malloc(sizeof(*res) + size);
-  if (res == NULL) {
-    return MEMORY_ERROR;
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  // Ouvre le tube en écriture dès que le client l'écoute
+  int pipe_fd = open_fifo_writer(id, &deadline);
+  if (pipe_fd < 0) {
+    return errno == ETIMEDOUT ? 0 : PIPE_ERROR;
   }
-  res->size = size;
-  for (size_t i = 0; i < res->size; ++i) {
-    res->msg[i] = msg[i];
+  // Envoie la taille puis le contenu de la réponse
+  int r = write_full(pipe_fd, &size, sizeof(size_t), &deadline);
+  if (r > 0) {
+    r = write_full(pipe_fd, msg, size, &deadline);
   }
-  int pipe_fd = 0;
-  int r = 0;
-  ssize_t n = 0;
-  size_t total = 0;
-  struct sigaction action;
-  // Gestion du timeout
-  switch (fork()) {
-    case -1:
-      return PROC_ERROR;
-    case 0:
-      // Mise en place d'une alarme
-      action.sa_handler = exit_sig;
-      action.sa_flags = 0;
-      if (sigfillset(&action.sa_mask) == -1) {
-        perror("Erreur lors de la création du masque des signaux bloqués ");
-        exit(SIG_ERROR);
-      }
-      // On associe l'action au signal d'alarme
-      if (sigaction(SIGALRM, &action, NULL) == -1) {
-        perror("Erreur lors de l'association d'une action aux signaux ");
-        exit(SIG_ERROR);
-      }
-      alarm((unsigned int) timeout);
-      // Ouvre le tube en écriture
-      if ((pipe_fd = open(id, O_WRONLY)) < 0) {
-        exit(PIPE_ERROR);
-      }
-      // Envoi la réponse
-      if ((n = write(pipe_fd, res, sizeof(size_t))) < 0) {
-        free(res);
-        exit(PIPE_ERROR);
-      }
-      while (
-        (max_size < 0 || total < (size_t) max_size) &&
-        (n = write(pipe_fd, &res->msg[total], res->size - total)) > 0
-      ) {
-        total += (size_t) n;
-      }
-      if (n < 0) {
-        exit(PIPE_ERROR);
-      }
-      if (close(pipe_fd) < 0) {
-        exit(PIPE_ERROR);
-      }
-      exit(EXIT_SUCCESS);
-    default:
-      wait(&r);
-      free(res);
-      if (r < 0) {
-        return r;
-      } else if (r > 0) {
-        return 0;
-      }
+  if (close(pipe_fd) < 0 && r > 0) {
+    return PIPE_ERROR;
   }
 
-  return 1;
+  return r;
 }
 
 int listen_response(response_fifo *res_fifo, char **buffer, time_t timeout) {
-  if (res_fifo == NULL) {
+  if (res_fifo == NULL || buffer == NULL) {
     return INVALID_POINTER;
   }
   // Ouvre le tube de réponse
@@ -477,61 +1423,29 @@ int listen_response(response_fifo *res_fifo, char **buffer, time_t timeout) {
   if ((pipe_fd = open(res_fifo->id, O_RDONLY | O_NONBLOCK)) < 0) {
     return PIPE_ERROR;
   }
-  // Attend que le serveur ait écrit
-  fd_set set;
-  struct timeval tv;
-  tv.tv_sec = timeout;
-  FD_ZERO(&set);
-  FD_SET(pipe_fd, &set);
-  int ret = select(pipe_fd + 1, &set, NULL, NULL, &tv);
-  if (ret < 0) {
-    fprintf(stderr, "Select error\n");
-    return PIPE_ERROR;
-  } else if (ret == 0) {
-    return 0;
-  }
-  // Lit la taille de la réponse
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  // Lit la taille de la réponse puis son contenu
   size_t size;
-  ssize_t n;
-  if ((n = read(pipe_fd, &size, sizeof(size_t))) < 0) {
-    return PIPE_ERROR;
-  }
-  response *res = malloc(sizeof(*res) + size);
-  if (res == NULL) {
-    return MEMORY_ERROR;
-  }
-  res->size = size;
-  // Lit le contenu de la réponse
-  size_t total = 0;
-  while (total < size) {
-    FD_ZERO(&set);
-    FD_SET(pipe_fd, &set);
-    ret = select(pipe_fd + 1, &set, NULL, NULL, &tv);
-    if (ret < 0) {
-      fprintf(stderr, "Select error\n");
-      return PIPE_ERROR;
-    } else if (ret == 0) {
-      return 0;
+  char *msg = NULL;
+  int r = read_full(pipe_fd, &size, sizeof(size_t), &deadline);
+  if (r > 0) {
+    // Ajoute un octet afin de terminer les réponses tronquées
+    if ((msg = malloc(size + 1)) == NULL) {
+      r = MEMORY_ERROR;
+    } else if ((r = read_full(pipe_fd, msg, size, &deadline)) > 0) {
+      msg[size] = '\0';
+      *buffer = msg;
+    } else {
+      free(msg);
     }
-    if ((n = read(pipe_fd, &res->msg[total], size - total)) < 0) {
-      free(res);
-      return PIPE_ERROR;
-    }
-    total += (size_t) n;
-  }
-  // Copie le résultat de la commande dans le buffer
-  *buffer = malloc(size);
-  if (*buffer == NULL) {
-    return MEMORY_ERROR;
   }
-  strncpy(*buffer, res->msg, res->size);
-  free(res);
-  // Ferme et supprime le tube
-  if (close(pipe_fd) < 0) {
+  // Ferme le tube
+  if (close(pipe_fd) < 0 && r > 0) {
     return PIPE_ERROR;
   }
 
-  return 1;
+  return r;
 }
 
 int close_response_fifo(response_fifo *res) {
@@ -543,9 +1457,1819 @@ int close_response_fifo(response_fifo *res) {
   return 1;
 }
 
-static void exit_sig(int signum) {
-  if (signum == SIGALRM) {
-    exit(1);
-  }
-  exit(SIG_ERROR);
-}
\ No newline at end of file
+/*
+ * Manipulation des sessions persistantes.
+ */
+
+// Indices des anneaux (ou des tubes) d'une session
+#define REQUEST_RING 0
+#define RESPONSE_RING 1
+
+// Période (en secondes) de vérification de la présence du pair lors d'une
+// attente sur un anneau.
+#define RING_LIVENESS_PERIOD 1
+
+// Taille maximale d'un message sur un socket : une écriture plus longue est 
+// découpée en messages de cette taille, et la lecture correspondante suit le
+// même découpage.
+#define SOCKET_MESSAGE_MAX 32768
+
+// Place approximative occupée dans le tampon d'envoi par un message de 
+// requête en attente (contenu et structure noyau associée)
+#define SOCKET_MESSAGE_COST 2048
+
+// Taille du tampon de recopie d'un descripteur dans un fichier en mémoire
+#define SPOOL_BUFFER_SIZE 65536
+
+// Silence (En millisecondes) de la commande au-delà duquel ce qui a déjà été
+// recopié est transmis sans attendre la suite
+#define SPOOL_IDLE_MS 20
+
+// Une requête refusée est ignorée si elle mesure au plus ce multiple de la
+// taille maximale des commandes. Au-delà, la session est fermée plutôt que de
+// lire ce qu'annonce le client.
+#define DISCARD_MAX_FACTOR 4
+
+/**
+ * Anneau d'octets à producteur unique et consommateur unique. head et tail
+ * comptent les octets écrits et lus depuis la création, la position dans
+ * l'anneau est obtenue par masquage.
+ */
+typedef struct spsc_ring {
+  _Alignas(CACHE_LINE) atomic_size_t head;
+  atomic_uint data_seq;    // Incrémenté après chaque écriture (futex)
+  atomic_uint data_waiter; // Non nul si le consommateur est endormi
+  _Alignas(CACHE_LINE) atomic_size_t tail;
+  atomic_uint space_seq;    // Incrémenté après chaque lecture (futex)
+  atomic_uint space_waiter; // Non nul si le producteur est endormi
+} spsc_ring;
+
+/**
+ * Segment de mémoire partagée d'une session. Les données des anneaux suivent
+ * l'en-tête : l'anneau i occupe data[i * ring_size .. (i + 1) * ring_size[.
+ */
+typedef struct session_shm {
+  atomic_int closed;
+  size_t ring_size;
+  spsc_ring rings[2];
+  char data[];
+} session_shm;
+
+// Le contenu du morceau est un bloc compressé (voir compression.h)
+#define CHUNK_COMPRESSED 0x1
+// Le morceau n'a pas de contenu : un fichier en mémoire de raw_size octets 
+// suivis d'un '\0' est joint à l'en-tête (TRANSPORT_SOCKET)
+#define CHUNK_FD 0x2
+
+// Indique si l'en-tête header termine la réponse
+#define IS_LAST_CHUNK(header) \
+    ((header).size == 0 && ((header).flags & CHUNK_FD) == 0)
+
+/**
+ * En-tête d'un morceau de réponse. Une réponse est une suite de morceaux 
+ * terminée par un morceau de taille nulle.
+ */
+typedef struct chunk_header {
+  unsigned int id; // Identifiant de la requête à laquelle le morceau répond
+  size_t size;     // Taille du contenu transmis
+  size_t raw_size; // Taille du contenu une fois décompressé
+  unsigned int flags;
+} chunk_header;
+
+/**
+ * Vue en mémoire d'un morceau transmis par descripteur, en attente de
+ * libération par session_free_chunk.
+ */
+typedef struct chunk_view {
+  char *data;
+  size_t size; // Taille de la projection
+  struct chunk_view *next;
+} chunk_view;
+
+/**
+ * Opérations d'un transport de session. channel désigne le sens des trames
+ * (REQUEST_RING ou RESPONSE_RING). read et write ont les mêmes retours que 
+ * read_full et write_full.
+ */
+typedef struct transport_ops {
+  int (*read)(session *s, int channel, void *buffer, size_t n, 
+      const struct timespec *deadline);
+  int (*write)(session *s, int channel, const void *buffer, size_t n, 
+      const struct timespec *deadline);
+  // Déplace n octets du tube fd vers le canal sans les recopier (NULL si non
+  // supporté)
+  int (*splice)(session *s, int channel, int fd, size_t n, 
+      const struct timespec *deadline);
+  // Comme write en joignant le descripteur fd (NULL si non supporté)
+  int (*write_fd)(session *s, int channel, const void *buffer, size_t n, 
+      int fd, const struct timespec *deadline);
+  // Descripteur signalant l'arrivée des requêtes (-1 si aucun)
+  int (*request_fd)(const session *s);
+  // Nombre de trames de requête tamponnées sans bloquer l'écrivain
+  size_t (*pipeline_depth)(const session *s);
+  // Libère les ressources du transport (pas la session elle-même)
+  int (*close)(session *s);
+} transport_ops;
+
+struct session {
+  int transport;
+  const transport_ops *ops;
+  int request_fd;  // Lecture côté serveur, écriture côté client
+  int response_fd; // Ecriture côté serveur, lecture côté client
+  int listen_fd;   // Socket d'écoute du client avant connexion du serveur
+  int passed_fd;   // Dernier descripteur reçu, pas encore réclamé
+  size_t request_max;
+  char *request_buffer; // Commande de la dernière requête reçue
+  size_t request_capacity;
+  time_t request_delay;    // Délai accordé aux requêtes envoyées (0 : aucun)
+  unsigned long long request_deadline; // Echéance de la dernière requête 
+                                       // reçue (voir request_header)
+  chunk_view *views;
+  char *ring_view; // Morceau prêté par l'anneau de réponse (NULL si aucun)
+  size_t ring_view_size;
+  session_shm *shm;
+  size_t shm_size;
+  size_t ring_size; // Capacité des anneaux, lue une fois à l'ouverture : le
+                    // pair peut réécrire celle du segment
+  pid_t peer; // Processus à l'autre extrémité des anneaux (0 si inconnu)
+  uid_t peer_uid;
+  int peer_known; // Non nul si peer et peer_uid sont fournis par le noyau
+  int peer_capabilities;
+  ssize_t compression_threshold; // -1 si la compression est désactivée
+  char shm_name[NAME_MAX + 1]; // Non vide si la session doit supprimer le
+                               // segment à sa fermeture
+  char socket_path[NAME_MAX + 1]; // Non vide si la session doit supprimer
+                                  // le socket
+};
+
+/*
+ * Transport par tubes nommés
+ */
+
+static int fifo_read(session *s, int channel, void *buffer, size_t n, 
+    const struct timespec *deadline);
+static int fifo_write(session *s, int channel, const void *buffer, size_t n,
+    const struct timespec *deadline);
+static int fifo_request_fd(const session *s);
+static size_t fifo_pipeline_depth(const session *s);
+static int fifo_splice(session *s, int channel, int fd, size_t n, 
+    const struct timespec *deadline);
+static int fifo_close(session *s);
+
+/*
+ * Transport par anneaux en mémoire partagée
+ */
+
+static int ring_read(session *s, int channel, void *buffer, size_t n, 
+    const struct timespec *deadline);
+static int ring_write(session *s, int channel, const void *buffer, size_t n,
+    const struct timespec *deadline);
+static int ring_request_fd(const session *s);
+static size_t ring_pipeline_depth(const session *s);
+static int ring_close(session *s);
+
+/**
+ * Comme session_wait_request pour une session TRANSPORT_SHM_RING : 
+ * l'attente sur l'anneau de requête est découpée afin de contrôler wake_fd.
+ */
+static int ring_wait_request(session *s, int wake_fd);
+
+/**
+ * Attend que les n prochains octets de l'anneau de réponse soient écrits 
+ * puis, s'ils sont contigus, les prête sans copie : *view pointe dans 
+ * l'anneau et les octets ne sont consommés que par ring_release. *view vaut
+ * NULL si les octets bouclent, l'appelant devant alors les lire avec 
+ * ring_read. Mêmes retours que read_full.
+ */
+static int ring_peek(session *s, size_t n, const struct timespec *deadline,
+    char **view);
+
+/**
+ * Consomme les octets de l'anneau de réponse prêtés par ring_peek.
+ */
+static void ring_release(session *s);
+
+/**
+ * Consomme les k octets suivant tail dans l'anneau r puis réveille le 
+ * producteur s'il attend de la place.
+ */
+static void ring_consume(spsc_ring *r, size_t tail, size_t k);
+
+/*
+ * Transport par socket du domaine Unix. Le client écoute, le serveur se 
+ * connecte : les deux sens partagent le même descripteur.
+ */
+
+static int socket_read(session *s, int channel, void *buffer, size_t n, 
+    const struct timespec *deadline);
+static int socket_write(session *s, int channel, const void *buffer, 
+    size_t n, const struct timespec *deadline);
+static int socket_write_fd(session *s, int channel, const void *buffer, 
+    size_t n, int fd, const struct timespec *deadline);
+static int socket_request_fd(const session *s);
+static size_t socket_pipeline_depth(const session *s);
+static int socket_close(session *s);
+
+/**
+ * Accepte, côté client, la connexion du serveur au plus tard à deadline puis
+ * supprime le socket. Mêmes retours que read_full.
+ */
+static int socket_accept_peer(session *s, const struct timespec *deadline);
+
+// Transports indexés par TRANSPORT_*
+static const transport_ops TRANSPORTS[] = {
+  { fifo_read, fifo_write, fifo_splice, NULL, fifo_request_fd, 
+      fifo_pipeline_depth, fifo_close },
+  { ring_read, ring_write, NULL, NULL, ring_request_fd, ring_pipeline_depth, 
+      ring_close },
+  { socket_read, socket_write, NULL, socket_write_fd, socket_request_fd, 
+      socket_pipeline_depth, socket_close }
+};
+
+#define NB_TRANSPORTS (sizeof(TRANSPORTS) / sizeof(TRANSPORTS[0]))
+
+/**
+ * Lit exactement n octets sur l'anneau (ou le tube) ring de la session s.
+ * Mêmes retours que read_full.
+ */
+static int session_read(session *s, int ring, void *buffer, size_t n, 
+    const struct timespec *deadline);
+
+/**
+ * Ecrit exactement n octets sur l'anneau (ou le tube) ring de la session s.
+ * Mêmes retours que write_full.
+ */
+static int session_write(session *s, int ring, const void *buffer, size_t n,
+    const struct timespec *deadline);
+
+/**
+ * Endort l'appelant tant que *seq vaut observed, au plus tard jusqu'à 
+ * deadline. Le pair est contrôlé toutes les RING_LIVENESS_PERIOD secondes.
+ * 
+ * @return {int} 1 si l'appelant doit revérifier l'anneau, 0 si l'échéance a 
+ *               été atteinte, PIPE_CLOSED si le pair a disparu.
+ */
+static int ring_wait(session *s, atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline);
+
+/**
+ * Réveille les processus endormis sur seq.
+ */
+static void ring_wake(atomic_uint *seq);
+
+/**
+ * Envoie un morceau d'en-tête header suivi de son contenu data.
+ */
+static int send_chunk(session *s, const chunk_header *header, 
+    const char *data, const struct timespec *deadline);
+
+/**
+ * Lit le contenu du morceau d'en-tête header et le stocke, décompressé, dans
+ * dst qui peut contenir header->raw_size octets. Mêmes retours que 
+ * read_full, INVALID_CHUNK si le morceau compressé est invalide.
+ */
+static int read_chunk(session *s, const chunk_header *header, char *dst, 
+    const struct timespec *deadline);
+
+/**
+ * Projette en lecture seule le dernier descripteur reçu sur la session s,
+ * qui doit contenir size octets suivis d'un '\0', puis le ferme.
+ * 
+ * @return {char *} La projection de size + 1 octets ou NULL en cas d'erreur.
+ */
+static char *map_passed_fd(session *s, size_t size);
+
+static session *alloc_session(int transport) {
+  if (transport < 0 || (size_t) transport >= NB_TRANSPORTS) {
+    errno = EINVAL;
+    return NULL;
+  }
+  session *s = malloc(sizeof *s);
+  if (s == NULL) {
+    return NULL;
+  }
+  s->transport = transport;
+  s->ops = &TRANSPORTS[transport];
+  s->request_fd = -1;
+  s->response_fd = -1;
+  s->listen_fd = -1;
+  s->passed_fd = -1;
+  s->request_max = DEFAULT_REQUEST_MAX;
+  s->request_buffer = NULL;
+  s->request_capacity = 0;
+  s->request_delay = 0;
+  s->request_deadline = 0;
+  s->views = NULL;
+  s->ring_view = NULL;
+  s->ring_view_size = 0;
+  s->shm = NULL;
+  s->shm_size = 0;
+  s->ring_size = 0;
+  s->peer = 0;
+  s->peer_uid = 0;
+  s->peer_known = 0;
+  s->peer_capabilities = 0;
+  s->compression_threshold = -1;
+  s->shm_name[0] = '\0';
+  s->socket_path[0] = '\0';
+
+  return s;
+}
+
+session *accept_session(const shm_request *shm_req, time_t timeout) {
+  if (shm_req == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  session *s = alloc_session(shm_req->transport);
+  if (s == NULL) {
+    return NULL;
+  }
+  s->peer_capabilities = shm_req->capabilities;
+  if (shm_req->transport == TRANSPORT_SHM_RING) {
+    // Projette le segment créé par le client
+    int shm_fd = shm_open(shm_req->session_shm, O_RDWR, S_IRUSR | S_IWUSR);
+    if (shm_fd < 0) {
+      free(s);
+      return NULL;
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) < 0) {
+      close(shm_fd);
+      free(s);
+      return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(session_shm)) {
+      close(shm_fd);
+      free(s);
+      errno = EINVAL;
+      return NULL;
+    }
+    s->shm_size = (size_t) st.st_size;
+    s->shm = mmap(NULL, s->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
+        shm_fd, 0);
+    close(shm_fd);
+    if (s->shm == MAP_FAILED) {
+      free(s);
+      return NULL;
+    }
+    // Refuse un segment dont les anneaux dépasseraient la projection
+    size_t ring_size = s->shm->ring_size;
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0
+        || ring_size > (s->shm_size - sizeof(session_shm)) / 2) {
+      munmap(s->shm, s->shm_size);
+      free(s);
+      errno = EINVAL;
+      return NULL;
+    }
+    s->ring_size = ring_size;
+    s->peer = shm_req->pid;
+
+    return s;
+  }
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  if (shm_req->transport == TRANSPORT_SOCKET) {
+    // Le client écoute déjà : la connexion n'attend que si sa file est 
+    // pleine
+    if ((s->request_fd = connect_socket(shm_req->socket_path, &deadline)) 
+        < 0) {
+      free(s);
+      return NULL;
+    }
+    s->response_fd = s->request_fd;
+    if (socket_endpoint_peer(s->request_fd, &s->peer, &s->peer_uid) < 0) {
+      close(s->request_fd);
+      free(s);
+      return NULL;
+    }
+    s->peer_known = 1;
+
+    return s;
+  }
+  // Ouvre le tube de requête sans attendre l'écrivain : la lecture attendra
+  // les données avec poll.
+  if ((s->request_fd = open(shm_req->request_pipe, 
+      O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+    free(s);
+    return NULL;
+  }
+  // Le client ouvre son tube de réponse avant le tube de requête
+  if ((s->response_fd = open_fifo_writer(shm_req->response_pipe, 
+      &deadline)) < 0) {
+    close(s->request_fd);
+    free(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+int session_export(const session *s, int fds[2]) {
+  if (s == NULL || fds == NULL) {
+    return INVALID_POINTER;
+  }
+  fds[0] = s->request_fd;
+  fds[1] = s->transport == TRANSPORT_FIFO ? s->response_fd : -1;
+  for (size_t i = 0; i < 2; ++i) {
+    if (fds[i] >= 0 && fcntl(fds[i], F_SETFD, 0) < 0) {
+      return PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+session *resume_session(const shm_request *shm_req, const int fds[2]) {
+  if (shm_req == NULL || fds == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  // Le segment des anneaux est projeté de nouveau
+  if (shm_req->transport == TRANSPORT_SHM_RING) {
+    return accept_session(shm_req, 0);
+  }
+  session *s = alloc_session(shm_req->transport);
+  if (s == NULL) {
+    return NULL;
+  }
+  s->peer_capabilities = shm_req->capabilities;
+  s->request_fd = fds[0];
+  s->response_fd = shm_req->transport == TRANSPORT_FIFO ? fds[1] : fds[0];
+  // Les descripteurs ne doivent pas survivre à un nouvel exec
+  if (fcntl(s->request_fd, F_SETFD, FD_CLOEXEC) < 0 
+      || fcntl(s->response_fd, F_SETFD, FD_CLOEXEC) < 0) {
+    free(s);
+    return NULL;
+  }
+  if (shm_req->transport == TRANSPORT_SOCKET) {
+    if (socket_endpoint_peer(s->request_fd, &s->peer, &s->peer_uid) < 0) {
+      free(s);
+      return NULL;
+    }
+    s->peer_known = 1;
+  }
+
+  return s;
+}
+
+session *open_session(const request_fifo *req_fifo, 
+    const response_fifo *res_fifo, time_t timeout) {
+  if (req_fifo == NULL || res_fifo == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  session *s = alloc_session(TRANSPORT_FIFO);
+  if (s == NULL) {
+    return NULL;
+  }
+  if ((s->response_fd = open(res_fifo->id, 
+      O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+    free(s);
+    return NULL;
+  }
+  // Attend que le serveur ait ouvert le tube de requête
+  struct timespec deadline;
+  if ((s->request_fd = open_fifo_writer(req_fifo->id, 
+      deadline_after(timeout, &deadline))) < 0) {
+    close(s->response_fd);
+    free(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+session *create_ring_session(const char *name, size_t ring_size) {
+  if (name == NULL || ring_size == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  // Arrondit la capacité à une puissance de 2 pour masquer les positions
+  size_t capacity = 1;
+  while (capacity < ring_size) {
+    capacity <<= 1;
+  }
+  session *s = alloc_session(TRANSPORT_SHM_RING);
+  if (s == NULL) {
+    return NULL;
+  }
+  int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (shm_fd < 0) {
+    free(s);
+    return NULL;
+  }
+  s->shm_size = sizeof(session_shm) + 2 * capacity;
+  if (ftruncate(shm_fd, (off_t) s->shm_size) < 0) {
+    goto err;
+  }
+  s->shm = mmap(NULL, s->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
+      shm_fd, 0);
+  if (s->shm == MAP_FAILED) {
+    goto err;
+  }
+  close(shm_fd);
+  // Le segment est rempli de zéros par ftruncate
+  atomic_init(&s->shm->closed, 0);
+  s->shm->ring_size = capacity;
+  s->ring_size = capacity;
+  for (size_t i = 0; i < 2; ++i) {
+    atomic_init(&s->shm->rings[i].head, 0);
+    atomic_init(&s->shm->rings[i].data_seq, 0);
+    atomic_init(&s->shm->rings[i].data_waiter, 0);
+    atomic_init(&s->shm->rings[i].tail, 0);
+    atomic_init(&s->shm->rings[i].space_seq, 0);
+    atomic_init(&s->shm->rings[i].space_waiter, 0);
+  }
+  strncpy(s->shm_name, name, NAME_MAX);
+  s->shm_name[NAME_MAX] = '\0';
+
+  return s;
+
+err:
+  close(shm_fd);
+  shm_unlink(name);
+  free(s);
+
+  return NULL;
+}
+
+session *create_socket_session(const char *path) {
+  if (path == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  session *s = alloc_session(TRANSPORT_SOCKET);
+  if (s == NULL) {
+    return NULL;
+  }
+  if ((s->listen_fd = socket_endpoint_listen(path)) < 0) {
+    free(s);
+    return NULL;
+  }
+  strncpy(s->socket_path, path, NAME_MAX);
+  s->socket_path[NAME_MAX] = '\0';
+
+  return s;
+}
+
+int session_peer_credentials(const session *s, pid_t *pid, uid_t *uid) {
+  if (s == NULL || pid == NULL || uid == NULL) {
+    return INVALID_POINTER;
+  }
+  if (!s->peer_known) {
+    return 0;
+  }
+  *pid = s->peer;
+  *uid = s->peer_uid;
+
+  return 1;
+}
+
+int session_forward_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *forwarded, time_t timeout) {
+  if (s == NULL || forwarded == NULL) {
+    return INVALID_POINTER;
+  }
+  *forwarded = 0;
+  // Attend des données ou la fermeture du tube
+  int available = 0;
+  while (available == 0) {
+    int events = wait_fd(fd, POLLIN, NULL);
+    if (events < 0 || ioctl(fd, FIONREAD, &available) < 0) {
+      return PIPE_ERROR;
+    }
+    if (available == 0 && (events & (POLLHUP | POLLERR | POLLNVAL))) {
+      return events & POLLHUP ? 1 : PIPE_ERROR;
+    }
+  }
+  size_t n = MIN((size_t) available, limit);
+  if (s->ops->splice == NULL || (s->compression_threshold >= 0 
+      && n >= (size_t) s->compression_threshold)) {
+    // Le morceau doit passer par l'appelant
+    char buffer[SPOOL_BUFFER_SIZE];
+    ssize_t k;
+    while ((k = read(fd, buffer, MIN(n, SPOOL_BUFFER_SIZE))) < 0) {
+      if (errno != EINTR) {
+        return PIPE_ERROR;
+      }
+    }
+    int r = session_send_chunk(s, id, buffer, (size_t) k, timeout);
+    if (r > 0) {
+      *forwarded = (size_t) k;
+    }
+    return r;
+  }
+  // Seul l'appelant lit le tube : les n octets disponibles le resteront 
+  // jusqu'au splice
+  chunk_header header = { .id = id, .size = n, .raw_size = n, .flags = 0 };
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  int r = session_write(s, RESPONSE_RING, &header, sizeof(chunk_header), 
+      &deadline);
+  if (r > 0 && (r = s->ops->splice(s, RESPONSE_RING, fd, n, &deadline)) > 0) {
+    *forwarded = n;
+  }
+
+  return r;
+}
+
+int session_can_send_fd(const session *s) {
+  return s != NULL && s->ops->write_fd != NULL 
+      && (s->peer_capabilities & CAPABILITY_FD_PASSING) != 0;
+}
+
+int session_spool_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *spooled, const struct timespec *deadline, time_t timeout) {
+  if (s == NULL || spooled == NULL) {
+    return INVALID_POINTER;
+  }
+  *spooled = 0;
+  if (!session_can_send_fd(s)) {
+    errno = ENOTSUP;
+    return PIPE_ERROR;
+  }
+  int memfd = (int) syscall(SYS_memfd_create, "response", MFD_CLOEXEC);
+  if (memfd < 0) {
+    return MEMORY_ERROR;
+  }
+  char buffer[SPOOL_BUFFER_SIZE];
+  size_t total = 0;
+  while (total < limit) {
+    // Une fois des octets recopiés, une commande qui se tait un instant 
+    // reçoit sa réponse sans attendre la suite
+    const struct timespec *until = deadline;
+    struct timespec idle;
+    if (total > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &idle);
+      idle.tv_nsec += SPOOL_IDLE_MS * 1000000L;
+      if (idle.tv_nsec >= 1000000000L) {
+        ++idle.tv_sec;
+        idle.tv_nsec -= 1000000000L;
+      }
+      if (deadline == NULL || idle.tv_sec < deadline->tv_sec 
+          || (idle.tv_sec == deadline->tv_sec 
+          && idle.tv_nsec < deadline->tv_nsec)) {
+        until = &idle;
+      }
+    }
+    int ready = wait_fd(fd, POLLIN, until);
+    if (ready < 0) {
+      close(memfd);
+      return PIPE_ERROR;
+    } else if (ready == 0) {
+      if (until == &idle) {
+        break;
+      }
+      close(memfd);
+      errno = ETIMEDOUT;
+      return REQUEST_EXPIRED;
+    }
+    size_t k = limit - total;
+    ssize_t n = read(fd, buffer, MIN(k, SPOOL_BUFFER_SIZE));
+    if (n == 0) {
+      break;
+    } else if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(memfd);
+      return PIPE_ERROR;
+    }
+    if (write_full(memfd, buffer, (size_t) n, NULL) <= 0) {
+      close(memfd);
+      return MEMORY_ERROR;
+    }
+    total += (size_t) n;
+  }
+  // Le '\0' final permet au client de projeter un morceau déjà terminé
+  if (total == 0 || ftruncate(memfd, (off_t) total + 1) < 0) {
+    close(memfd);
+    return total == 0 ? 1 : MEMORY_ERROR;
+  }
+  chunk_header header = { 
+    .id = id, 
+    .size = 0, 
+    .raw_size = total, 
+    .flags = CHUNK_FD 
+  };
+  struct timespec send_deadline;
+  int r = s->ops->write_fd(s, RESPONSE_RING, &header, sizeof(chunk_header), 
+      memfd, deadline_after(timeout, &send_deadline));
+  close(memfd);
+  if (r > 0) {
+    *spooled = total;
+  }
+
+  return r;
+}
+
+int session_enable_compression(session *s, size_t threshold) {
+  if (s == NULL) {
+    return INVALID_POINTER;
+  }
+  if ((s->peer_capabilities & CAPABILITY_COMPRESSION) == 0) {
+    return 0;
+  }
+  s->compression_threshold = (ssize_t) MIN(threshold, (size_t) SSIZE_MAX);
+
+  return 1;
+}
+
+int session_request_fd(const session *s) {
+  if (s == NULL) {
+    return -1;
+  }
+
+  return s->ops->request_fd(s);
+}
+
+int session_wait_request(session *s, int wake_fd) {
+  if (s == NULL) {
+    return INVALID_POINTER;
+  }
+  int fd = s->ops->request_fd(s);
+  if (fd < 0) {
+    return ring_wait_request(s, wake_fd);
+  }
+  // poll ignore les descripteurs négatifs
+  struct pollfd fds[2] = {
+    { .fd = fd, .events = POLLIN },
+    { .fd = wake_fd, .events = POLLIN }
+  };
+  while (1) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return PIPE_ERROR;
+    }
+    if (fds[1].revents & POLLIN) {
+      return 0;
+    }
+    // Une fermeture ou une erreur sera constatée par session_listen_request
+    if (fds[0].revents != 0) {
+      return 1;
+    }
+  }
+}
+
+int session_response_fd(const session *s) {
+  if (s == NULL) {
+    return -1;
+  }
+
+  return s->response_fd;
+}
+
+size_t session_pipeline_depth(const session *s) {
+  if (s == NULL) {
+    return 1;
+  }
+
+  return MAX(s->ops->pipeline_depth(s), 1);
+}
+
+void session_set_request_max(session *s, size_t max) {
+  if (s != NULL) {
+    s->request_max = MIN(MAX(max, MAX_COMMAND_LENGTH), REQUEST_MAX_LIMIT);
+  }
+}
+
+void session_set_request_deadline(session *s, time_t delay) {
+  if (s != NULL) {
+    s->request_delay = MAX(delay, 0);
+  }
+}
+
+int session_request_deadline(const session *s, struct timespec *deadline) {
+  if (s == NULL || deadline == NULL || s->request_deadline == 0) {
+    return 0;
+  }
+  deadline->tv_sec = (time_t) (s->request_deadline / 1000000000ULL);
+  deadline->tv_nsec = (long) (s->request_deadline % 1000000000ULL);
+
+  return 1;
+}
+
+int session_send_request(session *s, unsigned int id, const char *cmd, 
+    time_t timeout) {
+  if (s == NULL || cmd == NULL) {
+    return INVALID_POINTER;
+  }
+  size_t length = strlen(cmd);
+  if (length > s->request_max) {
+    errno = EMSGSIZE;
+    return INVALID_REQUEST;
+  }
+  request_header header = {
+    .version = REQUEST_VERSION,
+    .type = REQUEST_COMMAND,
+    .flags = 0,
+    .id = id,
+    .length = (unsigned int) length,
+    .deadline = 0
+  };
+  struct timespec deadline;
+  if (s->request_delay > 0) {
+    deadline_after(s->request_delay, &deadline);
+    header.deadline = (unsigned long long) deadline.tv_sec * 1000000000ULL 
+        + (unsigned long long) deadline.tv_nsec;
+  }
+  deadline_after(timeout, &deadline);
+  int r = session_write(s, REQUEST_RING, &header, sizeof(request_header), 
+      &deadline);
+  if (r <= 0 || length == 0) {
+    return r;
+  }
+
+  return session_write(s, REQUEST_RING, cmd, length, &deadline);
+}
+
+int session_listen_request(session *s, unsigned int *id, char **cmd, 
+    time_t timeout) {
+  if (s == NULL || id == NULL || cmd == NULL) {
+    return INVALID_POINTER;
+  }
+  request_header header;
+  int r = session_read(s, REQUEST_RING, &header, sizeof(request_header), 
+      NULL);
+  if (r == PIPE_CLOSED) {
+    return 0;
+  } else if (r < 0) {
+    return r;
+  }
+  *id = header.id;
+  s->request_deadline = header.deadline;
+  // L'en-tête reçu, le reste de la trame doit suivre dans le délai
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  if (header.version != REQUEST_VERSION || header.type != REQUEST_COMMAND 
+      || header.length > s->request_max) {
+    if (header.length / DISCARD_MAX_FACTOR > s->request_max) {
+      errno = EMSGSIZE;
+      return PIPE_ERROR;
+    }
+    // La longueur reste fiable : la requête est ignorée sans perdre la 
+    // trame suivante
+    char discard[SPOOL_BUFFER_SIZE];
+    size_t left = header.length;
+    while (left > 0) {
+      size_t k = MIN(left, SPOOL_BUFFER_SIZE);
+      if ((r = session_read(s, REQUEST_RING, discard, k, &deadline)) <= 0) {
+        return r == PIPE_CLOSED ? 0 : r;
+      }
+      left -= k;
+    }
+    errno = header.length > s->request_max ? EMSGSIZE : EPROTO;
+    return INVALID_REQUEST;
+  }
+  size_t needed = (size_t) header.length + 1;
+  if (needed > s->request_capacity) {
+    char *p = realloc(s->request_buffer, needed);
+    if (p == NULL) {
+      return MEMORY_ERROR;
+    }
+    s->request_buffer = p;
+    s->request_capacity = needed;
+  }
+  if (header.length > 0) {
+    r = session_read(s, REQUEST_RING, s->request_buffer, header.length, 
+        &deadline);
+    if (r == PIPE_CLOSED) {
+      return 0;
+    } else if (r <= 0) {
+      return r;
+    }
+  }
+  s->request_buffer[header.length] = '\0';
+  *cmd = s->request_buffer;
+
+  return 1;
+}
+
+int session_send_chunk(session *s, unsigned int id, const char *data, 
+    size_t n, time_t timeout) {
+  if (s == NULL || data == NULL) {
+    return INVALID_POINTER;
+  }
+  // Un morceau vide termine la réponse
+  if (n == 0) {
+    return 1;
+  }
+  // Une même échéance couvre tous les morceaux envoyés
+  struct timespec deadline;
+  deadline_after(timeout, &deadline);
+  if (s->compression_threshold < 0 
+      || n < (size_t) s->compression_threshold) {
+    chunk_header header = { .id = id, .size = n, .raw_size = n, .flags = 0 };
+    return send_chunk(s, &header, data, &deadline);
+  }
+  // Découpe le morceau en blocs compressés indépendamment, que le client 
+  // reçoit comme autant de morceaux
+  size_t block_bound = lz_compress_bound(MIN(n, COMPRESSION_BLOCK_SIZE));
+  char *packed = malloc(block_bound);
+  if (packed == NULL) {
+    return MEMORY_ERROR;
+  }
+  int r = 1;
+  for (size_t offset = 0; offset < n && r > 0; 
+      offset += COMPRESSION_BLOCK_SIZE) {
+    const char *block = data + offset;
+    size_t block_size = MIN(n - offset, COMPRESSION_BLOCK_SIZE);
+    ssize_t packed_size = lz_compress(block, block_size, packed, 
+        block_bound);
+    // Un bloc incompressible est envoyé tel quel
+    if (packed_size < 0 || (size_t) packed_size >= block_size) {
+      chunk_header header = { 
+        .id = id,
+        .size = block_size, 
+        .raw_size = block_size, 
+        .flags = 0 
+      };
+      r = send_chunk(s, &header, block, &deadline);
+    } else {
+      chunk_header header = { 
+        .id = id,
+        .size = (size_t) packed_size, 
+        .raw_size = block_size, 
+        .flags = CHUNK_COMPRESSED 
+      };
+      r = send_chunk(s, &header, packed, &deadline);
+    }
+  }
+  free(packed);
+
+  return r;
+}
+
+int session_end_response(session *s, unsigned int id, time_t timeout) {
+  if (s == NULL) {
+    return INVALID_POINTER;
+  }
+  chunk_header header = { .id = id, .size = 0, .raw_size = 0, .flags = 0 };
+  struct timespec deadline;
+
+  return session_write(s, RESPONSE_RING, &header, sizeof(chunk_header), 
+      deadline_after(timeout, &deadline));
+}
+
+int session_send_response(session *s, unsigned int id, const char *msg, 
+    ssize_t max_size, time_t timeout) {
+  if (s == NULL || msg == NULL) {
+    return INVALID_POINTER;
+  }
+  size_t size = strlen(msg);
+  if (max_size >= 0) {
+    size = MIN(size, (size_t) max_size);
+  }
+  int r = session_send_chunk(s, id, msg, size, timeout);
+  if (r <= 0) {
+    return r;
+  }
+
+  return session_end_response(s, id, timeout);
+}
+
+int session_listen_chunk(session *s, unsigned int *id, char **buffer, 
+    size_t *size, time_t timeout) {
+  if (s == NULL || id == NULL || buffer == NULL || size == NULL) {
+    return INVALID_POINTER;
+  }
+  // Une vue de l'anneau n'est valable que jusqu'à l'écoute suivante
+  if (s->ring_view != NULL) {
+    ring_release(s);
+  }
+  chunk_header header;
+  struct timespec deadline;
+  int r = session_read(s, RESPONSE_RING, &header, sizeof(chunk_header), 
+      deadline_after(timeout, &deadline));
+  if (r <= 0) {
+    return r;
+  }
+  *id = header.id;
+  *size = header.raw_size;
+  if (IS_LAST_CHUNK(header)) {
+    *size = 0;
+    *buffer = NULL;
+    return 1;
+  }
+  if (header.flags & CHUNK_FD) {
+    // Le morceau est lu directement dans le fichier du serveur
+    chunk_view *view = malloc(sizeof *view);
+    if (view == NULL) {
+      return MEMORY_ERROR;
+    }
+    if ((view->data = map_passed_fd(s, header.raw_size)) == NULL) {
+      free(view);
+      return INVALID_CHUNK;
+    }
+    view->size = header.raw_size + 1;
+    view->next = s->views;
+    s->views = view;
+    *buffer = view->data;
+    return 1;
+  }
+  if (s->transport == TRANSPORT_SHM_RING && header.flags == 0 
+      && header.size == header.raw_size) {
+    // Un morceau contigu est lu directement dans l'anneau
+    if ((r = ring_peek(s, header.size, &deadline, buffer)) <= 0 
+        || *buffer != NULL) {
+      return r;
+    }
+  }
+  char *msg = malloc(header.raw_size + 1);
+  if (msg == NULL) {
+    return MEMORY_ERROR;
+  }
+  if ((r = read_chunk(s, &header, msg, &deadline)) <= 0) {
+    free(msg);
+    return r;
+  }
+  msg[header.raw_size] = '\0';
+  *buffer = msg;
+
+  return 1;
+}
+
+int session_listen_response(session *s, unsigned int *id, char **buffer, 
+    time_t timeout) {
+  if (s == NULL || buffer == NULL) {
+    return INVALID_POINTER;
+  }
+  if (s->ring_view != NULL) {
+    ring_release(s);
+  }
+  // Concatène les morceaux jusqu'au morceau vide
+  char *msg = NULL;
+  size_t total = 0;
+  int first = 1;
+  while (1) {
+    chunk_header header;
+    struct timespec deadline;
+    int r = session_read(s, RESPONSE_RING, &header, sizeof(chunk_header), 
+        deadline_after(timeout, &deadline));
+    if (r <= 0) {
+      free(msg);
+      return r;
+    }
+    // Les morceaux d'une réponse ne sont jamais entrelacés avec ceux d'une
+    // autre
+    if (first) {
+      if (id != NULL) {
+        *id = header.id;
+      }
+      first = 0;
+    } else if (id != NULL && header.id != *id) {
+      free(msg);
+      return INVALID_CHUNK;
+    }
+    if (IS_LAST_CHUNK(header)) {
+      break;
+    }
+    char *p = realloc(msg, total + header.raw_size + 1);
+    if (p == NULL) {
+      free(msg);
+      return MEMORY_ERROR;
+    }
+    msg = p;
+    if ((r = read_chunk(s, &header, msg + total, &deadline)) <= 0) {
+      free(msg);
+      return r;
+    }
+    total += header.raw_size;
+  }
+  if (msg == NULL && (msg = malloc(1)) == NULL) {
+    return MEMORY_ERROR;
+  }
+  msg[total] = '\0';
+  *buffer = msg;
+
+  return 1;
+}
+
+void session_free_chunk(session *s, char *buffer) {
+  if (s != NULL && buffer != NULL && buffer == s->ring_view) {
+    ring_release(s);
+    return;
+  }
+  if (s != NULL) {
+    for (chunk_view **p = &s->views; *p != NULL; p = &(*p)->next) {
+      if ((*p)->data == buffer) {
+        chunk_view *view = *p;
+        *p = view->next;
+        munmap(view->data, view->size);
+        free(view);
+        return;
+      }
+    }
+  }
+  free(buffer);
+}
+
+int close_session(session *s) {
+  if (s == NULL) {
+    return INVALID_POINTER;
+  }
+  while (s->views != NULL) {
+    session_free_chunk(s, s->views->data);
+  }
+  if (s->passed_fd >= 0) {
+    close(s->passed_fd);
+  }
+  free(s->request_buffer);
+  int r = s->ops->close(s);
+  free(s);
+
+  return r;
+}
+
+static int session_read(session *s, int ring, void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  return s->ops->read(s, ring, buffer, n, deadline);
+}
+
+static int session_write(session *s, int ring, const void *buffer, size_t n,
+    const struct timespec *deadline) {
+  return s->ops->write(s, ring, buffer, n, deadline);
+}
+
+static int fifo_read(session *s, int channel, void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  return read_full(channel == REQUEST_RING ? s->request_fd : s->response_fd, 
+      buffer, n, deadline);
+}
+
+static int fifo_write(session *s, int channel, const void *buffer, size_t n,
+    const struct timespec *deadline) {
+  return write_full(channel == REQUEST_RING ? s->request_fd : s->response_fd,
+      buffer, n, deadline);
+}
+
+static int fifo_splice(session *s, int channel, int fd, size_t n, 
+    const struct timespec *deadline) {
+  int out = channel == REQUEST_RING ? s->request_fd : s->response_fd;
+  size_t total = 0;
+  while (total < n) {
+    ssize_t k = splice(fd, NULL, out, NULL, n - total, 
+        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (k > 0) {
+      total += (size_t) k;
+    } else if (k == 0) {
+      // Le tube source a été vidé par un autre lecteur
+      errno = EPIPE;
+      return PIPE_ERROR;
+    } else if (errno == EAGAIN) {
+      int r = wait_fd(out, POLLOUT, deadline);
+      if (r <= 0) {
+        return r < 0 ? PIPE_ERROR : 0;
+      }
+    } else if (errno != EINTR) {
+      return PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+static int fifo_request_fd(const session *s) {
+  return s->request_fd;
+}
+
+static size_t fifo_pipeline_depth(const session *s) {
+  (void) s;
+  // Capacité garantie d'un tube
+  return PIPE_BUF / REQUEST_NOMINAL_SIZE;
+}
+
+static int fifo_close(session *s) {
+  int r = 1;
+  if (close(s->request_fd) < 0) {
+    r = PIPE_ERROR;
+  }
+  if (close(s->response_fd) < 0) {
+    r = PIPE_ERROR;
+  }
+
+  return r;
+}
+
+static int ring_read(session *s, int ring, void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  spsc_ring *r = &s->shm->rings[ring];
+  size_t capacity = s->ring_size;
+  const char *data = s->shm->data + (size_t) ring * capacity;
+  size_t total = 0;
+  while (total < n) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head - tail > capacity) {
+      // Positions corrompues par le pair : la session est abandonnée plutôt
+      // que de lire hors de l'anneau
+      atomic_store(&s->shm->closed, 1);
+      return PIPE_ERROR;
+    }
+    if (head == tail) {
+      // S'annonce endormi puis revérifie afin de ne pas manquer un réveil
+      unsigned int seq = atomic_load(&r->data_seq);
+      atomic_store(&r->data_waiter, 1);
+      if (atomic_load(&r->head) != tail) {
+        continue;
+      }
+      if (atomic_load(&s->shm->closed)) {
+        return PIPE_CLOSED;
+      }
+      int w = ring_wait(s, &r->data_seq, seq, deadline);
+      if (w <= 0) {
+        return w;
+      }
+      continue;
+    }
+    // Copie les octets disponibles en deux fois si l'anneau boucle
+    size_t k = MIN(head - tail, n - total);
+    size_t pos = tail & (capacity - 1);
+    size_t first = MIN(k, capacity - pos);
+    memcpy((char *) buffer + total, data + pos, first);
+    memcpy((char *) buffer + total + first, data, k - first);
+    ring_consume(r, tail, k);
+    total += k;
+  }
+
+  return 1;
+}
+
+static int ring_peek(session *s, size_t n, const struct timespec *deadline,
+    char **view) {
+  spsc_ring *r = &s->shm->rings[RESPONSE_RING];
+  size_t capacity = s->ring_size;
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  size_t pos = tail & (capacity - 1);
+  *view = NULL;
+  if (n > capacity - pos) {
+    return 1;
+  }
+  while (1) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head - tail > capacity) {
+      atomic_store(&s->shm->closed, 1);
+      return PIPE_ERROR;
+    }
+    if (head - tail >= n) {
+      break;
+    }
+    // Le producteur dispose toujours de la place pour terminer le morceau
+    unsigned int seq = atomic_load(&r->data_seq);
+    atomic_store(&r->data_waiter, 1);
+    if (atomic_load(&r->head) != head) {
+      continue;
+    }
+    if (atomic_load(&s->shm->closed)) {
+      return PIPE_CLOSED;
+    }
+    int w = ring_wait(s, &r->data_seq, seq, deadline);
+    if (w <= 0) {
+      return w;
+    }
+  }
+  *view = s->shm->data + (size_t) RESPONSE_RING * capacity + pos;
+  s->ring_view = *view;
+  s->ring_view_size = n;
+
+  return 1;
+}
+
+static void ring_release(session *s) {
+  spsc_ring *r = &s->shm->rings[RESPONSE_RING];
+  ring_consume(r, atomic_load_explicit(&r->tail, memory_order_relaxed), 
+      s->ring_view_size);
+  s->ring_view = NULL;
+  s->ring_view_size = 0;
+}
+
+static void ring_consume(spsc_ring *r, size_t tail, size_t k) {
+  atomic_store_explicit(&r->tail, tail + k, memory_order_release);
+  atomic_fetch_add(&r->space_seq, 1);
+  if (atomic_exchange(&r->space_waiter, 0)) {
+    ring_wake(&r->space_seq);
+  }
+}
+
+static int ring_write(session *s, int ring, const void *buffer, size_t n,
+    const struct timespec *deadline) {
+  spsc_ring *r = &s->shm->rings[ring];
+  size_t capacity = s->ring_size;
+  char *data = s->shm->data + (size_t) ring * capacity;
+  size_t total = 0;
+  while (total < n) {
+    if (atomic_load(&s->shm->closed)) {
+      return PIPE_ERROR;
+    }
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail > capacity) {
+      // Positions corrompues par le pair : la session est abandonnée plutôt
+      // que d'écrire hors de l'anneau
+      atomic_store(&s->shm->closed, 1);
+      return PIPE_ERROR;
+    }
+    if (head - tail == capacity) {
+      unsigned int seq = atomic_load(&r->space_seq);
+      atomic_store(&r->space_waiter, 1);
+      if (atomic_load(&r->tail) != tail) {
+        continue;
+      }
+      int w = ring_wait(s, &r->space_seq, seq, deadline);
+      if (w <= 0) {
+        return w == PIPE_CLOSED ? PIPE_ERROR : w;
+      }
+      continue;
+    }
+    size_t k = MIN(capacity - (head - tail), n - total);
+    size_t pos = head & (capacity - 1);
+    size_t first = MIN(k, capacity - pos);
+    memcpy(data + pos, (const char *) buffer + total, first);
+    memcpy(data, (const char *) buffer + total + first, k - first);
+    atomic_store_explicit(&r->head, head + k, memory_order_release);
+    total += k;
+    atomic_fetch_add(&r->data_seq, 1);
+    if (atomic_exchange(&r->data_waiter, 0)) {
+      ring_wake(&r->data_seq);
+    }
+  }
+
+  return 1;
+}
+
+static int ring_request_fd(const session *s) {
+  (void) s;
+  return -1;
+}
+
+static size_t ring_pipeline_depth(const session *s) {
+  return s->ring_size / REQUEST_NOMINAL_SIZE;
+}
+
+static int ring_wait_request(session *s, int wake_fd) {
+  spsc_ring *r = &s->shm->rings[REQUEST_RING];
+  struct pollfd wake = { .fd = wake_fd, .events = POLLIN };
+  while (1) {
+    if (wake_fd >= 0 && poll(&wake, 1, 0) > 0 && (wake.revents & POLLIN)) {
+      return 0;
+    }
+    size_t tail = atomic_load(&r->tail);
+    unsigned int seq = atomic_load(&r->data_seq);
+    atomic_store(&r->data_waiter, 1);
+    if (atomic_load(&r->head) != tail || atomic_load(&s->shm->closed)) {
+      return 1;
+    }
+    int w = ring_wait(s, &r->data_seq, seq, NULL);
+    if (w < 0) {
+      return w == PIPE_CLOSED ? 1 : w;
+    }
+  }
+}
+
+static int ring_close(session *s) {
+  int r = 1;
+  // Prévient le pair puis le réveille s'il attend sur l'un des anneaux
+  atomic_store(&s->shm->closed, 1);
+  for (size_t i = 0; i < 2; ++i) {
+    atomic_fetch_add(&s->shm->rings[i].data_seq, 1);
+    ring_wake(&s->shm->rings[i].data_seq);
+    atomic_fetch_add(&s->shm->rings[i].space_seq, 1);
+    ring_wake(&s->shm->rings[i].space_seq);
+  }
+  if (munmap(s->shm, s->shm_size) < 0) {
+    r = SHM_ERROR;
+  }
+  if (s->shm_name[0] != '\0' && shm_unlink(s->shm_name) < 0) {
+    r = SHM_ERROR;
+  }
+
+  return r;
+}
+
+static int socket_read(session *s, int channel, void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  (void) channel;
+  if (s->request_fd < 0) {
+    int r = socket_accept_peer(s, deadline);
+    if (r <= 0) {
+      return r;
+    }
+  }
+  // Chaque message est lu d'un coup : il doit avoir exactement la taille du
+  // segment attendu, découpé comme à l'écriture.
+  size_t total = 0;
+  while (total < n) {
+    size_t k = MIN(n - total, SOCKET_MESSAGE_MAX);
+    int fd;
+    ssize_t m = socket_endpoint_recv(s->request_fd, (char *) buffer + total, 
+        k, &fd);
+    if (fd >= 0) {
+      // Seul le dernier descripteur reçu peut être réclamé
+      if (s->passed_fd >= 0) {
+        close(s->passed_fd);
+      }
+      s->passed_fd = fd;
+    }
+    if (m == 0) {
+      return PIPE_CLOSED;
+    } else if (m > 0) {
+      if ((size_t) m != k) {
+        errno = EPROTO;
+        return PIPE_ERROR;
+      }
+      total += k;
+    } else if (errno == EAGAIN) {
+      int r = wait_fd(s->request_fd, POLLIN, deadline);
+      if (r <= 0) {
+        return r < 0 ? PIPE_ERROR : 0;
+      }
+    } else if (errno != EINTR) {
+      return errno == ECONNRESET ? PIPE_CLOSED : PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+static int socket_write(session *s, int channel, const void *buffer, 
+    size_t n, const struct timespec *deadline) {
+  return socket_write_fd(s, channel, buffer, n, -1, deadline);
+}
+
+static int socket_write_fd(session *s, int channel, const void *buffer, 
+    size_t n, int fd, const struct timespec *deadline) {
+  (void) channel;
+  if (s->request_fd < 0) {
+    int r = socket_accept_peer(s, deadline);
+    if (r <= 0) {
+      return r == PIPE_CLOSED ? PIPE_ERROR : r;
+    }
+  }
+  // Un message est envoyé en entier ou pas du tout. Le descripteur est joint
+  // au premier.
+  size_t total = 0;
+  while (total < n) {
+    size_t k = MIN(n - total, SOCKET_MESSAGE_MAX);
+    ssize_t m = socket_endpoint_send(s->request_fd, 
+        (const char *) buffer + total, k, total == 0 ? fd : -1);
+    if (m >= 0) {
+      total += (size_t) m;
+    } else if (errno == EAGAIN) {
+      int r = wait_fd(s->request_fd, POLLOUT, deadline);
+      if (r <= 0) {
+        return r < 0 ? PIPE_ERROR : 0;
+      }
+    } else if (errno != EINTR) {
+      return PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+static int socket_request_fd(const session *s) {
+  return s->request_fd;
+}
+
+static size_t socket_pipeline_depth(const session *s) {
+  int size = s->request_fd < 0 ? -1 
+      : socket_endpoint_send_buffer(s->request_fd);
+  // Sans connexion, se limite à la capacité garantie d'un tube
+  if (size <= 0) {
+    return PIPE_BUF / REQUEST_NOMINAL_SIZE;
+  }
+
+  return (size_t) size / SOCKET_MESSAGE_COST;
+}
+
+static int socket_close(session *s) {
+  int r = 1;
+  if (s->request_fd >= 0 && close(s->request_fd) < 0) {
+    r = PIPE_ERROR;
+  }
+  if (s->listen_fd >= 0 && close(s->listen_fd) < 0) {
+    r = PIPE_ERROR;
+  }
+  if (s->socket_path[0] != '\0' && unlink(s->socket_path) < 0) {
+    r = PIPE_ERROR;
+  }
+
+  return r;
+}
+
+static int socket_accept_peer(session *s, const struct timespec *deadline) {
+  while ((s->request_fd = socket_endpoint_accept(s->listen_fd)) < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      return PIPE_ERROR;
+    }
+    int r = wait_fd(s->listen_fd, POLLIN, deadline);
+    if (r <= 0) {
+      return r < 0 ? PIPE_ERROR : 0;
+    }
+  }
+  s->response_fd = s->request_fd;
+  // Le socket ne sert plus qu'à cette connexion
+  close(s->listen_fd);
+  s->listen_fd = -1;
+  if (unlink(s->socket_path) < 0) {
+    return PIPE_ERROR;
+  }
+  s->socket_path[0] = '\0';
+
+  return 1;
+}
+
+static int ring_wait(session *s, atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline) {
+  // Découpe l'attente afin de détecter la disparition du pair
+  struct timespec until;
+  deadline_after(RING_LIVENESS_PERIOD, &until);
+  if (deadline != NULL && (deadline->tv_sec < until.tv_sec 
+      || (deadline->tv_sec == until.tv_sec 
+      && deadline->tv_nsec < until.tv_nsec))) {
+    until = *deadline;
+  }
+  if (futex_wait_until(seq, observed, &until) < 0) {
+    return PIPE_ERROR;
+  }
+  if (deadline != NULL && deadline_passed(deadline)) {
+    return 0;
+  }
+  if (s->peer > 0 && kill(s->peer, 0) < 0 && errno == ESRCH) {
+    return PIPE_CLOSED;
+  }
+
+  return 1;
+}
+
+static int send_chunk(session *s, const chunk_header *header, 
+    const char *data, const struct timespec *deadline) {
+  // Sur un anneau, le morceau est copié une seule fois, directement dans le
+  // segment.
+  int r = session_write(s, RESPONSE_RING, header, sizeof(chunk_header), 
+      deadline);
+  if (r <= 0) {
+    return r;
+  }
+
+  return session_write(s, RESPONSE_RING, data, header->size, deadline);
+}
+
+static int read_chunk(session *s, const chunk_header *header, char *dst, 
+    const struct timespec *deadline) {
+  if (header->flags & CHUNK_FD) {
+    char *view = map_passed_fd(s, header->raw_size);
+    if (view == NULL) {
+      return INVALID_CHUNK;
+    }
+    memcpy(dst, view, header->raw_size);
+    munmap(view, header->raw_size + 1);
+    return 1;
+  }
+  if ((header->flags & CHUNK_COMPRESSED) == 0) {
+    if (header->raw_size != header->size) {
+      return INVALID_CHUNK;
+    }
+    return session_read(s, RESPONSE_RING, dst, header->size, deadline);
+  }
+  char *packed = malloc(header->size);
+  if (packed == NULL) {
+    return MEMORY_ERROR;
+  }
+  int r = session_read(s, RESPONSE_RING, packed, header->size, deadline);
+  if (r > 0 && lz_decompress(packed, header->size, dst, header->raw_size) 
+      != (ssize_t) header->raw_size) {
+    r = INVALID_CHUNK;
+  }
+  free(packed);
+
+  return r;
+}
+
+static char *map_passed_fd(session *s, size_t size) {
+  int fd = s->passed_fd;
+  s->passed_fd = -1;
+  if (fd < 0) {
+    return NULL;
+  }
+  // Refuse un fichier plus court qu'annoncé : y accéder lèverait SIGBUS
+  struct stat st;
+  char *view = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size >= 0 
+      && (size_t) st.st_size > size) {
+    view = mmap(NULL, size + 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+      view = NULL;
+    }
+  }
+  close(fd);
+
+  return view;
+}
+
+static void ring_wake(atomic_uint *seq) {
+  futex_wake_all(seq);
+}
+
+/*
+ * Fonctions outils
+ */
+
+static struct timespec *deadline_after(time_t timeout, 
+    struct timespec *deadline) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout;
+
+  return deadline;
+}
+
+static int wait_fd(int fd, short events, const struct timespec *deadline) {
+  struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+  int r;
+  do {
+    int timeout_ms = -1;
+    if (deadline != NULL) {
+      // Convertit l'échéance absolue en durée restante
+      struct timespec now;
+      if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+        return -1;
+      }
+      long long ms = (long long) (deadline->tv_sec - now.tv_sec) * 1000
+          + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+      if (ms <= 0) {
+        return 0;
+      }
+      timeout_ms = ms > INT_MAX ? INT_MAX : (int) ms;
+    }
+    r = poll(&pfd, 1, timeout_ms);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0) {
+    return -1;
+  }
+
+  return r > 0 ? pfd.revents : 0;
+}
+
+static int read_full(int fd, void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  size_t total = 0;
+  while (total < n) {
+    ssize_t k = read(fd, (char *) buffer + total, n - total);
+    if (k > 0) {
+      total += (size_t) k;
+    } else if (k == 0 || errno == EAGAIN) {
+      // read renvoie 0 tant qu'aucun écrivain n'est présent. poll ne signale
+      // POLLHUP que si un écrivain a été ouvert puis fermé.
+      int r = wait_fd(fd, POLLIN, deadline);
+      if (r <= 0) {
+        return r < 0 ? PIPE_ERROR : 0;
+      }
+      if (!(r & POLLIN) && (r & POLLHUP)) {
+        return PIPE_CLOSED;
+      }
+    } else if (errno != EINTR) {
+      return PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+static int write_full(int fd, const void *buffer, size_t n, 
+    const struct timespec *deadline) {
+  size_t total = 0;
+  while (total < n) {
+    ssize_t k = write(fd, (const char *) buffer + total, n - total);
+    if (k >= 0) {
+      total += (size_t) k;
+    } else if (errno == EAGAIN) {
+      int r = wait_fd(fd, POLLOUT, deadline);
+      if (r <= 0) {
+        return r < 0 ? PIPE_ERROR : 0;
+      }
+    } else if (errno != EINTR) {
+      return PIPE_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+static int open_fifo_writer(const char *path, 
+    const struct timespec *deadline) {
+  struct timespec delay = { .tv_sec = 0, .tv_nsec = OPEN_RETRY_DELAY };
+  while (1) {
+    int fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) {
+      return fd;
+    }
+    // ENXIO : personne n'a encore ouvert le tube en lecture
+    if (errno != ENXIO) {
+      return -1;
+    }
+    if (deadline_passed(deadline)) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    nanosleep(&delay, NULL);
+  }
+}
+
+static int connect_socket(const char *path, const struct timespec *deadline) {
+  struct timespec delay = { .tv_sec = 0, .tv_nsec = OPEN_RETRY_DELAY };
+  while (1) {
+    int fd = socket_endpoint_connect(path);
+    if (fd >= 0) {
+      return fd;
+    }
+    // EAGAIN : le client n'a pas encore accepté les connexions précédentes
+    if (errno != EAGAIN) {
+      return -1;
+    }
+    if (deadline_passed(deadline)) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    nanosleep(&delay, NULL);
+  }
+}
+
+static int futex_wait_until(atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline) {
+  // FUTEX_WAIT_BITSET attend une échéance absolue sur CLOCK_MONOTONIC. Le
+  // futex n'est pas privé car le mot est partagé entre processus.
+  if (syscall(SYS_futex, seq, FUTEX_WAIT_BITSET, observed, deadline, NULL, 
+      FUTEX_BITSET_MATCH_ANY) < 0) {
+    if (errno == ETIMEDOUT) {
+      return 0;
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+      return -1;
+    }
+  }
+
+  return 1;
+}
+
+static void futex_wake_all(atomic_uint *seq) {
+  syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int spin_until_changed(atomic_uint *seq, unsigned int observed, 
+    atomic_uint *budget, atomic_ulong *spins) {
+  // Sur un seul processeur, l'autre côté ne peut avancer pendant l'attente
+  static atomic_long nb_cpus = 0;
+  if (atomic_load_explicit(&nb_cpus, memory_order_relaxed) == 0) {
+    atomic_store_explicit(&nb_cpus, MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), 
+        memory_order_relaxed);
+  }
+  if (atomic_load_explicit(&nb_cpus, memory_order_relaxed) == 1) {
+    return 0;
+  }
+  unsigned int limit = atomic_load_explicit(budget, memory_order_relaxed);
+  for (unsigned int i = 0; i < limit; ++i) {
+    if (atomic_load_explicit(seq, memory_order_acquire) != observed) {
+      // Rapproche le budget de 2 * i, par moyenne exponentielle
+      long target = MAX(2 * (long) i, SPIN_MIN);
+      long b = (long) limit + (target - (long) limit) / 8;
+      atomic_store_explicit(budget, (unsigned int) MIN(b, SPIN_MAX), 
+          memory_order_relaxed);
+      atomic_fetch_add_explicit(spins, 1, memory_order_relaxed);
+      return 1;
+    }
+    CPU_RELAX();
+  }
+
+  return 0;
+}
+
+static int park_until_changed(atomic_uint *seq, unsigned int observed, 
+    const struct timespec *deadline, atomic_uint *budget, 
+    atomic_ulong *parks) {
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int r = futex_wait_until(seq, observed, deadline);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (r > 0) {
+    long ns = (long) (end.tv_sec - start.tv_sec) * 1000000000L 
+        + (end.tv_nsec - start.tv_nsec);
+    unsigned int b = atomic_load_explicit(budget, memory_order_relaxed);
+    b = ns < SHORT_PARK_NS ? MIN(2 * b, SPIN_MAX) : MAX(b - b / 8, SPIN_MIN);
+    atomic_store_explicit(budget, b, memory_order_relaxed);
+    atomic_fetch_add_explicit(parks, 1, memory_order_relaxed);
+  }
+
+  return r;
+}
+
+static int deadline_passed(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec 
+      && now.tv_nsec >= deadline->tv_nsec);
+}
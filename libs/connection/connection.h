@@ -10,17 +10,38 @@
 
 #include <limits.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-// Nom du SHM pour se mettre en liste d'attente sur le serveur
+// Nom par défaut de la file de connexion au serveur. Chacune de ses 
+// partitions est un SHM nommé <SHM_NAME>_<i>.
 #define SHM_NAME "/shm_server_963852741"
 
-// Taille maximale d'une commande
+// Taille maximale d'une commande des requêtes de taille fixe (send_request)
 #define MAX_COMMAND_LENGTH 256
 
+// Taille maximale par défaut d'une commande envoyée sur une session
+#define DEFAULT_REQUEST_MAX 65536
+
+// Borne de la taille maximale d'une commande (voir session_set_request_max)
+#define REQUEST_MAX_LIMIT (1 << 24)
+
+// Version du format des requêtes de session
+#define REQUEST_VERSION 2
+
+/*
+ * Types des requêtes de session
+ */
+
+// La charge utile est une commande à exécuter
+#define REQUEST_COMMAND 1
+
 // Taille maximale d'un message de réponse
 #define MAX_RESPONSE_LENGTH 4000
 
+// Taille des blocs compressés indépendamment dans une réponse
+#define COMPRESSION_BLOCK_SIZE 65536
+
 /*
  * Codes d'erreurs
  */
@@ -33,31 +54,71 @@
 #define MEMORY_ERROR -6
 #define PROC_ERROR -7
 #define SIG_ERROR -8
+#define PIPE_CLOSED -9
+#define INVALID_CHUNK -10
+#define INVALID_REQUEST -11
+#define REQUEST_EXPIRED -12
 
 /*
  * Manipulation de la queue de connexion au serveur
  */
 
+// Nombre maximum de voies de priorité de la file de connexion
+#define MAX_LANES 4
+
+// Nombre maximum de règles d'affectation des clients aux voies
+#define MAX_LANE_RULES 32
+
+/*
+ * Types des règles d'affectation des voies
+ */
+
+// La règle porte sur l'utilisateur du client
+#define LANE_RULE_UID 0
+// La règle porte sur le groupe, principal ou supplémentaire, du client
+#define LANE_RULE_GID 1
+
+/**
+ * Règle envoyant les requêtes des clients d'identifiant id (utilisateur ou 
+ * groupe selon kind) dans la voie lane.
+ */
+typedef struct lane_rule {
+  int kind;
+  unsigned int id;
+  size_t lane;
+} lane_rule;
+
 typedef struct server_queue server_queue;
 
 /**
- * Alloue en mémoire partagée la file de connexion du serveur et la renvoie.
- * La file contiendra max_slot slots.
+ * Alloue en mémoire partagée la file de connexion shm_name du serveur et la
+ * renvoie. La file est découpée en nb_shards partitions indépendantes, que 
+ * le serveur peut vider en parallèle (voir fetch_shm_requests). Chaque 
+ * partition contient nb_lanes voies de priorité de max_slot slots chacune 
+ * (voir set_lane_rules et set_lane_weights). Plusieurs serveurs peuvent 
+ * coexister sous des noms différents.
  * 
- * @param {size_t} Le nombre de slots de la file.
+ * @param {char *} Le nom de la file, commençant par '/'.
+ * @param {size_t} Le nombre de partitions de la file.
+ * @param {size_t} Le nombre de voies, de 1 à MAX_LANES.
+ * @param {size_t} Le nombre de slots de chaque voie.
  * @return {server_queue *} Le pointeur vers la file du serveur ou NULL en cas
  *                          d'erreur. L'erreur peut-être récupérée avec perror.
  */
-server_queue *init_server_queue(size_t max_slot);
+server_queue *init_server_queue(const char *shm_name, size_t nb_shards, 
+    size_t nb_lanes, size_t max_slot);
 
 /**
- * Etablit un lien avec la file de connexion du serveur shm_name et renvoie
- * un pointeur vers celle-ci.
+ * Etablit un lien avec toutes les partitions de la file de connexion du 
+ * serveur shm_name et renvoie un pointeur vers celle-ci.
  * 
- * @param {char *} Le nom du serveur auquel on souhaite se connecter.
+ * @param {char *} Le nom de la file du serveur auquel on souhaite se 
+ *                 connecter.
  * @return {server_queue *} Le pointeur vers la file de connexion au serveur 
  *                          ou NULL en cas d'erreur. L'erreur peut-être
- *                          récupérée via perror.
+ *                          récupérée via perror : EAGAIN si le serveur n'a 
+ *                          pas fini de créer la file et EINVAL si elle est
+ *                          incohérente.
  */
 server_queue *connect(const char *shm_name);
 
@@ -72,7 +133,8 @@ server_queue *connect(const char *shm_name);
 int disconnect(server_queue *queue_p);
 
 /**
- * Libère toutes les ressources associées à la file pointée par server_queue.
+ * Libère toutes les ressources associées à la file pointée par server_queue
+ * et supprime ses partitions.
  * 
  * @param {server_queue *} La file à libérer.
  * @return {int} 1 si tout se passe bien et un nombre négatif en cas d'erreur
@@ -80,44 +142,334 @@ int disconnect(server_queue *queue_p);
  */
 int free_server_queue(server_queue *queue_p);
 
+/**
+ * Publie dans la file queue_p la taille maximale des commandes acceptées par
+ * le serveur sur ses sessions.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {size_t} La taille maximale d'une commande, sans le '\0' final, 
+ *                 ramenée entre MAX_COMMAND_LENGTH et REQUEST_MAX_LIMIT.
+ */
+void set_request_max(server_queue *queue_p, size_t max);
+
+/**
+ * Renvoie la taille maximale des commandes acceptées par le serveur de la
+ * file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @return {size_t} La taille maximale, DEFAULT_REQUEST_MAX si le serveur ne
+ *                  l'a pas publiée.
+ */
+size_t get_request_max(const server_queue *queue_p);
+
+/**
+ * Renvoie le nombre de partitions de la file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @return {size_t} Le nombre de partitions, 0 si queue_p vaut NULL.
+ */
+size_t get_nb_shards(const server_queue *queue_p);
+
+/**
+ * Issue des attentes sur une file vide (consommateurs) ou pleine 
+ * (producteurs), cumulée sur toutes ses partitions depuis sa création.
+ */
+typedef struct queue_wait_stats {
+  unsigned long consumer_spins; // Attentes abouties pendant l'attente active
+  unsigned long consumer_parks; // Attentes terminées par un sommeil (futex)
+  unsigned long producer_spins;
+  unsigned long producer_parks;
+} queue_wait_stats;
+
+/**
+ * Copie dans stats les compteurs d'attente de la file queue_p, partagés par
+ * le serveur et ses clients.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {queue_wait_stats *} Les compteurs à remplir.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int get_wait_stats(const server_queue *queue_p, queue_wait_stats *stats);
+
+/**
+ * Fixe les permissions des partitions de la file queue_p, créées accessibles
+ * au seul propriétaire du serveur. Des clients d'autres utilisateurs ne 
+ * peuvent s'y connecter qu'avec les droits de lecture et d'écriture.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {mode_t} Les permissions (voir chmod).
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int set_queue_mode(server_queue *queue_p, mode_t mode);
+
+/**
+ * Renvoie le nombre de voies de priorité de la file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @return {size_t} Le nombre de voies, 0 si queue_p vaut NULL.
+ */
+size_t get_nb_lanes(const server_queue *queue_p);
+
+/**
+ * Fixe le poids des voies de la file queue_p : tant que plusieurs voies ont 
+ * des requêtes en attente, la voie i en cède weights[i] par tour, les voies
+ * de plus petit indice d'abord. Une voie chargée ne bloque jamais les 
+ * autres.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {const unsigned int[]} Le poids de chaque voie (au moins 1).
+ * @param {size_t} Le nombre de poids, égal au nombre de voies.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int set_lane_weights(server_queue *queue_p, const unsigned int weights[], 
+    size_t nb);
+
+/**
+ * Publie dans la file queue_p les règles d'affectation des clients aux 
+ * voies. Un client utilise la première règle portant sur son utilisateur ou
+ * l'un de ses groupes, et à défaut la voie default_lane.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {const lane_rule[]} Les règles, dans leur ordre d'application.
+ * @param {size_t} Le nombre de règles, au plus MAX_LANE_RULES.
+ * @param {size_t} La voie par défaut.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int set_lane_rules(server_queue *queue_p, const lane_rule rules[], 
+    size_t nb_rules, size_t default_lane);
+
+/**
+ * Etat d'une voie, cumulé sur toutes les partitions de la file.
+ */
+typedef struct lane_stats {
+  size_t depth;                  // Requêtes en attente
+  unsigned long dequeued;        // Requêtes retirées depuis la création,
+                                 // expirées comprises
+  unsigned long long wait_ns;    // Attente cumulée des requêtes retirées
+  unsigned long long max_wait_ns;
+  unsigned long expired;         // Requêtes écartées car leur client avait
+                                 // renoncé
+} lane_stats;
+
+/**
+ * Copie dans stats l'état de la voie lane de la file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {size_t} La voie.
+ * @param {lane_stats *} L'état à remplir.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int get_lane_stats(const server_queue *queue_p, size_t lane, 
+    lane_stats *stats);
+
+/**
+ * Charge du serveur, publiée dans la file pour que les clients renoncent
+ * d'emblée à une connexion qui ne serait pas acceptée avant leur timeout.
+ */
+typedef struct queue_load {
+  size_t length;                // Requêtes en attente, toutes voies
+                                // confondues
+  size_t active_sessions;       // Sessions en cours
+  size_t max_sessions;          // Sessions simultanées (0 : pas de limite)
+  unsigned long long service_ns; // Durée récente d'une session (moyenne
+                                 // glissante)
+  unsigned long rejected;       // Requêtes refusées depuis la création
+} queue_load;
+
+/**
+ * Copie dans load la charge publiée dans la file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {queue_load *} La charge à remplir.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int get_queue_load(const server_queue *queue_p, queue_load *load);
+
+/**
+ * Publie dans la file queue_p le nombre maximum de sessions que le serveur
+ * mène de front. Au-delà, les requêtes patientent dans la file.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {size_t} Le nombre de sessions (0 : pas de limite).
+ */
+void set_max_sessions(server_queue *queue_p, size_t max);
+
+/**
+ * Compte une nouvelle session dans la charge publiée dans la file queue_p.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @return {size_t} Le nombre de sessions en cours, celle-ci comprise.
+ */
+size_t add_active_session(server_queue *queue_p);
+
+/**
+ * Retire une session terminée de la charge publiée dans la file queue_p et
+ * intègre sa durée à la durée récente des sessions.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {unsigned long long} La durée de la session en nanosecondes, 0 si
+ *                             elle n'a pas démarré.
+ * @return {size_t} Le nombre de sessions restant en cours.
+ */
+size_t remove_active_session(server_queue *queue_p, 
+    unsigned long long service_ns);
+
+/**
+ * Estime, d'après la charge publiée dans la file queue_p, le délai au bout
+ * duquel une requête refusée (SERVER_IS_FULL) a des chances d'être acceptée.
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @return {long} Le délai en millisecondes, au moins RETRY_AFTER_MIN_MS, et
+ *                une valeur négative en cas d'erreur.
+ */
+long get_retry_after(const server_queue *queue_p);
+
+// Délai minimum suggéré par get_retry_after
+#define RETRY_AFTER_MIN_MS 10
+
 /*
  * Manipulation de la requête de connexion au serveur.
  */
 
+/*
+ * Transports possibles des données d'une session
+ */
+
+// Tubes nommés request_pipe et response_pipe
+#define TRANSPORT_FIFO 0
+// Anneaux en mémoire partagée dans le segment session_shm
+#define TRANSPORT_SHM_RING 1
+// Socket du domaine Unix SOCK_SEQPACKET socket_path, créé par le client
+#define TRANSPORT_SOCKET 2
+
+/*
+ * Capacités annoncées par le client dans sa requête de connexion
+ */
+
+// Le client sait décompresser les morceaux de réponse compressés
+#define CAPABILITY_COMPRESSION 0x1
+// Le client accepte les réponses volumineuses transmises sous forme de 
+// descripteur de fichier en mémoire (TRANSPORT_SOCKET uniquement)
+#define CAPABILITY_FD_PASSING 0x2
+// Le client ne doit pas être interrompu par des signaux du serveur : il est
+// embarqué dans un processus qui ouvre éventuellement plusieurs sessions
+#define CAPABILITY_NO_SIGNALS 0x4
+
 typedef struct shm_request {
   char request_pipe[NAME_MAX + 1];
   char response_pipe[NAME_MAX + 1];
+  char session_shm[NAME_MAX + 1];
+  char socket_path[NAME_MAX + 1];
+  int transport;
+  int capabilities;
   pid_t pid;
   uid_t uid;
+  struct timespec deadline; // Instant où le client renonce (CLOCK_MONOTONIC)
 } shm_request;
 
 /**
  * Créé et envoie une requête au serveur pointé par server_q. Cette requête
  * contiendra les noms des pipes sur lesquels doit s'effectuer la 
- * requête / réponse.
+ * requête / réponse. La partition utilisée dépend du pid du client : si elle
+ * est pleine, les autres sont essayées avant d'attendre qu'elle se libère.
+ * Si la charge publiée par le serveur indique que la requête ne serait pas
+ * acceptée avant le timeout, elle est refusée sans attendre : le délai
+ * avant une nouvelle tentative est donné par get_retry_after.
  * 
  * @param {server_queue *} La file de requêtes.
  * @param {char[]} Le nom du tube de requête.
  * @param {char[]} Le nom du tube de réponse.
+ * @param {int} Les capacités du client (CAPABILITY_*).
+ * @param {time_t} Un timeout.
+ * @return {int} 1 si tout se passe bien et une valeur négative sinon
+ *               (SERVER_IS_FULL si la requête est refusée). Cette erreur
+ *               peut-être récupérée via perror. Retourne 0 si le timeout a
+ *               atteint 0.
+ */
+int send_shm_request(server_queue *server_q, const char request_pipe_name[], 
+    const char response_pipe_name[], int capabilities, time_t timeout);
+
+/**
+ * Créé et envoie au serveur pointé par server_q une requête de connexion dont
+ * les données transiteront par les anneaux du segment de mémoire partagée 
+ * session_shm_name (voir create_ring_session).
+ * 
+ * @param {server_queue *} La file de requêtes.
+ * @param {char[]} Le nom du segment de mémoire partagée de la session.
+ * @param {int} Les capacités du client (CAPABILITY_*).
  * @param {time_t} Un timeout.
  * @return {int} 1 si tout se passe bien et une valeur négative sinon.
  *               Cette erreur peut-être récupérée via perror. Retourne 0
  *               si le timeout a atteint 0.
  */
-int send_shm_request(server_queue *server_q, const char request_pipe_name[], 
-    const char response_pipe_name[], time_t timeout);
+int send_shm_ring_request(server_queue *server_q, 
+    const char session_shm_name[], int capabilities, time_t timeout);
 
 /**
- * Récupère la requête la plus ancienne de la file des requêtes et execute la
- * fonction apply en passant cette requête en paramètre. À la fin de 
- * l'exécution de apply, la requête la plus ancienne est supprimée de la file.
+ * Créé et envoie au serveur pointé par server_q une requête de connexion dont
+ * les données transiteront par le socket socket_path sur lequel le client 
+ * écoute (voir create_socket_session).
+ * 
+ * @param {server_queue *} La file de requêtes.
+ * @param {char[]} Le chemin du socket de la session.
+ * @param {int} Les capacités du client (CAPABILITY_*).
+ * @param {time_t} Un timeout.
+ * @return {int} 1 si tout se passe bien et une valeur négative sinon.
+ *               Cette erreur peut-être récupérée via perror. Retourne 0
+ *               si le timeout a atteint 0.
+ */
+int send_shm_socket_request(server_queue *server_q, 
+    const char socket_path[], int capabilities, time_t timeout);
+
+/**
+ * Retire la requête la plus ancienne de la prochaine voie à servir (voir 
+ * set_lane_weights) de la partition shard de la file des requêtes et 
+ * execute la fonction apply en passant une copie de cette requête en 
+ * paramètre. La case est rendue aux producteurs avant l'exécution
+ * de apply. Attend tant que la partition est vide. Les requêtes dont le 
+ * client a renoncé (deadline dépassée) sont écartées sans être appliquées.
  * 
  * @param {server_queue *} La file sur laquelle récupérer la requête.
+ * @param {size_t} La partition à vider.
  * @param {int (*apply)} La fonction à appliquer sur la requête récupérée.
- * @return {int} Le retour de apply si tout se passe bien et une valeur 
- *               négative sinon. L'erreur peut-être récupérée via perror.
+ * @return {int} Le retour de apply si tout se passe bien, 0 si le retrait 
+ *               est suspendu (voir pause_fetching) et une valeur négative 
+ *               sinon. L'erreur peut-être récupérée via perror.
  */
-int fetch_shm_request(server_queue *server_q, int (*apply)(shm_request *));
+int fetch_shm_request(server_queue *server_q, size_t shard, 
+    int (*apply)(shm_request *));
+
+/**
+ * Retire en une fois toutes les requêtes en attente dans la partition shard
+ * de la file, dans la limite de max_batch et selon le poids des voies, et 
+ * exécute la fonction apply sur le lot. Attend tant que la partition est 
+ * vide. Les cases sont rendues aux producteurs avant l'exécution de apply. 
+ * Chaque partition peut être vidée par un thread différent. Les requêtes 
+ * dont le client a renoncé (deadline dépassée) sont écartées du lot et 
+ * comptées dans lane_stats.expired.
+ * 
+ * @param {server_queue *} La file sur laquelle récupérer les requêtes.
+ * @param {size_t} La partition à vider.
+ * @param {int (*apply)} La fonction à appliquer sur le lot et sa taille.
+ * @param {size_t} La taille maximale d'un lot.
+ * @return {int} Le retour de apply si tout se passe bien, 0 si le retrait 
+ *               est suspendu (voir pause_fetching) et une valeur négative 
+ *               sinon. L'erreur peut-être récupérée via perror.
+ */
+int fetch_shm_requests(server_queue *server_q, size_t shard, 
+    int (*apply)(shm_request *, size_t), size_t max_batch);
+
+/**
+ * Suspend ou reprend, dans le processus appelant, le retrait des requêtes de
+ * la file server_q. Une fois suspendu, fetch_shm_request et 
+ * fetch_shm_requests renvoient 0 sans rien retirer ni appeler apply, y 
+ * compris lorsqu'elles attendaient : les requêtes restent dans la file pour
+ * un autre processus qui s'y connecterait (voir connect).
+ * 
+ * @param {server_queue *} La file du serveur.
+ * @param {int} Une valeur non nulle pour suspendre, 0 pour reprendre.
+ */
+void pause_fetching(server_queue *server_q, int paused);
 
 /*
  * Manipulation de la requête à écrire sur le tube.
@@ -221,4 +573,407 @@ int listen_response(response_fifo *res_fifo, char **buffer, time_t timeout);
  */
 int close_response_fifo(response_fifo *res);
 
+/*
+ * Manipulation des sessions persistantes.
+ *
+ * Une session garde les tubes de requête et de réponse ouverts pendant toute
+ * la durée de la connexion du client. Les messages y sont délimités par leur
+ * trame : une requête est un en-tête versionné (type, options, longueur) 
+ * suivi de la commande, sans taille fixe, et une réponse est une suite de 
+ * morceaux précédés de leur taille, terminée par un morceau vide. Chaque 
+ * requête porte un identifiant choisi par le client et repris par tous les 
+ * morceaux de sa réponse : le client peut envoyer plusieurs 
+ * requêtes sans attendre leurs réponses, qui lui parviennent dans l'ordre 
+ * d'envoi (voir session_pipeline_depth).
+ * 
+ * Le transport des trames est interchangeable : tubes nommés 
+ * (TRANSPORT_FIFO), anneaux en mémoire partagée propres à la session 
+ * (TRANSPORT_SHM_RING) ou socket du domaine Unix (TRANSPORT_SOCKET) dont le 
+ * noyau fournit l'identité du client. Si le client l'a 
+ * annoncé (CAPABILITY_COMPRESSION), les morceaux volumineux peuvent être 
+ * compressés ; ils sont décompressés à la réception.
+ */
+
+typedef struct session session;
+
+/**
+ * Ouvre, côté serveur, la session du client ayant émis la requête shm_req.
+ * Selon shm_req->transport, le tube de requête est ouvert en lecture et le
+ * tube de réponse en écriture, le segment session_shm est projeté ou le 
+ * serveur se connecte au socket socket_path.
+ * 
+ * @param {shm_request *} La requête de connexion du client.
+ * @param {time_t} Le temps maximum d'attente de l'ouverture du tube de 
+ *                 réponse par le client ou d'une place dans la file de son
+ *                 socket. 0 pour une seule tentative, sans attente.
+ * @return {session *} Un pointeur vers la session ou NULL en cas d'erreur.
+ *                     L'erreur peut être consultée via perror. errno vaut 
+ *                     ETIMEDOUT si le client n'était pas prêt à temps.
+ */
+session *accept_session(const shm_request *shm_req, time_t timeout);
+
+/**
+ * Rend les descripteurs de la session s, côté serveur, héritables par un 
+ * programme lancé via exec afin qu'il reprenne la session (voir 
+ * resume_session) sans que le client ne soit déconnecté. La session reste 
+ * utilisable par l'appelant.
+ * 
+ * @param {session *} La session.
+ * @param {int[2]} Où stocker les descripteurs de requête et de réponse, -1
+ *                 pour une session TRANSPORT_SHM_RING dont le segment est
+ *                 retrouvé par son nom.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int session_export(const session *s, int fds[2]);
+
+/**
+ * Reconstitue, côté serveur, la session du client ayant émis la requête 
+ * shm_req à partir des descripteurs hérités d'un processus qui l'a exportée
+ * via session_export avant exec. Les paramètres de la session (taille 
+ * maximale des commandes, compression) doivent être fixés de nouveau.
+ * 
+ * @param {shm_request *} La requête de connexion du client.
+ * @param {const int[2]} Les descripteurs donnés par session_export.
+ * @return {session *} La session ou NULL en cas d'erreur.
+ */
+session *resume_session(const shm_request *shm_req, const int fds[2]);
+
+/**
+ * Ouvre, côté client, la session associée aux tubes req_fifo et res_fifo.
+ * Doit être appelée après l'envoi de la requête de connexion au serveur.
+ * 
+ * @param {request_fifo *} Le réseau de requête.
+ * @param {response_fifo *} Le tube de réponse.
+ * @param {time_t} Le temps maximum d'attente de l'ouverture du tube de 
+ *                 requête par le serveur.
+ * @return {session *} Un pointeur vers la session ou NULL en cas d'erreur.
+ *                     L'erreur peut être consultée via perror.
+ */
+session *open_session(const request_fifo *req_fifo, 
+    const response_fifo *res_fifo, time_t timeout);
+
+/**
+ * Créé, côté client, le segment de mémoire partagée name contenant deux 
+ * anneaux producteur unique / consommateur unique de ring_size octets 
+ * (arrondi à la puissance de 2 supérieure) : l'un pour les requêtes, l'autre
+ * pour les réponses. La session renvoyée est utilisable dès que la requête
+ * de connexion a été envoyée via send_shm_ring_request. Le segment est 
+ * supprimé par close_session.
+ * 
+ * @param {char *} Le nom du segment à créer.
+ * @param {size_t} La capacité de chaque anneau.
+ * @return {session *} Un pointeur vers la session ou NULL en cas d'erreur.
+ *                     L'erreur peut être consultée via perror.
+ */
+session *create_ring_session(const char *name, size_t ring_size);
+
+/**
+ * Créé, côté client, le socket path et s'y met à l'écoute du serveur. La 
+ * session renvoyée est utilisable dès que la requête de connexion a été 
+ * envoyée via send_shm_socket_request : la connexion du serveur est 
+ * acceptée lors du premier échange, puis le socket est supprimé.
+ * 
+ * @param {char *} Le chemin du socket à créer.
+ * @return {session *} Un pointeur vers la session ou NULL en cas d'erreur.
+ *                     L'erreur peut être consultée via perror.
+ */
+session *create_socket_session(const char *path);
+
+/**
+ * Récupère, côté serveur, l'identité du client de la session s telle que 
+ * fournie par le noyau, lorsque le transport le permet (TRANSPORT_SOCKET).
+ * 
+ * @param {session *} La session.
+ * @param {pid_t *} L'adresse où stocker le pid du client.
+ * @param {uid_t *} L'adresse où stocker l'uid du client.
+ * @return {int} 1 si l'identité est connue, 0 si le transport ne la fournit
+ *               pas et une valeur négative en cas d'erreur.
+ */
+int session_peer_credentials(const session *s, pid_t *pid, uid_t *uid);
+
+/**
+ * Active, côté serveur, la compression des morceaux de réponse d'au moins 
+ * threshold octets sur la session s. Les morceaux de plus de 
+ * COMPRESSION_BLOCK_SIZE octets sont découpés en blocs compressés 
+ * indépendamment.
+ * 
+ * @param {session *} La session.
+ * @param {size_t} La taille à partir de laquelle un morceau est compressé.
+ * @return {int} 1 si la compression est activée, 0 si le client ne sait pas
+ *               décompresser et une valeur négative en cas d'erreur.
+ */
+int session_enable_compression(session *s, size_t threshold);
+
+/**
+ * Renvoie le descripteur sur lequel un serveur peut attendre, via poll ou 
+ * epoll, l'arrivée des requêtes de la session s. Une requête est écrite 
+ * sans interruption : dès que le descripteur est lisible, 
+ * session_listen_request ne bloque que le temps de la recevoir.
+ * 
+ * @param {session *} La session.
+ * @return {int} Le descripteur ou -1 si la session n'en possède pas 
+ *               (TRANSPORT_SHM_RING).
+ */
+int session_request_fd(const session *s);
+
+/**
+ * Attend, côté serveur, qu'une requête arrive sur la session s (ou que le 
+ * client la ferme) ou que le descripteur wake_fd devienne lisible. Les 
+ * sessions sans descripteur (TRANSPORT_SHM_RING) contrôlent wake_fd toutes
+ * les secondes.
+ * 
+ * @param {session *} La session.
+ * @param {int} Un descripteur de réveil, -1 si aucun.
+ * @return {int} 1 si session_listen_request peut être appelée, 0 si wake_fd
+ *               est lisible et une valeur négative en cas d'erreur.
+ */
+int session_wait_request(session *s, int wake_fd);
+
+/**
+ * Renvoie le descripteur sur lequel un client peut attendre, via poll ou 
+ * epoll, l'arrivée des morceaux de réponse de la session s. Un morceau est 
+ * écrit sans interruption : dès que le descripteur est lisible, 
+ * session_listen_chunk ne bloque que le temps de le recevoir.
+ * 
+ * @param {session *} La session.
+ * @return {int} Le descripteur ou -1 si la session n'en possède pas 
+ *               (TRANSPORT_SHM_RING, ou TRANSPORT_SOCKET tant que le serveur
+ *               ne s'est pas connecté).
+ */
+int session_response_fd(const session *s);
+
+/**
+ * Renvoie le nombre de requêtes d'au plus MAX_COMMAND_LENGTH octets que le 
+ * client peut envoyer sur la session s sans attendre de réponse, sans jamais
+ * être bloqué à l'envoi. Au-delà, le client et le serveur pourraient 
+ * s'attendre mutuellement.
+ * 
+ * @param {session *} La session.
+ * @return {size_t} Le nombre maximum de requêtes en vol (au moins 1).
+ */
+size_t session_pipeline_depth(const session *s);
+
+/**
+ * Transmet comme morceau de la réponse à la requête id ce qui est disponible
+ * sur le tube fd, au plus limit octets (limit > 0), en attendant si besoin 
+ * que des données arrivent. Si le morceau n'a pas à être compressé et que le
+ * transport le permet (TRANSPORT_FIFO), les octets passent directement du 
+ * tube au canal de réponse (splice) sans être recopiés par l'appelant.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {int} Le tube à lire.
+ * @param {size_t} Le nombre maximum d'octets à transmettre.
+ * @param {size_t *} L'adresse où stocker le nombre d'octets transmis, 0 si 
+ *                   le tube a été fermé.
+ * @param {time_t} Un timeout d'envoi.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               0 si le timeout a été atteint.
+ */
+int session_forward_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *forwarded, time_t timeout);
+
+/**
+ * Indique si la session s peut transmettre des descripteurs à son client 
+ * (voir session_spool_chunk).
+ * 
+ * @param {session *} La session.
+ * @return {int} Une valeur non nulle si c'est le cas et 0 sinon.
+ */
+int session_can_send_fd(const session *s);
+
+/**
+ * Recopie ce qui est lu sur fd dans un fichier en mémoire (memfd) puis 
+ * transmet ce fichier au client comme morceau de la réponse en cours à la 
+ * requête id. Le client le projette en mémoire sans copie. La recopie 
+ * s'arrête à la fermeture de fd, après limit octets ou lorsque fd reste 
+ * silencieux un court instant : une longue sortie est transmise en plusieurs
+ * morceaux. Nécessite session_can_send_fd.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {int} Le descripteur à lire.
+ * @param {size_t} Le nombre maximum d'octets à lire.
+ * @param {size_t *} L'adresse où stocker le nombre d'octets transmis, 0 si 
+ *                   fd a été fermé.
+ * @param {const struct timespec *} L'échéance (CLOCK_MONOTONIC) de la 
+ *                                  lecture de fd, NULL si aucune.
+ * @param {time_t} Un timeout d'envoi.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               0 si le timeout a été atteint. REQUEST_EXPIRED si 
+ *               l'échéance de lecture est dépassée.
+ */
+int session_spool_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *spooled, const struct timespec *deadline, time_t timeout);
+
+/**
+ * Fixe la taille maximale des commandes envoyées ou reçues sur la session s
+ * (DEFAULT_REQUEST_MAX par défaut). Le client et le serveur doivent 
+ * s'accorder sur cette valeur (voir get_request_max).
+ * 
+ * @param {session *} La session.
+ * @param {size_t} La taille maximale d'une commande, sans le '\0' final, 
+ *                 ramenée entre MAX_COMMAND_LENGTH et REQUEST_MAX_LIMIT.
+ */
+void session_set_request_max(session *s, size_t max);
+
+/**
+ * Fixe le délai accordé au serveur pour répondre à chaque requête envoyée 
+ * ensuite sur la session s, à compter de son envoi. L'échéance absolue 
+ * voyage avec la requête : le serveur ne l'exécute pas si elle est déjà 
+ * dépassée et interrompt la commande qui la dépasse.
+ * 
+ * @param {session *} La session.
+ * @param {time_t} Le délai en secondes, 0 pour aucune échéance (défaut).
+ */
+void session_set_request_deadline(session *s, time_t delay);
+
+/**
+ * Copie dans deadline l'échéance (CLOCK_MONOTONIC) de la dernière requête 
+ * reçue sur la session s par session_listen_request.
+ * 
+ * @param {const session *} La session.
+ * @param {struct timespec *} L'échéance à remplir.
+ * @return {int} 1 si la requête a une échéance et 0 sinon.
+ */
+int session_request_deadline(const session *s, struct timespec *deadline);
+
+/**
+ * Envoie la commande cmd, identifiée par id, sur la session s. Seuls les 
+ * octets de la commande sont transmis, derrière un en-tête de taille fixe.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {char *} La commande que doit éxecuter le serveur.
+ * @param {time_t} Un timeout.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               Cette erreur pourra être récupérée via perror. 0 si le 
+ *               timeout a été atteint. INVALID_REQUEST si la commande 
+ *               dépasse la taille maximale de la session.
+ */
+int session_send_request(session *s, unsigned int id, const char *cmd, 
+    time_t timeout);
+
+/**
+ * Attend la prochaine requête de la session s et stocke son identifiant dans
+ * *id et la commande à exécuter dans *cmd. La commande, terminée par '\0', 
+ * appartient à la session et reste valide jusqu'au prochain appel. Une fois
+ * l'en-tête reçu, le reste de la requête doit arriver avant timeout.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int *} L'adresse où stocker l'identifiant de la requête.
+ * @param {char **} L'adresse où stocker la commande à exécuter.
+ * @param {time_t} Le timeout de réception de la requête après son en-tête.
+ * @return {int} 1 en cas de succès, 0 si le client a fermé la session ou si 
+ *               le timeout a été atteint, et une valeur négative en cas 
+ *               d'erreur. Cette erreur pourra être récupérée via perror. 
+ *               INVALID_REQUEST si la requête *id est d'une version ou d'un
+ *               type inconnus ou dépasse la taille maximale : elle est 
+ *               ignorée et la session reste utilisable. Une requête dépassant
+ *               de loin la taille maximale ferme la session (PIPE_ERROR).
+ */
+int session_listen_request(session *s, unsigned int *id, char **cmd, 
+    time_t timeout);
+
+/**
+ * Envoie sur la session s les n octets de data comme morceau de la réponse
+ * en cours à la requête id. Le client peut les lire avant la fin de la 
+ * réponse via session_listen_chunk. Ne fait rien si n vaut 0.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {const char *} Les octets à envoyer.
+ * @param {size_t} Le nombre d'octets à envoyer.
+ * @param {time_t} Un timeout d'envoi.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               0 si le timeout a été atteint.
+ */
+int session_send_chunk(session *s, unsigned int id, const char *data, 
+    size_t n, time_t timeout);
+
+/**
+ * Termine la réponse en cours à la requête id sur la session s.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {time_t} Un timeout d'envoi.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               0 si le timeout a été atteint.
+ */
+int session_end_response(session *s, unsigned int id, time_t timeout);
+
+/**
+ * Envoie la réponse msg à la requête id, en un seul morceau, sur la 
+ * session s.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {char *} Le message à envoyer.
+ * @param {ssize_t} La taille maximale de la réponse.
+ * @param {time_t} Un timeout de réponse.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               Cette erreur pourra être récupérée via perror.
+ *               0 si le timeout a été atteint.
+ */
+int session_send_response(session *s, unsigned int id, const char *msg, 
+    ssize_t max_size, time_t timeout);
+
+/**
+ * Ecoute le prochain morceau de la réponse en cours sur la session s. Son 
+ * contenu est stocké dans *buffer et devra être libéré par l'appelant via 
+ * session_free_chunk : un morceau transmis par descripteur est une vue en 
+ * lecture seule du fichier du serveur, terminée par '\0'. Un morceau non 
+ * compressé et contigu dans l'anneau de réponse (TRANSPORT_SHM_RING) est 
+ * une vue de l'anneau, sans '\0' final, valable jusqu'à l'écoute suivante.
+ * Les autres morceaux sont copiés et terminés par '\0'. *size vaut 0 et 
+ * *buffer NULL lorsque la réponse est terminée. L'identifiant de la requête
+ * concernée est stocké dans *id.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int *} L'adresse où stocker l'identifiant de la requête.
+ * @param {char **} L'adresse où stocker le morceau.
+ * @param {size_t *} L'adresse où stocker la taille du morceau.
+ * @param {time_t} Un timeout en cas de non réponse.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               Cette erreur pourra être récupérée via perror. 0 si le timeout
+ *               a été atteint.
+ */
+int session_listen_chunk(session *s, unsigned int *id, char **buffer, 
+    size_t *size, time_t timeout);
+
+/**
+ * Libère le morceau buffer renvoyé par session_listen_chunk.
+ * 
+ * @param {session *} La session.
+ * @param {char *} Le morceau à libérer.
+ */
+void session_free_chunk(session *s, char *buffer);
+
+/**
+ * Ecoute la prochaine réponse de la session s et stocke son contenu dans 
+ * *buffer qui devra être libéré par l'appelant. Le timeout s'applique à
+ * l'attente de chacun des morceaux de la réponse. Si id n'est pas NULL,
+ * l'identifiant de la requête concernée y est stocké.
+ * 
+ * @param {session *} La session.
+ * @param {unsigned int *} L'adresse où stocker l'identifiant de la requête.
+ * @param {char **} L'adresse où stocker la réponse.
+ * @param {time_t} Un timeout en cas de non réponse.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ *               Cette erreur pourra être récupérée via perror. 0 si le timeout
+ *               a été atteint.
+ */
+int session_listen_response(session *s, unsigned int *id, char **buffer, 
+    time_t timeout);
+
+/**
+ * Ferme les descripteurs de la session s et libère celle-ci. Les tubes ne
+ * sont pas supprimés, contrairement au segment ou au socket créés par le 
+ * client. Les vues non libérées par session_free_chunk sont détruites.
+ * 
+ * @param {session *} La session à fermer.
+ * @return {int} 1 en cas de succès et un nombre négatif en cas d'échec.
+ */
+int close_session(session *s);
+
 #endif
\ No newline at end of file
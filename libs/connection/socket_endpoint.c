@@ -0,0 +1,166 @@
+// struct ucred n'est déclarée qu'avec _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "socket_endpoint.h"
+
+/**
+ * Remplit address avec le chemin path.
+ * 
+ * @return {int} 0 en cas de succès et -1 si le chemin est trop long.
+ */
+static int fill_address(struct sockaddr_un *address, const char *path);
+
+int socket_endpoint_listen(const char *path) {
+  struct sockaddr_un address;
+  if (fill_address(&address, path) < 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, 1) < 0) {
+    int err = errno;
+    close(fd);
+    unlink(path);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+int socket_endpoint_accept(int listen_fd) {
+  return accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+int socket_endpoint_connect(const char *path) {
+  struct sockaddr_un address;
+  if (fill_address(&address, path) < 0) {
+    return -1;
+  }
+  // Le chemin est choisi par le client : une connexion locale aboutit 
+  // immédiatement ou échoue (EAGAIN) si sa file d'attente est pleine, sans
+  // jamais bloquer l'appelant.
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  // Dans libconnection.so, le symbole connect désigne la fonction de 
+  // connection.h : l'appel système est donc effectué directement.
+  if (syscall(SYS_connect, fd, (struct sockaddr *) &address, 
+      sizeof(address)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+int socket_endpoint_peer(int fd, pid_t *pid, uid_t *uid) {
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0) {
+    return -1;
+  }
+  *pid = credentials.pid;
+  *uid = credentials.uid;
+
+  return 0;
+}
+
+ssize_t socket_endpoint_send(int fd, const void *buffer, size_t n, 
+    int passed_fd) {
+  struct iovec iov = { .iov_base = (void *) buffer, .iov_len = n };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (passed_fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+  }
+
+  return sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+ssize_t socket_endpoint_recv(int fd, void *buffer, size_t n, int *passed_fd) {
+  struct iovec iov = { .iov_base = buffer, .iov_len = n };
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = { 
+    .msg_iov = &iov, 
+    .msg_iovlen = 1,
+    .msg_control = control.buffer,
+    .msg_controllen = sizeof(control.buffer)
+  };
+  *passed_fd = -1;
+  ssize_t r = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (r < 0) {
+    return -1;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+      cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+    if (*passed_fd >= 0) {
+      close(*passed_fd);
+      *passed_fd = -1;
+    }
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  return r;
+}
+
+int socket_endpoint_send_buffer(int fd) {
+  int size;
+  socklen_t length = sizeof(size);
+  if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &length) < 0) {
+    return -1;
+  }
+
+  return size;
+}
+
+/*
+ * Fonctions outils
+ */
+
+static int fill_address(struct sockaddr_un *address, const char *path) {
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, path);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * Mise en place des sockets du domaine Unix (SOCK_SEQPACKET) du transport 
+ * TRANSPORT_SOCKET. Ces appels sont isolés de connection.c car la fonction
+ * connect de connection.h masque celle de <sys/socket.h>. Les descripteurs
+ * renvoyés sont non bloquants et fermés lors d'un exec.
+ * 
+ * @author Jordan ELIE.
+ */
+
+#ifndef SOCKET_ENDPOINT_H
+#define SOCKET_ENDPOINT_H
+
+#include <sys/types.h>
+
+/**
+ * Créé le socket path et se met à l'écoute d'une unique connexion.
+ * 
+ * @param {const char *} Le chemin du socket à créer.
+ * @return {int} Le descripteur d'écoute ou -1 en cas d'erreur (errno).
+ */
+int socket_endpoint_listen(const char *path);
+
+/**
+ * Accepte la connexion en attente sur le descripteur d'écoute listen_fd.
+ * 
+ * @param {int} Le descripteur d'écoute.
+ * @return {int} Le descripteur de la connexion ou -1 en cas d'erreur. errno
+ *               vaut EAGAIN si aucune connexion n'est en attente.
+ */
+int socket_endpoint_accept(int listen_fd);
+
+/**
+ * Se connecte au socket path sans bloquer. La connexion obtenue est non 
+ * bloquante.
+ * 
+ * @param {const char *} Le chemin du socket.
+ * @return {int} Le descripteur de la connexion ou -1 en cas d'erreur (errno).
+ *               errno vaut EAGAIN si la file d'attente du socket est pleine.
+ */
+int socket_endpoint_connect(const char *path);
+
+/**
+ * Récupère auprès du noyau l'identité du processus à l'autre extrémité de la
+ * connexion fd (SO_PEERCRED).
+ * 
+ * @param {int} Le descripteur de la connexion.
+ * @param {pid_t *} L'adresse où stocker le pid du pair.
+ * @param {uid_t *} L'adresse où stocker l'uid du pair.
+ * @return {int} 0 en cas de succès et -1 en cas d'erreur (errno).
+ */
+int socket_endpoint_peer(int fd, pid_t *pid, uid_t *uid);
+
+/**
+ * Envoie les n octets de buffer en un seul message sur la connexion fd, 
+ * accompagnés du descripteur passed_fd s'il est positif (SCM_RIGHTS).
+ * 
+ * @param {int} Le descripteur de la connexion.
+ * @param {const void *} Le contenu du message.
+ * @param {size_t} La taille du message.
+ * @param {int} Le descripteur à transmettre ou -1.
+ * @return {ssize_t} Le nombre d'octets envoyés ou -1 en cas d'erreur (errno).
+ */
+ssize_t socket_endpoint_send(int fd, const void *buffer, size_t n, 
+    int passed_fd);
+
+/**
+ * Reçoit un message d'au plus n octets sur la connexion fd. Un descripteur
+ * joint au message est stocké dans *passed_fd (-1 sinon).
+ * 
+ * @param {int} Le descripteur de la connexion.
+ * @param {void *} Le tampon où stocker le message.
+ * @param {size_t} La taille du tampon.
+ * @param {int *} L'adresse où stocker le descripteur reçu.
+ * @return {ssize_t} La taille du message, 0 si le pair a fermé la connexion
+ *                   ou -1 en cas d'erreur (errno). errno vaut EMSGSIZE si le
+ *                   message dépassait n octets.
+ */
+ssize_t socket_endpoint_recv(int fd, void *buffer, size_t n, int *passed_fd);
+
+/**
+ * Renvoie la taille du tampon d'envoi de la connexion fd (SO_SNDBUF).
+ * 
+ * @param {int} Le descripteur de la connexion.
+ * @return {int} La taille du tampon ou -1 en cas d'erreur (errno).
+ */
+int socket_endpoint_send_buffer(int fd);
+
+#endif
@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "flight.h"
+
+/*
+ * Une exécution reste dans la table tant que son meneur n'a pas fini : une
+ * requête arrivée ensuite lance une nouvelle exécution et ne reçoit jamais
+ * une sortie calculée avant elle. L'exécution elle-même vit jusqu'à ce que
+ * la dernière requête rattachée ait transmis la sortie.
+ */
+
+// Nombre de listes de la table des exécutions
+#define FLIGHT_BUCKETS 64
+
+#define MAX(x, y) (x > y ? x : y)
+
+/*
+ * Etats d'une exécution
+ */
+
+#define FLIGHT_RUNNING 0
+#define FLIGHT_DONE 1
+#define FLIGHT_FAILED 2
+
+/*
+ * Structures
+ */
+
+struct flight {
+  char *key;
+  size_t key_len;
+  size_t hash;
+  int state;
+  char *data;
+  size_t size;
+  size_t refs;         // Meneur (jusqu'à la fin) et requêtes rattachées
+  pthread_cond_t done; // Signalée à la fin de l'exécution
+  struct flight *next; // Suivante dans la table
+};
+
+struct flight_table {
+  pthread_mutex_t mutex;
+  flight *flights[FLIGHT_BUCKETS];
+  flight_stats stats;
+};
+
+/**
+ * Calcule le hachage FNV-1a des n octets de key.
+ */
+static size_t hash_key(const char *key, size_t n);
+
+/**
+ * Créé l'exécution key, dont l'appelant est le meneur.
+ */
+static flight *new_flight(const char *key, size_t key_len, size_t hash);
+
+/**
+ * Retire f de la table, la termine dans l'état state et rend la référence
+ * du meneur. Le verrou doit être pris.
+ */
+static void finish_flight(flight_table *table, flight *f, int state);
+
+/**
+ * Rend une référence de f, libérée avec la dernière. Le verrou doit être
+ * pris.
+ */
+static void put_flight(flight *f);
+
+/*
+ * Fonctions de l'interface
+ */
+
+flight_table *flight_create(void) {
+  flight_table *table = calloc(1, sizeof *table);
+  if (table == NULL) {
+    return NULL;
+  }
+  if (pthread_mutex_init(&table->mutex, NULL) != 0) {
+    free(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+int flight_join(flight_table *table, const char *key, size_t key_len,
+    flight **f) {
+  if (table == NULL || key == NULL || f == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  size_t hash = hash_key(key, key_len);
+  size_t bucket = hash % FLIGHT_BUCKETS;
+  pthread_mutex_lock(&table->mutex);
+  flight *p = table->flights[bucket];
+  while (p != NULL && (p->hash != hash || p->key_len != key_len
+      || memcmp(p->key, key, key_len) != 0)) {
+    p = p->next;
+  }
+  if (p != NULL) {
+    ++p->refs;
+    ++table->stats.followers;
+    pthread_mutex_unlock(&table->mutex);
+    *f = p;
+    return 0;
+  }
+  if ((p = new_flight(key, key_len, hash)) == NULL) {
+    pthread_mutex_unlock(&table->mutex);
+    return FLIGHT_MEMORY_ERROR;
+  }
+  p->next = table->flights[bucket];
+  table->flights[bucket] = p;
+  ++table->stats.leaders;
+  pthread_mutex_unlock(&table->mutex);
+  *f = p;
+
+  return 1;
+}
+
+int flight_complete(flight_table *table, flight *f, char *data, size_t size) {
+  if (table == NULL || f == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  pthread_mutex_lock(&table->mutex);
+  f->data = data;
+  f->size = size;
+  finish_flight(table, f, FLIGHT_DONE);
+  pthread_mutex_unlock(&table->mutex);
+
+  return 1;
+}
+
+int flight_abort(flight_table *table, flight *f) {
+  if (table == NULL || f == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  pthread_mutex_lock(&table->mutex);
+  ++table->stats.aborted;
+  finish_flight(table, f, FLIGHT_FAILED);
+  pthread_mutex_unlock(&table->mutex);
+
+  return 1;
+}
+
+int flight_wait(flight_table *table, flight *f,
+    const struct timespec *deadline, const char **data, size_t *size) {
+  if (table == NULL || f == NULL || data == NULL || size == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  int r = 1;
+  pthread_mutex_lock(&table->mutex);
+  while (f->state == FLIGHT_RUNNING && r > 0) {
+    int e = deadline == NULL ? pthread_cond_wait(&f->done, &table->mutex)
+        : pthread_cond_timedwait(&f->done, &table->mutex, deadline);
+    if (e == ETIMEDOUT) {
+      r = 0;
+    }
+  }
+  if (f->state == FLIGHT_DONE) {
+    // Une sortie disponible est transmise même si l'échéance vient de
+    // passer
+    *data = f->data != NULL ? f->data : "";
+    *size = f->size;
+    r = 1;
+  } else if (f->state == FLIGHT_FAILED) {
+    r = FLIGHT_ABORTED;
+  }
+  pthread_mutex_unlock(&table->mutex);
+
+  return r;
+}
+
+int flight_release(flight_table *table, flight *f) {
+  if (table == NULL || f == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  pthread_mutex_lock(&table->mutex);
+  put_flight(f);
+  pthread_mutex_unlock(&table->mutex);
+
+  return 1;
+}
+
+int flight_get_stats(flight_table *table, flight_stats *stats) {
+  if (table == NULL || stats == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  pthread_mutex_lock(&table->mutex);
+  *stats = table->stats;
+  pthread_mutex_unlock(&table->mutex);
+
+  return 1;
+}
+
+int flight_dispose(flight_table *table) {
+  if (table == NULL) {
+    return FLIGHT_INVALID_POINTER;
+  }
+  pthread_mutex_destroy(&table->mutex);
+  free(table);
+
+  return 1;
+}
+
+/*
+ * Fonctions outils
+ */
+
+static size_t hash_key(const char *key, size_t n) {
+  size_t h = 14695981039346656037UL;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= (unsigned char) key[i];
+    h *= 1099511628211UL;
+  }
+
+  return h;
+}
+
+static flight *new_flight(const char *key, size_t key_len, size_t hash) {
+  flight *f = calloc(1, sizeof *f);
+  if (f == NULL) {
+    return NULL;
+  }
+  if ((f->key = malloc(MAX(key_len, 1))) == NULL) {
+    free(f);
+    return NULL;
+  }
+  // Les échéances des requêtes sont données sur l'horloge monotone
+  pthread_condattr_t attr;
+  if (pthread_condattr_init(&attr) != 0) {
+    free(f->key);
+    free(f);
+    return NULL;
+  }
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  int e = pthread_cond_init(&f->done, &attr);
+  pthread_condattr_destroy(&attr);
+  if (e != 0) {
+    free(f->key);
+    free(f);
+    return NULL;
+  }
+  memcpy(f->key, key, key_len);
+  f->key_len = key_len;
+  f->hash = hash;
+  f->state = FLIGHT_RUNNING;
+  f->refs = 1;
+
+  return f;
+}
+
+static void finish_flight(flight_table *table, flight *f, int state) {
+  flight **link = &table->flights[f->hash % FLIGHT_BUCKETS];
+  while (*link != NULL && *link != f) {
+    link = &(*link)->next;
+  }
+  if (*link == f) {
+    *link = f->next;
+  }
+  f->state = state;
+  pthread_cond_broadcast(&f->done);
+  put_flight(f);
+}
+
+static void put_flight(flight *f) {
+  if (--f->refs > 0) {
+    return;
+  }
+  pthread_cond_destroy(&f->done);
+  free(f->data);
+  free(f->key);
+  free(f);
+}
@@ -0,0 +1,132 @@
+/**
+ * Table thread-safe des exécutions en cours. La première requête d'une clé
+ * en devient le meneur et exécute la commande ; les requêtes identiques qui
+ * arrivent avant la fin s'y rattachent et reçoivent la même sortie, partagée
+ * sans copie.
+ *
+ * @author Jordan ELIE.
+ */
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <time.h>
+
+/*
+ * Codes d'erreur
+ */
+
+#define FLIGHT_INVALID_POINTER -1
+#define FLIGHT_MEMORY_ERROR -2
+#define FLIGHT_ABORTED -3
+
+typedef struct flight_table flight_table;
+
+/**
+ * Exécution en cours, partagée par son meneur et les requêtes rattachées.
+ */
+typedef struct flight flight;
+
+/**
+ * Compteurs de la table depuis sa création.
+ */
+typedef struct flight_stats {
+  unsigned long leaders;   // Exécutions lancées
+  unsigned long followers; // Requêtes rattachées à une exécution en cours
+  unsigned long aborted;   // Exécutions abandonnées par leur meneur
+} flight_stats;
+
+/**
+ * Créé une table des exécutions en cours.
+ *
+ * @return {flight_table *} La table ou NULL en cas d'erreur.
+ */
+flight_table *flight_create(void);
+
+/**
+ * Rattache l'appelant à l'exécution key de taille key_len si elle est en
+ * cours, sinon l'enregistre et en fait le meneur. L'exécution est stockée
+ * dans *f.
+ *
+ * @param {flight_table *} La table.
+ * @param {const char *} La clé.
+ * @param {size_t} La taille de la clé.
+ * @param {flight **} L'adresse où stocker l'exécution.
+ * @return {int} 1 si l'appelant est le meneur, qui devra appeler
+ *               flight_complete ou flight_abort, 0 s'il est rattaché, et
+ *               devra appeler flight_wait puis flight_release, et une valeur
+ *               négative en cas d'erreur.
+ */
+int flight_join(flight_table *table, const char *key, size_t key_len,
+    flight **f);
+
+/**
+ * Publie la sortie data de taille size de l'exécution f, dont la table
+ * devient propriétaire, puis rend la référence du meneur. Les requêtes
+ * rattachées sont réveillées.
+ *
+ * @param {flight_table *} La table.
+ * @param {flight *} L'exécution.
+ * @param {char *} La sortie, allouée par malloc (NULL si vide).
+ * @param {size_t} Sa taille.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int flight_complete(flight_table *table, flight *f, char *data, size_t size);
+
+/**
+ * Abandonne l'exécution f sans sortie puis rend la référence du meneur. Les
+ * requêtes rattachées sont réveillées et devront exécuter la commande
+ * elles-mêmes.
+ *
+ * @param {flight_table *} La table.
+ * @param {flight *} L'exécution.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int flight_abort(flight_table *table, flight *f);
+
+/**
+ * Attend la fin de l'exécution f, au plus jusqu'à deadline, et stocke sa
+ * sortie dans *data et *size. La sortie reste valable jusqu'à
+ * flight_release.
+ *
+ * @param {flight_table *} La table.
+ * @param {flight *} L'exécution.
+ * @param {const struct timespec *} L'échéance (CLOCK_MONOTONIC, NULL si
+ *                                  aucune).
+ * @param {const char **} L'adresse où stocker la sortie.
+ * @param {size_t *} L'adresse où stocker sa taille.
+ * @return {int} 1 en cas de succès, 0 si l'échéance est dépassée,
+ *               FLIGHT_ABORTED si le meneur a abandonné et une valeur
+ *               négative en cas d'erreur.
+ */
+int flight_wait(flight_table *table, flight *f,
+    const struct timespec *deadline, const char **data, size_t *size);
+
+/**
+ * Rend la référence d'une requête rattachée à f. La sortie est libérée
+ * avec la dernière référence.
+ *
+ * @param {flight_table *} La table.
+ * @param {flight *} L'exécution.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int flight_release(flight_table *table, flight *f);
+
+/**
+ * Copie dans stats les compteurs de la table.
+ *
+ * @param {flight_table *} La table.
+ * @param {flight_stats *} Les compteurs à remplir.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int flight_get_stats(flight_table *table, flight_stats *stats);
+
+/**
+ * Libère la table. Aucune exécution ne doit être en cours.
+ *
+ * @param {flight_table *} La table.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int flight_dispose(flight_table *table);
+
+#endif
@@ -1,17 +1,32 @@
 #define _POSIX_C_SOURCE 200809L
+// Nécessaire à l'affectation des threads aux coeurs
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <semaphore.h>
 #include <unistd.h>
 #include "libs/connection/connection.h"
 #include "libs/commands/commands.h"
+#include "libs/cache/cache.h"
+#include "libs/flight/flight.h"
 #include "libs/list/list.h"
 #include "libs/yml_parser/yml_parser.h"
 
@@ -22,6 +37,126 @@
 #define NOT_ENOUGH_MEMORY -1
 #define THREAD_ERROR -2
 
+/*
+ * Statistiques
+ */
+
+// Nombre de classes de la distribution des tailles de lots de connexions.
+// La classe i compte les lots de taille [2^i, 2^(i+1)[.
+#define BATCH_BUCKETS 16
+
+// Taille du tampon de lecture de la sortie d'une commande (capacité par 
+// défaut d'un tube). read renvoie ce qui est disponible sans attendre que le
+// tampon soit plein : une sortie abondante part en gros morceaux, éligibles
+// à la compression, sans retarder une sortie au compte-gouttes.
+#define STREAM_BUFFER_SIZE 65536
+
+// Nombre maximum d'événements récupérés par un réveil d'une boucle 
+// d'événements
+#define EVENT_BATCH 64
+
+// Délai (En ns) entre deux tentatives d'ouverture de la session d'un client
+// qui n'a pas encore ouvert ses tubes, en mode boucle d'événements
+#define ATTACH_RETRY_DELAY 1000000L
+
+// Taille maximale des listes de la configuration des voies (poids, règles)
+#define LANE_SPEC_MAX 1024
+
+/**
+ * Copie de la sortie d'une commande transmise au client, destinée au cache 
+ * des réponses et aux requêtes identiques rattachées à son exécution.
+ */
+typedef struct output_capture {
+  char *data;
+  size_t size;
+  size_t capacity;
+  size_t max;   // Taille maximale d'une réponse réutilisée
+  int overflow; // Non nul si la sortie a dépassé max : la copie est 
+                // abandonnée
+} output_capture;
+
+// Taille de la clé d'une commande de length octets : utilisateur, dossier
+// courant et commande
+#define REQUEST_KEY_SIZE(length) (sizeof(uid_t) + PATH_MAX + (length) + 1)
+
+// Longueur maximale d'une commande dont la réponse peut être réutilisée : 
+// les tampons de sa clé restent de taille fixe
+#define CACHE_MAX_COMMAND 1024
+
+#define MIN(x, y) (x < y ? x : y)
+#define MAX(x, y) (x > y ? x : y)
+
+// Variable d'environnement donnant au serveur relancé par un redémarrage à 
+// chaud le descripteur de l'état transmis par son prédécesseur
+#define HANDOVER_ENV "SERVER_HANDOVER_FD"
+
+/*
+ * Mode boucle d'événements
+ */
+
+/**
+ * Client connecté au serveur. En mode boucle d'événements, sa session est 
+ * surveillée par epoll et il est confié à un worker à son arrivée (s vaut 
+ * alors NULL), à chaque nouvelle tentative d'ouverture de sa session puis à
+ * chaque fois qu'une requête est prête. Sinon, il est servi par son propre 
+ * thread.
+ */
+typedef struct event_client {
+  shm_request *req; // La requête de connexion stockée dans client_list
+  session *s;
+  struct timespec started; // Acceptation de la requête (CLOCK_MONOTONIC)
+  // Minuteur des tentatives d'ouverture de la session (-1 si aucun) et 
+  // échéance de l'ouverture (CLOCK_MONOTONIC)
+  int attach_fd;
+  struct timespec attach_deadline;
+  // Voisins dans la file des clients prêts d'un worker
+  struct event_client *prev;
+  struct event_client *next;
+  // Voisins dans la liste de tous les clients (live_clients)
+  struct event_client *live_prev;
+  struct event_client *live_next;
+} event_client;
+
+/**
+ * Worker du pool exécutant les commandes prêtes. Chacun sert sa propre file
+ * de clients prêts, du plus ancien au plus récent. Un worker dont la file 
+ * est vide vole le client le plus récent de la file d'un autre avant de 
+ * s'endormir.
+ */
+typedef struct worker {
+  pthread_mutex_t mutex; // Protège la file et les compteurs
+  event_client *head;    // Plus ancien client prêt
+  event_client *tail;    // Plus récent, pris par les voleurs
+  size_t length;
+  size_t max_length;
+  unsigned long tasks;   // Clients traités
+  unsigned long steals;  // Clients volés dans la file d'un autre worker
+  unsigned long long idle_ns; // Temps passé endormi faute de client prêt
+} worker;
+
+/*
+ * Redémarrage à chaud
+ */
+
+/**
+ * En-tête de l'état transmis au nouveau programme, suivi d'un 
+ * handover_record par client.
+ */
+typedef struct handover_header {
+  char shm_name[NAME_MAX + 1]; // La file, qui reste en place
+  size_t nb_clients;
+} handover_header;
+
+/**
+ * Client transmis au nouveau programme.
+ */
+typedef struct handover_record {
+  shm_request req;
+  struct timespec started;
+  int opened; // Non nul si la session est ouverte : fds est alors valide
+  int fds[2]; // Descripteurs hérités (voir session_export)
+} handover_record;
+
 /*
  * Variables externes
  */
@@ -38,14 +173,181 @@ extern int errno;
 int skeleton_dameon();
 
 /**
- * Fonction run du thread traitant la requête request.
+ * Fonction run du thread servant un client, dont la session est ouverte si
+ * nécessaire.
+ * 
+ * @param {void *} Le client (event_client *) à servir.
+ */
+void *handle_request(void *client);
+
+/**
+ * Ouvre la session du client ayant émis la requête req et y active la 
+ * compression selon la configuration.
+ * 
+ * @param {shm_request *} La requête de connexion du client.
+ * @return {session *} La session ou NULL en cas d'erreur.
+ */
+session *open_client_session(shm_request *req);
+
+/**
+ * Exécute la commande cmd, identifiée par id, du client req et lui transmet 
+ * sa sortie sur la session s. La commande exit termine la session.
+ * 
+ * @param {session *} La session du client.
+ * @param {shm_request *} La requête de connexion du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {const char *} La commande à exécuter ou NULL si la requête est 
+ *                       invalide, auquel cas seule une erreur est renvoyée.
+ * @return {int} 1 si la session se poursuit, 0 si elle est terminée (exit ou
+ *               client timeout) et une valeur négative en cas d'erreur.
+ */
+int serve_request(session *s, shm_request *req, unsigned int id, 
+    const char *cmd);
+
+/**
+ * Démarre nb_loops threads de boucle d'événements surveillant les sessions 
+ * via epoll et nb_threads workers exécutant les commandes prêtes.
+ * 
+ * @param {size_t} Le nombre de boucles d'événements.
+ * @param {size_t} Le nombre de workers.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int start_event_loops(size_t nb_loops, size_t nb_threads);
+
+/**
+ * Fonction run d'un thread de boucle d'événements.
+ */
+void *run_event_loop(void *arg);
+
+/**
+ * Fonction run d'un worker, dont l'indice dans le pool est passé en 
+ * argument : ouvre les sessions des nouveaux clients et traite les requêtes
+ * prêtes.
+ */
+void *run_worker(void *arg);
+
+/**
+ * Ajoute le client c à la file des clients prêts d'un worker, choisi à tour
+ * de rôle, et réveille un worker endormi.
+ */
+void push_client(event_client *c);
+
+/**
+ * Retire le plus ancien client de la file du worker self ou, si elle est 
+ * vide, vole le plus récent de la file d'un autre worker. Attend tant 
+ * qu'aucun client n'est prêt. Renvoie NULL pendant un redémarrage à chaud.
+ */
+event_client *pop_client(size_t self);
+
+/**
+ * Retire de la file du worker w son plus ancien client, ou son plus récent
+ * si steal est non nul. Renvoie NULL si la file est vide.
+ */
+event_client *take_client(worker *w, int steal);
+
+/**
+ * Ferme la session du client c, le retire de la liste des clients et le 
+ * libère.
+ */
+void drop_client(event_client *c);
+
+/**
+ * Confie le client c, enregistré dans les listes de clients, à son propre 
+ * thread, ou aux boucles d'événements si elles sont actives et que sa 
+ * session possède un descripteur.
+ * 
+ * @param {event_client *} Le client.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int start_client(event_client *c);
+
+/**
+ * Confie à epoll la surveillance de la session du client c (op vaut 
+ * EPOLL_CTL_ADD ou EPOLL_CTL_MOD), pour une seule requête.
+ * 
+ * @param {event_client *} Le client.
+ * @param {int} L'opération epoll.
+ * @return {int} 1 en cas de succès et -1 en cas d'erreur.
+ */
+int watch_client(event_client *c, int op);
+
+/**
+ * Tente, sans attendre, d'ouvrir la session du client c puis la confie à 
+ * epoll. Si le client n'a pas encore ouvert ses tubes ou sa socket, une 
+ * nouvelle tentative est programmée par un minuteur surveillé par epoll, 
+ * jusqu'à l'échéance de l'ouverture : aucun worker n'attend le client.
+ * 
+ * @param {event_client *} Le client.
+ * @return {int} 1 si la session est ouverte ou une tentative programmée et 
+ *               -1 en cas d'erreur, le client devant alors être abandonné.
+ */
+int attach_client(event_client *c);
+
+/**
+ * Applique à la session s du client req la taille maximale des commandes et
+ * la compression de la configuration, après avoir vérifié l'identité du 
+ * client lorsque le noyau la fournit.
+ * 
+ * @param {session *} La session, fermée en cas d'erreur.
+ * @param {shm_request *} La requête de connexion du client.
+ * @return {session *} s ou NULL en cas d'erreur.
+ */
+session *prepare_client_session(session *s, shm_request *req);
+
+/**
+ * Gestionnaire de SIGHUP : demande un redémarrage à chaud.
+ */
+void sig_restart(int signum);
+
+/**
+ * Fonction run du thread effectuant les redémarrages à chaud demandés.
+ */
+void *run_restart(void *arg);
+
+/**
+ * Redémarre le serveur à chaud : suspend l'acceptation des connexions, 
+ * attend que chaque thread ait terminé la requête en cours puis remplace le
+ * programme par la version installée (exec) en lui transmettant la file et
+ * les sessions ouvertes, qui ne sont pas interrompues. En cas d'échec, le 
+ * serveur reprend son activité.
+ * 
+ * @return {int} Une valeur négative : ne revient qu'en cas d'échec.
+ */
+int hot_restart(void);
+
+/**
+ * Endort le thread appelant, arrivé à un point où il ne sert aucune 
+ * requête, jusqu'à l'abandon du redémarrage à chaud en cours.
+ */
+void wait_handover(void);
+
+/**
+ * Reprend les clients transmis par le serveur précédent dans le descripteur
+ * fd, placé après l'en-tête, puis le ferme. Un client qui ne peut être 
+ * repris est déconnecté sans affecter les autres.
+ * 
+ * @param {int} Le descripteur de l'état transmis.
+ * @param {size_t} Le nombre de clients.
+ * @return {int} 1 en cas de succès et une valeur négative si l'état n'a pu
+ *               être lu en entier.
+ */
+int restore_clients(int fd, size_t nb_clients);
+
+/**
+ * Déconnecte le client transmis record qui n'a pu être repris : ferme les 
+ * descripteurs hérités qui n'appartiennent à aucune session, le prévient 
+ * puis termine sa session.
  * 
- * @param {void *} La requête à traiter.
+ * @param {handover_record *} Le client transmis.
+ * @param {shm_request *} Sa requête dans la liste des clients, NULL si elle
+ *                        n'a pu y être ajoutée.
  */
-void *handle_request(void *request);
+void drop_restored(handover_record *record, shm_request *req);
 
 /**
- * Créé le thread permettant de traiter la requête request.
+ * Créé le thread permettant de traiter la requête request, ou la confie aux
+ * boucles d'événements si elles sont actives et que la session utilise des
+ * tubes nommés.
  * 
  * @param {shm_request *} La requête à traiter.
  * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
@@ -53,16 +355,268 @@ void *handle_request(void *request);
  */
 int allocate_request_ressources(shm_request *request);
 
+/**
+ * Créé les threads traitant chacune des n requêtes du lot batch et met à 
+ * jour la distribution des tailles de lots.
+ * 
+ * @param {shm_request *} Le lot de requêtes à traiter.
+ * @param {size_t} La taille du lot.
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int allocate_batch_ressources(shm_request *batch, size_t n);
+
+/**
+ * Fonction run d'un thread d'acceptation : affecte le thread à son coeur 
+ * puis vide la partition de la file de connexion dont l'indice est passé en
+ * argument. Ne termine qu'en cas d'erreur.
+ */
+void *run_accept_loop(void *arg);
+
+/**
+ * Affecte le thread appelant au i-ème coeur, modulo leur nombre, parmi ceux
+ * sur lesquels le processus peut s'exécuter.
+ * 
+ * @param {size_t} L'indice du coeur.
+ * @return {int} 1 en cas de succès et -1 en cas d'erreur.
+ */
+int pin_to_core(size_t i);
+
+/**
+ * Affiche sur stream la distribution des tailles des lots de connexions 
+ * traités depuis le lancement du serveur.
+ * 
+ * @param {FILE *} Le flux de sortie.
+ */
+void print_batch_stats(FILE *stream);
+
+/**
+ * Affiche sur stream l'issue des attentes sur la file de connexion : 
+ * attentes actives abouties et sommeils, côté serveur et côté clients.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_wait_stats(FILE *stream);
+
+/**
+ * Affiche sur stream, pour chaque voie de la file de connexion, le nombre de
+ * requêtes en attente, acceptées et écartées à l'échéance de leur client, 
+ * ainsi que l'attente moyenne et maximale des requêtes acceptées.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_lane_stats(FILE *stream);
+
+/**
+ * Affiche sur stream la charge publiée dans la file de connexion : sessions
+ * en cours, durée récente d'une session et requêtes refusées.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_load_stats(FILE *stream);
+
+/**
+ * Affiche sur stream le nombre de requêtes de session écartées car leur 
+ * échéance était dépassée avant leur exécution, puis celui des commandes 
+ * interrompues pour l'avoir dépassée.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_deadline_stats(FILE *stream);
+
+/**
+ * Affiche sur stream les compteurs du cache des réponses.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_cache_stats(FILE *stream);
+
+/**
+ * Affiche sur stream le nombre d'exécutions lancées pour des commandes sans
+ * effet de bord et celui des requêtes rattachées à une exécution en cours.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_flight_stats(FILE *stream);
+
+/**
+ * Affiche sur stream, pour chaque worker du pool, le nombre de clients 
+ * traités et volés, la longueur actuelle et maximale de sa file et son 
+ * temps d'inactivité.
+ * 
+ * @param {FILE *} Le flux.
+ */
+void print_worker_stats(FILE *stream);
+
+/**
+ * Retire le client req de la liste des clients et sa session, ouverte à 
+ * l'instant started, de la charge publiée, puis réveille les threads 
+ * d'acceptation qui attendent qu'une session se termine.
+ * 
+ * @param {shm_request *} La requête du client, stockée dans client_list.
+ * @param {const struct timespec *} L'acceptation de la requête 
+ *                                  (CLOCK_MONOTONIC).
+ */
+void end_session(shm_request *req, const struct timespec *started);
+
+/**
+ * Lit dans la configuration le poids des voies (lane_weights) et les règles
+ * d'affectation des utilisateurs (lane_uids) et des groupes (lane_gids), 
+ * données par paires "<identifiant> <voie>", puis les publie dans la file.
+ * 
+ * @return {int} 1 en cas de succès et une valeur négative en cas d'erreur.
+ */
+int configure_lanes(void);
+
+/**
+ * Transmet sur la session s, morceau par morceau, ce que la commande écrit 
+ * sur le tube fd jusqu'à sa fermeture, en réponse à la requête id. Au-delà
+ * de limit octets (-1 si pas de limite), la sortie est lue mais n'est plus 
+ * transmise. L'attente de la sortie s'arrête à l'échéance de la requête.
+ * 
+ * @param {session *} La session du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {int} Le descripteur de lecture de la sortie de la commande.
+ * @param {ssize_t} La taille maximale de la réponse.
+ * @param {const struct timespec *} L'échéance de la requête (NULL si 
+ *                                  aucune).
+ * @param {output_capture *} Si non NULL, reçoit une copie de ce qui est 
+ *                           transmis.
+ * @return {int} 1 en cas de succès, 0 si le client a été timeout, 
+ *               REQUEST_EXPIRED si l'échéance est dépassée et une valeur 
+ *               négative en cas d'erreur.
+ */
+int stream_output(session *s, unsigned int id, int fd, ssize_t limit, 
+    const struct timespec *deadline, output_capture *capture);
+
+/**
+ * Construit dans key, de taille REQUEST_KEY_SIZE(CACHE_MAX_COMMAND), la clé 
+ * de la commande cmd du client req : utilisateur, dossier courant puis 
+ * commande aux espaces normalisés. Les chemins dont dépend sa réponse sont 
+ * stockés dans paths et pointent dans tokens, de taille 
+ * CACHE_MAX_COMMAND + 1. Une commande plus longue n'est jamais réutilisée.
+ * 
+ * @param {shm_request *} La requête de connexion du client.
+ * @param {const char *} La commande.
+ * @param {char *} La clé.
+ * @param {size_t *} L'adresse où stocker la taille de la clé.
+ * @param {char *} Le tampon des chemins.
+ * @param {const char **} Les chemins (au plus CACHE_MAX_PATHS).
+ * @param {size_t *} L'adresse où stocker le nombre de chemins.
+ * @return {int} La politique de cache de la commande, CACHE_POLICY_NEVER si
+ *               sa réponse ne peut pas être réutilisée.
+ */
+int request_key(shm_request *req, const char *cmd, char *key, 
+    size_t *key_len, char *tokens, const char **paths, size_t *nb_paths);
+
+/**
+ * Rattache la requête id à l'exécution en cours de la commande de clé key 
+ * et lui transmet sa sortie une fois disponible. Si aucune n'est en cours, 
+ * l'appelant devient le meneur d'une nouvelle exécution, stockée dans *f.
+ * Si son meneur l'abandonne, l'appelant exécute la commande seul.
+ * 
+ * @param {session *} La session du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {const char *} La clé de la commande.
+ * @param {size_t} La taille de la clé.
+ * @param {const struct timespec *} L'échéance de la requête (NULL si 
+ *                                  aucune).
+ * @param {ssize_t} La taille maximale de la réponse.
+ * @param {flight **} L'adresse où stocker l'exécution à mener (NULL si 
+ *                    aucune).
+ * @param {int *} L'adresse où stocker le résultat de l'envoi de la réponse.
+ * @return {int} 1 si la requête a reçu sa réponse et 0 si l'appelant doit 
+ *               exécuter la commande.
+ */
+int follow_flight(session *s, unsigned int id, const char *key, 
+    size_t key_len, const struct timespec *deadline, ssize_t res_max, 
+    flight **f, int *r);
+
+/**
+ * Exécute dans le thread appelant la commande personnalisée cmd du client 
+ * req, en réponse à la requête id, puis transmet sa sortie sur la session s.
+ * La sortie complète est enregistrée dans le cache (pending) et partagée 
+ * avec les requêtes rattachées à l'exécution f.
+ * 
+ * @param {session *} La session du client.
+ * @param {shm_request *} La requête de connexion du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {const char *} La commande.
+ * @param {ssize_t} La taille maximale de la réponse.
+ * @param {cache_pending *} La réservation du cache (NULL si aucune).
+ * @param {flight *} L'exécution menée (NULL si aucune).
+ * @return {int} 1 en cas de succès, 0 si le client a été timeout et une 
+ *               valeur négative en cas d'erreur.
+ */
+int serve_custom_command(session *s, shm_request *req, unsigned int id, 
+    const char *cmd, ssize_t res_max, cache_pending *pending, flight *f);
+
+/**
+ * Lit sur le tube fd au plus limit octets de la sortie d'une commande, les 
+ * transmet sur la session s comme morceau de la réponse à la requête id et 
+ * en ajoute une copie à capture.
+ * 
+ * @param {session *} La session du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {int} Le descripteur de lecture de la sortie de la commande.
+ * @param {size_t} Le nombre maximum d'octets à lire.
+ * @param {size_t *} L'adresse où stocker le nombre d'octets transmis (0 à 
+ *                   la fermeture du tube).
+ * @param {output_capture *} La copie de la sortie.
+ * @return {int} 1 en cas de succès, 0 si le client a été timeout et une 
+ *               valeur négative en cas d'erreur.
+ */
+int capture_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *forwarded, output_capture *capture);
+
+/**
+ * Transmet sur la session s les size octets de data en réponse à la requête
+ * id.
+ * 
+ * @param {session *} La session du client.
+ * @param {unsigned int} L'identifiant de la requête.
+ * @param {const char *} La réponse.
+ * @param {size_t} Sa taille.
+ * @return {int} 1 en cas de succès, 0 si le client a été timeout et une 
+ *               valeur négative en cas d'erreur.
+ */
+int send_cached_response(session *s, unsigned int id, const char *data, 
+    size_t size);
+
+/**
+ * Attend que le tube fd ait des données ou soit fermé, au plus tard jusqu'à
+ * l'échéance deadline.
+ * 
+ * @param {int} Le descripteur.
+ * @param {const struct timespec *} L'échéance (NULL si aucune).
+ * @return {int} 1 si le tube est prêt, REQUEST_EXPIRED si l'échéance est 
+ *               dépassée et -1 en cas d'erreur.
+ */
+int wait_output(int fd, const struct timespec *deadline);
+
+/**
+ * Renvoie le temps restant avant l'échéance deadline (CLOCK_MONOTONIC), en
+ * millisecondes, ou une valeur négative ou nulle si elle est dépassée.
+ */
+long long remaining_ms(const struct timespec *deadline);
+
 /**
  * Compare 2 requêtes.
  */
 int request_cmp(shm_request *a, shm_request *b);
 
 /**
- * Libère les ressources du serveur en cas d'interruption par un signal.
+ * Gestionnaire de SIGINT, SIGQUIT, SIGTERM et SIGPIPE : demande l'arrêt du 
+ * serveur, effectué par un thread dédié (SIGPIPE est ignoré).
  */
 void sig_free(int signum);
 
+/**
+ * Fonction run du thread arrêtant le serveur à la demande de sig_free : 
+ * affiche les statistiques puis libère les clients et les ressources du 
+ * serveur.
+ */
+void *run_shutdown(void *arg);
+
 /**
  * Libère les clients connectés au serveur en envoyant une réponse de 
  * terminaison.
@@ -85,9 +639,91 @@ list *client_list = NULL;
 // Parseur de fichier yml pour la configuration du serveur
 yml_parser *config = NULL;
 // Indique si le serveur est un démon
-int daemon = 0;
+int is_daemon = 0;
 // Timeout de réponse du serveur
 int res_timeout = 5;
+// Nombre maximum de connexions acceptées par réveil du serveur
+int accept_batch = 64;
+// Nombre de partitions de la file de connexion, chacune vidée par son propre
+// thread (0 : une par coeur)
+int queue_shards = 0;
+// Nombre de voies de priorité de la file de connexion
+int lanes = 1;
+// Voie des clients qu'aucune règle ne concerne
+int default_lane = 0;
+// Nombre maximum de sessions menées de front (0 : pas de limite). Au-delà,
+// les requêtes patientent dans la file et les clients sont refusés dès que
+// leur attente estimée dépasse leur timeout.
+int max_sessions = 0;
+// Réveille les threads d'acceptation à la fin d'une session
+pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sessions_cond = PTHREAD_COND_INITIALIZER;
+// Coeurs sur lesquels le processus peut s'exécuter. Les threads des clients
+// ne restent pas sur le coeur de leur thread d'acceptation.
+cpu_set_t process_cpus;
+// Taille à partir de laquelle un morceau de réponse est compressé (-1 si la
+// compression est désactivée)
+int compress_threshold = 16384;
+// Taille maximale d'une commande reçue sur une session
+int request_max = DEFAULT_REQUEST_MAX;
+// Taille de sortie à partir de laquelle le reste de la réponse est transmis
+// par fichier en mémoire aux clients qui le supportent (-1 pour désactiver),
+// et taille maximale de chacun de ces fichiers
+int memfd_threshold = 1048576;
+int memfd_max = 4194304;
+// Cache des réponses des commandes sans effet de bord (NULL si désactivé)
+// et dossier courant des commandes, qui fait partie de la clé
+response_cache *cache = NULL;
+char server_cwd[PATH_MAX];
+// Exécutions en cours des commandes sans effet de bord, auxquelles se 
+// rattachent les requêtes identiques (NULL si désactivé), et taille 
+// maximale d'une sortie partagée
+flight_table *flights = NULL;
+size_t coalesce_max = 0;
+// Nombre de threads de boucle d'événements (0 : un thread par client)
+int event_loops = 1;
+// Nombre de workers exécutant les commandes en mode boucle d'événements (0 :
+// un par coeur)
+int workers = 0;
+// Instance epoll partagée par les boucles d'événements
+int epoll_fd = -1;
+// Pool des workers et prochain worker recevant un client prêt
+worker *pool = NULL;
+size_t pool_size = 0;
+atomic_size_t next_worker;
+// Clients prêts dans l'ensemble des files. Les workers endormis attendent 
+// pool_cond, signalée lorsqu'un client est ajouté.
+atomic_size_t ready_clients;
+size_t idle_workers = 0;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+// Distribution des tailles des lots de connexions, tous threads 
+// d'acceptation confondus
+atomic_size_t batch_sizes[BATCH_BUCKETS];
+// Requêtes de session expirées avant leur exécution et commandes 
+// interrompues à leur échéance
+atomic_ulong expired_before_start;
+atomic_ulong expired_during_run;
+// Liste de tous les clients, transmis lors d'un redémarrage à chaud
+event_client *live_clients = NULL;
+pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Programme relancé lors d'un redémarrage à chaud (SIGHUP)
+char server_path[PATH_MAX];
+char queue_name[NAME_MAX + 1];
+sem_t restart_sem;
+// Arrêt demandé par un signal, effectué par un thread dédié car les 
+// statistiques et la libération des ressources prennent des verrous
+sem_t shutdown_sem;
+volatile sig_atomic_t shutdown_signal = 0;
+// Non nul pendant un redémarrage à chaud : les threads pouvant servir une 
+// requête s'endorment un à un et handover_fd devient lisible afin de 
+// réveiller ceux qui attendent une requête.
+atomic_int handing_over = 0;
+int handover_fd = -1;
+size_t parkable_threads = 0;
+size_t parked_threads = 0;
+pthread_mutex_t handover_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t handover_cond = PTHREAD_COND_INITIALIZER;
 
 int main(void) {
   // Création de la liste des clients où l'on stockera les pipes de réponse
@@ -110,11 +746,37 @@ int main(void) {
     return EXIT_FAILURE;
   }
   get(config, "res_timeout", &res_timeout);
-  get(config, "daemon", &daemon);
-  if (daemon != 0) {
+  get(config, "accept_batch", &accept_batch);
+  get(config, "queue_shards", &queue_shards);
+  get(config, "lanes", &lanes);
+  get(config, "default_lane", &default_lane);
+  get(config, "max_sessions", &max_sessions);
+  get(config, "compress_threshold", &compress_threshold);
+  get(config, "request_max", &request_max);
+  request_max = MIN(MAX(request_max, MAX_COMMAND_LENGTH), REQUEST_MAX_LIMIT);
+  get(config, "memfd_threshold", &memfd_threshold);
+  get(config, "memfd_max", &memfd_max);
+  get(config, "event_loops", &event_loops);
+  get(config, "workers", &workers);
+  int cache_max_bytes = 0;
+  int cache_ttl_ms = 1000;
+  get(config, "cache_max_bytes", &cache_max_bytes);
+  get(config, "cache_ttl_ms", &cache_ttl_ms);
+  int coalesce_max_bytes = 0;
+  get(config, "coalesce_max_bytes", &coalesce_max_bytes);
+  get(config, "daemon", &is_daemon);
+  // Un serveur relancé à chaud est déjà détaché du terminal
+  const char *handover = getenv(HANDOVER_ENV);
+  int handover_state = handover != NULL ? atoi(handover) : -1;
+  unsetenv(HANDOVER_ENV);
+  if (is_daemon != 0 && handover_state < 0) {
     skeleton_dameon();
   }
   // Gestion des signaux
+  if (sem_init(&shutdown_sem, 0, 0) < 0) {
+    perror("Impossible de préparer l'arrêt du serveur ");
+    return EXIT_FAILURE;
+  }
   struct sigaction action;
   action.sa_handler = sig_free;
   action.sa_flags = 0;
@@ -139,29 +801,200 @@ int main(void) {
     perror("Erreur lors de l'association d'une action aux signaux ");
     return EXIT_FAILURE;
   }
+  // SIGHUP déclenche un redémarrage à chaud, effectué par un thread dédié
+  if (sem_init(&restart_sem, 0, 0) < 0 
+      || (handover_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    perror("Impossible de préparer le redémarrage à chaud ");
+    return EXIT_FAILURE;
+  }
+  ssize_t path_length = readlink("/proc/self/exe", server_path, 
+      sizeof(server_path) - 1);
+  server_path[path_length > 0 ? path_length : 0] = '\0';
+  action.sa_handler = sig_restart;
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGHUP, &action, NULL) == -1) {
+    perror("Erreur lors de l'association d'une action aux signaux ");
+    return EXIT_FAILURE;
+  }
 
-  // Mise en place de la mémoire partagée et la remplit avec une file
+  // Mise en place de la mémoire partagée et la remplit avec une file, 
+  // partitionnée par défaut selon le nombre de coeurs
   int nb_slots;
   get(config, "slots", &nb_slots);
-  server_q = init_server_queue((size_t) nb_slots);
+  char shm_prefix[NAME_MAX + 1];
+  char shm_name[NAME_MAX + 1] = SHM_NAME;
+  if (get(config, "shm_name", shm_prefix) > 0) {
+    snprintf(shm_name, sizeof(shm_name), "/%.*s", NAME_MAX - 1, shm_prefix);
+  }
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &process_cpus) < 0) {
+    perror("sched_getaffinity ");
+    return EXIT_FAILURE;
+  }
+  size_t nb_shards = queue_shards > 0 ? (size_t) queue_shards 
+      : (size_t) CPU_COUNT(&process_cpus);
+  handover_header header;
+  if (handover_state >= 0) {
+    // La file du serveur précédent reste en place avec ses requêtes : sa 
+    // géométrie prime sur la configuration
+    if (read(handover_state, &header, sizeof(header)) 
+        != (ssize_t) sizeof(header)) {
+      perror("Impossible de lire l'état du serveur précédent ");
+      return EXIT_FAILURE;
+    }
+    header.shm_name[NAME_MAX] = '\0';
+    strcpy(queue_name, header.shm_name);
+    server_q = connect(queue_name);
+    nb_shards = get_nb_shards(server_q);
+  } else {
+    strcpy(queue_name, shm_name);
+    server_q = init_server_queue(shm_name, nb_shards, 
+        (size_t) MIN(MAX(lanes, 1), MAX_LANES), (size_t) nb_slots);
+  }
   if (server_q == NULL) {
     perror("Une erreur est survenue lors du chargement du SHM ");
     return EXIT_FAILURE;
   }
+  // Les clients y lisent la taille maximale de leurs commandes et la voie 
+  // qui leur est réservée
+  set_request_max(server_q, (size_t) request_max);
+  set_max_sessions(server_q, (size_t) MAX(max_sessions, 0));
+  char mode[LANE_SPEC_MAX];
+  if (get(config, "queue_mode", mode) > 0 
+      && set_queue_mode(server_q, (mode_t) strtoul(mode, NULL, 8)) < 0) {
+    perror("Impossible de fixer les permissions de la file ");
+    free_server_queue(server_q);
+    return EXIT_FAILURE;
+  }
+  if (configure_lanes() < 0) {
+    perror("Configuration des voies de la file invalide ");
+    free_server_queue(server_q);
+    return EXIT_FAILURE;
+  }
+
+  // Les réponses des commandes sans effet de bord sont réutilisées
+  if ((cache_max_bytes > 0 || coalesce_max_bytes > 0) 
+      && getcwd(server_cwd, sizeof(server_cwd)) == NULL) {
+    perror("getcwd ");
+    return EXIT_FAILURE;
+  }
+  if (cache_max_bytes > 0 && (cache = cache_create((size_t) cache_max_bytes, 
+      (long) cache_ttl_ms)) == NULL) {
+    perror("Impossible de créer le cache des réponses ");
+    return EXIT_FAILURE;
+  }
+  // Et partagées entre les requêtes identiques simultanées
+  if (coalesce_max_bytes > 0) {
+    if ((flights = flight_create()) == NULL) {
+      perror("Impossible de créer la table des exécutions en cours ");
+      return EXIT_FAILURE;
+    }
+    coalesce_max = (size_t) coalesce_max_bytes;
+  }
+
+  // Démarre les boucles d'événements et leurs workers
+  if (event_loops > 0 && start_event_loops((size_t) event_loops, 
+      workers > 0 ? (size_t) workers : (size_t) CPU_COUNT(&process_cpus)) 
+      < 0) {
+    perror("Impossible de démarrer les boucles d'événements ");
+    return EXIT_FAILURE;
+  }
+  // Les clients qui ne peuvent être repris sont déconnectés : le serveur 
+  // continue pour les autres
+  if (handover_state >= 0 
+      && restore_clients(handover_state, header.nb_clients) < 0) {
+    perror("Impossible de reprendre tous les clients du serveur précédent ");
+  }
+
+  // Lancement du serveur : une boucle d'acceptation par partition, celle de
+  // la partition 0 s'exécutant dans le thread principal
+  pthread_mutex_lock(&handover_mutex);
+  parkable_threads += nb_shards;
+  pthread_mutex_unlock(&handover_mutex);
+  pthread_t restart_thread;
+  if (pthread_create(&restart_thread, NULL, run_restart, NULL) != 0 
+      || pthread_detach(restart_thread) != 0) {
+    perror("Impossible de démarrer le thread de redémarrage ");
+    return EXIT_FAILURE;
+  }
+  pthread_t shutdown_thread;
+  if (pthread_create(&shutdown_thread, NULL, run_shutdown, NULL) != 0 
+      || pthread_detach(shutdown_thread) != 0) {
+    perror("Impossible de démarrer le thread d'arrêt ");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 1; i < nb_shards; ++i) {
+    pthread_t accept_thread;
+    if (pthread_create(&accept_thread, NULL, run_accept_loop, 
+        (void *) (uintptr_t) i) != 0 || pthread_detach(accept_thread) != 0) {
+      perror("Impossible de démarrer les threads d'acceptation ");
+      return EXIT_FAILURE;
+    }
+  }
+  fprintf(stdout, "File des requêtes %s (%zu partition(s)). "
+      "Ecoute des requêtes en cours :\n----------\n", 
+      handover_state >= 0 ? "reprise" : "initialisée", nb_shards);
+  run_accept_loop((void *) (uintptr_t) 0);
+
+  return EXIT_FAILURE;
+}
 
-  // Lancement du serveur
-  fprintf(stdout, "File des requêtes initialisée. "
-      "Ecoute des requêtes en cours :\n----------\n");
+void *run_accept_loop(void *arg) {
+  size_t shard = (size_t) (uintptr_t) arg;
+  if (pin_to_core(shard) < 0) {
+    fprintf(stderr, "Impossible d'affecter la partition %zu à un coeur\n", 
+        shard);
+  }
   while (1) {
-    // Dès qu'une connexion entre on la traite
-    if (fetch_shm_request(server_q, allocate_request_ressources) < 0) {
+    // Pendant un redémarrage à chaud, les requêtes restent dans la file 
+    // pour le serveur suivant
+    if (atomic_load(&handing_over)) {
+      wait_handover();
+      continue;
+    }
+    // Les requêtes au-delà du nombre maximum de sessions restent dans la 
+    // file, où les clients voient la charge et renoncent à temps
+    size_t room = (size_t) accept_batch;
+    if (max_sessions > 0) {
+      queue_load load;
+      pthread_mutex_lock(&sessions_mutex);
+      while (get_queue_load(server_q, &load) > 0 && !atomic_load(&handing_over)
+          && load.active_sessions >= (size_t) max_sessions) {
+        pthread_cond_wait(&sessions_cond, &sessions_mutex);
+      }
+      pthread_mutex_unlock(&sessions_mutex);
+      if (load.active_sessions >= (size_t) max_sessions) {
+        continue;
+      }
+      room = MIN(room, (size_t) max_sessions - load.active_sessions);
+    }
+    // Dès que des connexions entrent on traite toutes celles en attente
+    if (fetch_shm_requests(server_q, shard, allocate_batch_ressources, 
+        room) < 0) {
       fprintf(stderr, "Impossible de traiter la requête\n");
-      return EXIT_FAILURE;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  return NULL;
+}
+
+int pin_to_core(size_t i) {
+  int nb_cpus = CPU_COUNT(&process_cpus);
+  if (nb_cpus <= 0) {
+    return -1;
+  }
+  i %= (size_t) nb_cpus;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &process_cpus) && i-- == 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), 
+          &set) == 0 ? 1 : -1;
     }
-    fprintf(stdout, "Une connexion a été établie avec un client\n");
   }
 
-  return EXIT_SUCCESS;
+  return -1;
 }
 
 int skeleton_dameon() {
@@ -206,9 +1039,61 @@ int allocate_request_ressources(shm_request *request) {
   if (r == NULL) {
     return NOT_ENOUGH_MEMORY;
   }
-  // Créer le thread et passe la requête dupliquée en paramètre et le détache
+  add_active_session(server_q);
+  event_client *c = malloc(sizeof *c);
+  if (c == NULL) {
+    end_session(r, NULL);
+    return NOT_ENOUGH_MEMORY;
+  }
+  c->req = r;
+  c->s = NULL;
+  clock_gettime(CLOCK_MONOTONIC, &c->started);
+  c->attach_fd = -1;
+  c->attach_deadline = c->started;
+  c->attach_deadline.tv_sec += res_timeout;
+  pthread_mutex_lock(&clients_mutex);
+  c->live_prev = NULL;
+  c->live_next = live_clients;
+  if (live_clients != NULL) {
+    live_clients->live_prev = c;
+  }
+  live_clients = c;
+  pthread_mutex_unlock(&clients_mutex);
+
+  return start_client(c);
+}
+
+int start_client(event_client *c) {
+  // Les anneaux n'offrent pas de descripteur à surveiller : leurs sessions
+  // gardent un thread dédié.
+  if (event_loops > 0 && c->req->transport != TRANSPORT_SHM_RING) {
+    if (c->s == NULL) {
+      push_client(c);
+      return 1;
+    }
+    if (watch_client(c, EPOLL_CTL_ADD) < 0) {
+      perror("epoll_ctl ");
+      drop_client(c);
+    }
+    return 1;
+  }
+  // Créer le thread et lui passe le client puis le détache. Il peut 
+  // s'exécuter sur tous les coeurs du processus.
+  pthread_attr_t attr;
+  if (pthread_attr_init(&attr) != 0) {
+    return THREAD_ERROR;
+  }
+  pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &process_cpus);
+  pthread_mutex_lock(&handover_mutex);
+  ++parkable_threads;
+  pthread_mutex_unlock(&handover_mutex);
   pthread_t request_thread;
-  if (pthread_create(&request_thread, NULL, handle_request, r) != 0) {
+  int created = pthread_create(&request_thread, &attr, handle_request, c);
+  pthread_attr_destroy(&attr);
+  if (created != 0) {
+    pthread_mutex_lock(&handover_mutex);
+    --parkable_threads;
+    pthread_mutex_unlock(&handover_mutex);
     return THREAD_ERROR;
   }
   if (pthread_detach(request_thread) != 0) {
@@ -218,136 +1103,1017 @@ int allocate_request_ressources(shm_request *request) {
   return 1;
 }
 
-void *handle_request(void *request) {
-  shm_request *req = (shm_request *) request;
-  // Récupère la taille maximale des requêtes dans la configuration
-  int res_max = -1;
+void *handle_request(void *client) {
+  event_client *c = (event_client *) client;
+  // Ouvre les tubes du client pour toute la durée de la session, sauf si 
+  // elle a été reprise d'un serveur précédent
+  if (c->s == NULL && (c->s = open_client_session(c->req)) == NULL) {
+    drop_client(c);
+    goto exit;
+  }
+  // Ecoute les requêtes. Le client peut en avoir envoyé plusieurs sans 
+  // attendre : elles patientent dans la session et sont traitées dans 
+  // l'ordre, chaque réponse reprenant l'identifiant de sa requête. Entre 
+  // deux requêtes, le thread peut s'effacer devant un redémarrage à chaud.
+  unsigned int req_id;
+  char *cmd;
+  int r;
+  while (1) {
+    if ((r = session_wait_request(c->s, handover_fd)) == 0) {
+      wait_handover();
+      continue;
+    }
+    if (r > 0 && (r = session_listen_request(c->s, &req_id, &cmd, 
+        (time_t) res_timeout)) == 0) {
+      break;
+    }
+    if (r < 0 && r != INVALID_REQUEST) {
+      perror("Erreur lors de la lecture d'une requete ");
+      break;
+    }
+    if (serve_request(c->s, c->req, req_id, r > 0 ? cmd : NULL) <= 0) {
+      break;
+    }
+  }
+  drop_client(c);
+exit:
+  pthread_mutex_lock(&handover_mutex);
+  --parkable_threads;
+  pthread_cond_broadcast(&handover_cond);
+  pthread_mutex_unlock(&handover_mutex);
+  return NULL;
+}
+
+void end_session(shm_request *req, const struct timespec *started) {
+  // Une session qui n'a pas démarré ne compte pas dans la durée récente
+  unsigned long long service_ns = 0;
+  if (started != NULL) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    service_ns = (unsigned long long) (now.tv_sec - started->tv_sec) 
+        * 1000000000ULL + (unsigned long long) now.tv_nsec 
+        - (unsigned long long) started->tv_nsec;
+  }
+  pid_t pid = req->pid;
+  if (list_remove(client_list, req) <= 0) {
+    fprintf(stderr, 
+        "Impossible d'enlever le client %d de la liste des clients\n", pid);
+  }
+  pthread_mutex_lock(&sessions_mutex);
+  remove_active_session(server_q, service_ns);
+  pthread_cond_broadcast(&sessions_cond);
+  pthread_mutex_unlock(&sessions_mutex);
+}
+
+session *open_client_session(shm_request *req) {
+  session *s = accept_session(req, (time_t) res_timeout);
+  if (s == NULL) {
+    perror("Impossible d'ouvrir la session du client ");
+    return NULL;
+  }
+
+  return prepare_client_session(s, req);
+}
+
+session *prepare_client_session(session *s, shm_request *req) {
+  // Lorsque le noyau fournit l'identité du client, elle prime sur celle 
+  // déclarée dans la requête
+  pid_t pid;
+  uid_t uid;
+  if (session_peer_credentials(s, &pid, &uid) > 0 
+      && (pid != req->pid || uid != req->uid)) {
+    fprintf(stderr, "Identité du client %d invalide (pid %d, uid %d)\n", 
+        req->pid, pid, uid);
+    close_session(s);
+    return NULL;
+  }
+  session_set_request_max(s, (size_t) request_max);
+  // Compresse les réponses volumineuses si le client sait les décompresser
+  if (compress_threshold >= 0) {
+    session_enable_compression(s, (size_t) compress_threshold);
+  }
+
+  return s;
+}
+
+int serve_request(session *s, shm_request *req, unsigned int id, 
+    const char *cmd) {
+  // Récupère la taille maximale des requêtes dans la configuration
+  int res_max = -1;
   get(config, "response_limit", &res_max);
-  // Ecoute la requête
-  char req_buffer[MAX_COMMAND_LENGTH + 1];
-  if (listen_request(req->request_pipe, req_buffer) < 0) {
-    perror("Erreur lors de la lecture d'une requete ");
-    send_response(req->response_pipe, "Erreur lors de la récéption de la "
-        "requête\n", (ssize_t) res_max, (time_t) res_timeout);
-    goto remove;
+  if (cmd == NULL) {
+    perror("Requête invalide ");
+    int r = session_send_response(s, id, 
+        "Requête invalide ou trop longue\n", (ssize_t) res_max, 
+        (time_t) res_timeout);
+    if (r < 0) {
+      perror("Impossible d'envoyer la réponse au client ");
+    }
+    return r;
+  }
+  if (strcmp(cmd, "exit") == 0) {
+    if (session_send_response(s, id, "Déconnexion du serveur...\n", 
+        (ssize_t) res_max, (time_t) res_timeout) < 0) {
+      perror("Impossible d'envoyer la réponse au client ");
+    }
+    return 0;
   }
+  // Le client a déjà renoncé à la réponse : la commande n'est pas exécutée
+  struct timespec deadline;
+  int has_deadline = session_request_deadline(s, &deadline) > 0;
+  if (has_deadline && remaining_ms(&deadline) <= 0) {
+    atomic_fetch_add(&expired_before_start, 1);
+    int r = session_send_response(s, id, "Echéance de la requête dépassée\n",
+        (ssize_t) res_max, (time_t) res_timeout);
+    if (r < 0) {
+      perror("Impossible d'envoyer la réponse au client ");
+    }
+    return r;
+  }
+  // La réponse d'une commande sans effet de bord est réutilisée
+  char key[REQUEST_KEY_SIZE(CACHE_MAX_COMMAND)];
+  char tokens[CACHE_MAX_COMMAND + 1];
+  const char *paths[CACHE_MAX_PATHS];
+  size_t key_len = 0;
+  size_t nb_paths = 0;
+  int policy = CACHE_POLICY_NEVER;
+  if (cache != NULL || flights != NULL) {
+    policy = request_key(req, cmd, key, &key_len, tokens, paths, &nb_paths);
+  }
+  cache_pending *pending = NULL;
+  flight *f = NULL;
+  if (policy != CACHE_POLICY_NEVER) {
+    // Déjà exécutée : elle n'est pas relancée
+    char *cached;
+    size_t cached_size;
+    if (cache != NULL 
+        && cache_lookup(cache, key, key_len, &cached, &cached_size) > 0) {
+      int r = send_cached_response(s, id, cached, 
+          res_max >= 0 ? MIN(cached_size, (size_t) res_max) : cached_size);
+      free(cached);
+      if (r < 0) {
+        perror("Impossible d'envoyer la réponse au client ");
+      }
+      return r;
+    }
+    // En cours d'exécution pour un autre client : sa sortie est attendue
+    int r;
+    if (follow_flight(s, id, key, key_len, has_deadline ? &deadline : NULL, 
+        (ssize_t) res_max, &f, &r) > 0) {
+      return r;
+    }
+    if (cache != NULL) {
+      pending = cache_begin(cache, key, key_len, 
+          policy == CACHE_POLICY_TTL ? NULL : paths, nb_paths);
+    }
+  }
+  // Les commandes personnalisées s'exécutent dans le thread, sans fork : 
+  // seules les commandes usuelles et ccp, dont la durée n'est pas bornée, 
+  // passent par un processus interrompu à l'échéance
+  if (is_custom_command(cmd)) {
+    return serve_custom_command(s, req, id, cmd, (ssize_t) res_max, pending,
+        f);
+  }
+  // La copie doit pouvoir servir au cache comme aux requêtes rattachées
+  size_t capture_max = f != NULL ? coalesce_max : 0;
+  output_capture capture = { 
+    .data = NULL, 
+    .size = 0, 
+    .capacity = 0, 
+    .max = MAX(cache_max_entry(cache), capture_max), 
+    .overflow = 0 
+  };
   int tube[2];
-  while (strcmp(req_buffer, "exit") != 0) {
-    if (pipe(tube) < 0) {
-      perror("pipe ");
-      fprintf(stderr, "Impossible de relier la commande et la réponse\n");
-      goto remove;
-    }
-    char *res_buffer = NULL;
-    ssize_t n = 0;
-    size_t total = 0;
-    switch (fork()) {
-      case -1:
-        perror("fork ");
-        send_response(req->response_pipe, "Erreur lors de l'exécution de la "
-            "commande\n", (ssize_t) res_max, (time_t) res_timeout);
-        goto remove;
-      case 0:
-        fflush(stdout);
-        fflush(stderr);
-        if (dup2(tube[1], STDOUT_FILENO) < 0) {
-          perror("dup2 ");
-          fprintf(stderr, "Impossible de relier la commande et la réponse\n");
-          return NULL;
-        }
-        if (dup2(tube[1], STDERR_FILENO) < 0) {
-          perror("dup2 ");
-          fprintf(stderr, "Impossible de relier la commande et la réponse\n");
-          return NULL;
-        }
-        if (close(tube[0]) < 0) {
-          perror("close ");
-          fprintf(stderr, "Erreur lors de l'exécution de la commande.\n");
-          return NULL;
-        }
-        if (exec_cmd(req_buffer, req) < 0) {
-          fprintf(stderr, "Erreur lors de l'exécution de la commande.\n");
-        }
-        return NULL;
-      default:
-        if (close(tube[1]) < 0) {
-          perror("close ");
-          send_response(req->response_pipe, "Erreur lors de l'exécution "
-              "de la commande\n", (ssize_t) res_max, (time_t) res_timeout);
-        }
-        // Attend la mort du processus enfant
-        wait(NULL);
-        do {
-          total += (size_t) n;
-          res_buffer = realloc(res_buffer, total + PIPE_BUF + 1);
-          if (res_buffer == NULL) {
-            send_response(req->response_pipe, "Erreur lors de l'exécution "
-                "de la commande\n", (ssize_t) res_max, (time_t) res_timeout);
-            goto remove;
-          }
-        } while ((n = read(tube[0], res_buffer + total, PIPE_BUF)) > 0);
-        if (n == -1) {
-          perror("read ");
-          send_response(req->response_pipe, "Erreur lors de la liaison "
-              "entre la commande et la réponse\n", (ssize_t) res_max, 
-              (time_t) res_timeout);
-        }
-        res_buffer[total] = '\0';
-        if (close(tube[0]) < 0) {
-          perror("Impossible de fermer tube 0 : ");
-          goto remove;
-        }
-        int r = send_response(req->response_pipe, res_buffer, (ssize_t) res_max,
+  if (pipe(tube) < 0) {
+    perror("pipe ");
+    fprintf(stderr, "Impossible de relier la commande et la réponse\n");
+    if (pending != NULL) {
+      cache_commit(cache, pending, NULL, 0);
+    }
+    if (f != NULL) {
+      flight_abort(flights, f);
+    }
+    return -1;
+  }
+  pid_t pid;
+  int r;
+  switch (pid = fork()) {
+    case -1:
+      perror("fork ");
+      session_send_response(s, id, "Erreur lors de l'exécution de la "
+          "commande\n", (ssize_t) res_max, (time_t) res_timeout);
+      close(tube[0]);
+      close(tube[1]);
+      if (pending != NULL) {
+        cache_commit(cache, pending, NULL, 0);
+      }
+      if (f != NULL) {
+        flight_abort(flights, f);
+      }
+      return -1;
+    case 0:
+      // La commande et les processus qu'elle lance forment un groupe, 
+      // interrompu en bloc à l'échéance
+      setpgid(0, 0);
+      fflush(stdout);
+      fflush(stderr);
+      if (dup2(tube[1], STDOUT_FILENO) < 0) {
+        perror("dup2 ");
+        fprintf(stderr, "Impossible de relier la commande et la réponse\n");
+        exit(EXIT_FAILURE);
+      }
+      if (dup2(tube[1], STDERR_FILENO) < 0) {
+        perror("dup2 ");
+        fprintf(stderr, "Impossible de relier la commande et la réponse\n");
+        exit(EXIT_FAILURE);
+      }
+      if (close(tube[0]) < 0) {
+        perror("close ");
+        fprintf(stderr, "Erreur lors de l'exécution de la commande.\n");
+        exit(EXIT_FAILURE);
+      }
+      if (exec_cmd(cmd, req) < 0) {
+        fprintf(stderr, "Erreur lors de l'exécution de la commande.\n");
+      }
+      exit(EXIT_SUCCESS);
+    default:
+      setpgid(pid, pid);
+      if (close(tube[1]) < 0) {
+        perror("close ");
+      }
+      // Transmet la sortie de la commande au fur et à mesure
+      r = stream_output(s, id, tube[0], (ssize_t) res_max, 
+          has_deadline ? &deadline : NULL, 
+          pending != NULL || f != NULL ? &capture : NULL);
+      // Seule une sortie complète, transmise en entier, est réutilisée. Le 
+      // cache est rempli avant la fin de l'exécution : une requête arrivée
+      // entre les deux trouve la réponse.
+      int complete = r > 0 && !capture.overflow;
+      if (pending != NULL) {
+        cache_commit(cache, pending, !complete ? NULL 
+            : capture.data != NULL ? capture.data : "", capture.size);
+      }
+      if (f != NULL && complete && capture.size <= coalesce_max) {
+        // Les requêtes rattachées partagent la copie sans la dupliquer. La
+        // copie peut dépasser coalesce_max lorsqu'elle sert aussi au cache.
+        flight_complete(flights, f, capture.data, capture.size);
+        capture.data = NULL;
+      } else if (f != NULL) {
+        flight_abort(flights, f);
+      }
+      free(capture.data);
+      if (r == REQUEST_EXPIRED) {
+        // Personne n'attend plus la suite : la commande est interrompue et
+        // la réponse close par un avertissement
+        kill(-pid, SIGKILL);
+        atomic_fetch_add(&expired_during_run, 1);
+        const char *notice = "\nEchéance de la requête dépassée\n";
+        r = session_send_chunk(s, id, notice, strlen(notice), 
             (time_t) res_timeout);
-        if (r < 0) {
-          perror("Impossible d'envoyer la réponse au client");
-          free(res_buffer);
-          goto remove;
-        } else if (r == 0) {
-          fprintf(stderr, "Un client a été timeout\n");
-          if (kill(req->pid, SIGUSR2) < 0) {
-            fprintf(stderr, "Impossible d'envoyer un signal au client\n");
-          }
-          goto remove;
+      }
+      if (close(tube[0]) < 0) {
+        perror("Impossible de fermer tube 0 : ");
+      }
+      // Attend la mort du processus enfant
+      waitpid(pid, NULL, 0);
+      if (r > 0) {
+        r = session_end_response(s, id, (time_t) res_timeout);
+      }
+      if (r < 0) {
+        perror("Impossible d'envoyer la réponse au client");
+      } else if (r == 0) {
+        fprintf(stderr, "Un client a été timeout\n");
+        if (!(req->capabilities & CAPABILITY_NO_SIGNALS) 
+            && kill(req->pid, SIGUSR2) < 0) {
+          fprintf(stderr, "Impossible d'envoyer un signal au client\n");
         }
+      }
+  }
+
+  return r;
+}
+
+int start_event_loops(size_t nb_loops, size_t nb_threads) {
+  if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    return THREAD_ERROR;
+  }
+  if ((pool = calloc(nb_threads, sizeof(worker))) == NULL) {
+    return NOT_ENOUGH_MEMORY;
+  }
+  for (size_t i = 0; i < nb_threads; ++i) {
+    if (pthread_mutex_init(&pool[i].mutex, NULL) != 0) {
+      return THREAD_ERROR;
+    }
+  }
+  pool_size = nb_threads;
+  // Les workers s'effacent devant un redémarrage à chaud
+  pthread_mutex_lock(&handover_mutex);
+  parkable_threads += nb_threads;
+  pthread_mutex_unlock(&handover_mutex);
+  // Toutes les boucles attendent sur la même instance epoll : EPOLLONESHOT
+  // garantit qu'un événement n'est délivré qu'à l'une d'elles.
+  for (size_t i = 0; i < nb_loops + nb_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, 
+        i < nb_loops ? run_event_loop : run_worker, 
+        (void *) (uintptr_t) (i < nb_loops ? i : i - nb_loops)) != 0) {
+      return THREAD_ERROR;
+    }
+    if (pthread_detach(thread) != 0) {
+      return THREAD_ERROR;
+    }
+  }
+
+  return 1;
+}
+
+void *run_event_loop(void *arg) {
+  (void) arg;
+  struct epoll_event events[EVENT_BATCH];
+  while (1) {
+    int n = epoll_wait(epoll_fd, events, EVENT_BATCH, -1);
+    if (n < 0) {
+      if (errno != EINTR) {
+        perror("epoll_wait ");
+      }
+      continue;
+    }
+    // Une session lisible (ou fermée par le client) est confiée aux workers
+    for (int i = 0; i < n; ++i) {
+      push_client((event_client *) events[i].data.ptr);
     }
-    if (listen_request(req->request_pipe, req_buffer) < 0) {
+  }
+
+  return NULL;
+}
+
+void *run_worker(void *arg) {
+  size_t self = (size_t) (uintptr_t) arg;
+  while (1) {
+    event_client *c = pop_client(self);
+    if (c == NULL) {
+      wait_handover();
+      continue;
+    }
+    if (c->s == NULL) {
+      // Nouvelle connexion : ouvre la session, ou programme une nouvelle 
+      // tentative si le client n'est pas prêt, puis la confie à epoll
+      if (attach_client(c) < 0) {
+        drop_client(c);
+      }
+      continue;
+    }
+    unsigned int req_id;
+    char *cmd;
+    int r = session_listen_request(c->s, &req_id, &cmd, 
+        (time_t) res_timeout);
+    if (r > 0 || r == INVALID_REQUEST) {
+      r = serve_request(c->s, c->req, req_id, r > 0 ? cmd : NULL);
+    } else if (r < 0) {
       perror("Erreur lors de la lecture d'une requete ");
-      send_response(req->response_pipe, "Erreur lors de la récéption de la "
-          "requête\n", (ssize_t) res_max, (time_t) res_timeout);
     }
-    free(res_buffer);
+    if (r <= 0) {
+      drop_client(c);
+      continue;
+    }
+    // Réarme la surveillance : une requête déjà en attente la redéclenche
+    // aussitôt.
+    if (watch_client(c, EPOLL_CTL_MOD) < 0) {
+      perror("epoll_ctl ");
+      drop_client(c);
+    }
+  }
+
+  return NULL;
+}
+
+int watch_client(event_client *c, int op) {
+  struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT };
+  event.data.ptr = c;
+
+  return epoll_ctl(epoll_fd, op, session_request_fd(c->s), &event) < 0 
+      ? -1 : 1;
+}
+
+int attach_client(event_client *c) {
+  session *s = accept_session(c->req, 0);
+  if (s == NULL) {
+    if (errno != ETIMEDOUT || remaining_ms(&c->attach_deadline) <= 0) {
+      perror("Impossible d'ouvrir la session du client ");
+      return -1;
+    }
+    // Le client n'a pas encore ouvert ses tubes : le minuteur redonnera le 
+    // client à un worker
+    int op = EPOLL_CTL_MOD;
+    if (c->attach_fd < 0) {
+      c->attach_fd = timerfd_create(CLOCK_MONOTONIC, 
+          TFD_NONBLOCK | TFD_CLOEXEC);
+      if (c->attach_fd < 0) {
+        perror("timerfd_create ");
+        return -1;
+      }
+      op = EPOLL_CTL_ADD;
+    }
+    struct itimerspec delay = { .it_value.tv_nsec = ATTACH_RETRY_DELAY };
+    struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT };
+    event.data.ptr = c;
+    if (timerfd_settime(c->attach_fd, 0, &delay, NULL) < 0
+        || epoll_ctl(epoll_fd, op, c->attach_fd, &event) < 0) {
+      perror("Impossible de programmer l'ouverture de la session ");
+      return -1;
+    }
+    return 1;
+  }
+  if (c->attach_fd >= 0) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->attach_fd, NULL);
+    close(c->attach_fd);
+    c->attach_fd = -1;
+  }
+  if ((c->s = prepare_client_session(s, c->req)) == NULL) {
+    return -1;
+  }
+  if (watch_client(c, EPOLL_CTL_ADD) < 0) {
+    perror("epoll_ctl ");
+    return -1;
+  }
+
+  return 1;
+}
+
+void push_client(event_client *c) {
+  worker *w = &pool[atomic_fetch_add(&next_worker, 1) % pool_size];
+  pthread_mutex_lock(&w->mutex);
+  c->prev = w->tail;
+  c->next = NULL;
+  if (w->tail == NULL) {
+    w->head = c;
+  } else {
+    w->tail->next = c;
+  }
+  w->tail = c;
+  ++w->length;
+  w->max_length = MAX(w->max_length, w->length);
+  // Le compteur est incrémenté sous le verrou de la file, avant qu'un voleur
+  // puisse retirer le client et le décrémenter, et avant de consulter
+  // idle_workers : un worker qui s'endort le voit forcément
+  atomic_fetch_add(&ready_clients, 1);
+  pthread_mutex_unlock(&w->mutex);
+  pthread_mutex_lock(&pool_mutex);
+  if (idle_workers > 0) {
+    pthread_cond_signal(&pool_cond);
+  }
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+event_client *pop_client(size_t self) {
+  worker *w = &pool[self];
+  while (1) {
+    // Pendant un redémarrage à chaud, les clients prêts attendent le serveur
+    // suivant
+    if (atomic_load(&handing_over)) {
+      return NULL;
+    }
+    event_client *c = take_client(w, 0);
+    int stolen = 0;
+    for (size_t i = 1; c == NULL && i < pool_size; ++i) {
+      c = take_client(&pool[(self + i) % pool_size], 1);
+      stolen = c != NULL;
+    }
+    if (c != NULL) {
+      pthread_mutex_lock(&w->mutex);
+      ++w->tasks;
+      w->steals += (unsigned long) stolen;
+      pthread_mutex_unlock(&w->mutex);
+      return c;
+    }
+    // Aucun client prêt : le worker s'endort jusqu'au prochain
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&pool_mutex);
+    while (atomic_load(&ready_clients) == 0 && !atomic_load(&handing_over)) {
+      ++idle_workers;
+      pthread_cond_wait(&pool_cond, &pool_mutex);
+      --idle_workers;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_lock(&w->mutex);
+    w->idle_ns += (unsigned long long) ((end.tv_sec - start.tv_sec) 
+        * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+    pthread_mutex_unlock(&w->mutex);
+  }
+}
+
+event_client *take_client(worker *w, int steal) {
+  pthread_mutex_lock(&w->mutex);
+  event_client *c = steal ? w->tail : w->head;
+  if (c != NULL) {
+    if (c->prev != NULL) {
+      c->prev->next = c->next;
+    } else {
+      w->head = c->next;
+    }
+    if (c->next != NULL) {
+      c->next->prev = c->prev;
+    } else {
+      w->tail = c->prev;
+    }
+    --w->length;
+    atomic_fetch_sub(&ready_clients, 1);
+  }
+  pthread_mutex_unlock(&w->mutex);
+
+  return c;
+}
+
+void drop_client(event_client *c) {
+  int opened = c->s != NULL;
+  if (c->attach_fd >= 0) {
+    // Les processus des commandes peuvent aussi partager le minuteur
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->attach_fd, NULL);
+    close(c->attach_fd);
+  }
+  if (opened) {
+    // Les processus des commandes en cours partagent le descripteur : la 
+    // fermeture seule ne le retirerait pas d'epoll.
+    if (epoll_fd >= 0 && session_request_fd(c->s) >= 0) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session_request_fd(c->s), NULL);
+    }
+    if (close_session(c->s) < 0) {
+      perror("Impossible de fermer la session du client ");
+    }
+  }
+  pthread_mutex_lock(&clients_mutex);
+  if (c->live_prev != NULL) {
+    c->live_prev->live_next = c->live_next;
+  } else {
+    live_clients = c->live_next;
+  }
+  if (c->live_next != NULL) {
+    c->live_next->live_prev = c->live_prev;
+  }
+  pthread_mutex_unlock(&clients_mutex);
+  end_session(c->req, opened ? &c->started : NULL);
+  free(c);
+}
+
+int allocate_batch_ressources(shm_request *batch, size_t n) {
+  size_t bucket = 0;
+  while (bucket + 1 < BATCH_BUCKETS && ((size_t) 2 << bucket) <= n) {
+    ++bucket;
+  }
+  atomic_fetch_add(&batch_sizes[bucket], 1);
+  for (size_t i = 0; i < n; ++i) {
+    int r = allocate_request_ressources(&batch[i]);
+    if (r < 0) {
+      return r;
+    }
+  }
+  fprintf(stdout, "%zu connexion(s) établie(s) avec des clients\n", n);
+
+  return 1;
+}
+
+void print_batch_stats(FILE *stream) {
+  fprintf(stream, "Distribution des tailles des lots de connexions :\n");
+  for (size_t i = 0; i < BATCH_BUCKETS; ++i) {
+    size_t count = atomic_load(&batch_sizes[i]);
+    if (count > 0) {
+      fprintf(stream, "    [%zu, %zu[ : %zu\n", (size_t) 1 << i, 
+          (size_t) 2 << i, count);
+    }
+  }
+}
+
+void print_wait_stats(FILE *stream) {
+  queue_wait_stats stats;
+  if (get_wait_stats(server_q, &stats) < 0) {
+    return;
+  }
+  fprintf(stream, "Attentes sur la file (actives / sommeils) :\n");
+  fprintf(stream, "    serveur : %lu / %lu\n", stats.consumer_spins, 
+      stats.consumer_parks);
+  fprintf(stream, "    clients : %lu / %lu\n", stats.producer_spins, 
+      stats.producer_parks);
+}
+
+void print_lane_stats(FILE *stream) {
+  fprintf(stream, "Voies de la file (en attente, acceptées, expirées, "
+      "attente moyenne / max) :\n");
+  for (size_t i = 0; i < get_nb_lanes(server_q); ++i) {
+    lane_stats stats;
+    if (get_lane_stats(server_q, i, &stats) < 0) {
+      return;
+    }
+    unsigned long long avg = stats.dequeued == 0 ? 0 
+        : stats.wait_ns / stats.dequeued;
+    fprintf(stream, "    voie %zu : %zu, %lu, %lu, %llu / %llu us\n", i, 
+        stats.depth, stats.dequeued - stats.expired, stats.expired, 
+        avg / 1000, 
+        stats.max_wait_ns / 1000);
+  }
+}
+
+void print_load_stats(FILE *stream) {
+  queue_load load;
+  if (get_queue_load(server_q, &load) < 0) {
+    return;
+  }
+  fprintf(stream, "Charge : %zu session(s) en cours, %zu requête(s) en "
+      "attente, session moyenne de %llu us, %lu requête(s) refusée(s)\n", 
+      load.active_sessions, load.length, load.service_ns / 1000, 
+      load.rejected);
+}
+
+int request_key(shm_request *req, const char *cmd, char *key, 
+    size_t *key_len, char *tokens, const char **paths, size_t *nb_paths) {
+  if (strlen(cmd) > CACHE_MAX_COMMAND) {
+    return CACHE_POLICY_NEVER;
+  }
+  int policy = command_cache_policy(cmd, tokens, paths, CACHE_MAX_PATHS, 
+      nb_paths);
+  if (policy == CACHE_POLICY_NEVER) {
+    return policy;
+  }
+  memcpy(key, &req->uid, sizeof(uid_t));
+  *key_len = sizeof(uid_t);
+  size_t cwd_len = strlen(server_cwd) + 1;
+  memcpy(key + *key_len, server_cwd, cwd_len);
+  *key_len += cwd_len;
+  char normalized[CACHE_MAX_COMMAND + 1];
+  strcpy(normalized, cmd);
+  char *cmd_p = normalized;
+  char *token;
+  while ((token = strtok_r(cmd_p, " ", &cmd_p)) != NULL) {
+    size_t k = strlen(token);
+    memcpy(key + *key_len, token, k);
+    *key_len += k;
+    key[(*key_len)++] = ' ';
+  }
+
+  return policy;
+}
+
+int follow_flight(session *s, unsigned int id, const char *key, 
+    size_t key_len, const struct timespec *deadline, ssize_t res_max, 
+    flight **f, int *r) {
+  *f = NULL;
+  if (flights == NULL) {
+    return 0;
+  }
+  int joined = flight_join(flights, key, key_len, f);
+  if (joined != 0) {
+    if (joined < 0) {
+      *f = NULL;
+    }
+    return 0;
+  }
+  const char *data;
+  size_t size;
+  int w = flight_wait(flights, *f, deadline, &data, &size);
+  if (w > 0) {
+    *r = send_cached_response(s, id, data, 
+        res_max >= 0 ? MIN(size, (size_t) res_max) : size);
+  } else if (w == 0) {
+    atomic_fetch_add(&expired_before_start, 1);
+    *r = session_send_response(s, id, "Echéance de la requête dépassée\n",
+        res_max, (time_t) res_timeout);
   }
-  if (send_response(req->response_pipe, "Déconnexion du serveur...\n", 
-      (ssize_t) res_max, (time_t) res_timeout) < 0) {
+  flight_release(flights, *f);
+  *f = NULL;
+  if (w < 0) {
+    // Le meneur a abandonné (client parti, échéance, sortie trop longue) :
+    // chaque requête rattachée exécute la commande pour son compte
+    return 0;
+  }
+  if (*r < 0) {
     perror("Impossible d'envoyer la réponse au client ");
   }
-remove:
-  if (list_remove(client_list, req) <= 0) {
-    fprintf(stderr, 
-        "Impossible d'enlever le client %d de la liste des clients\n", 
-        req->pid);
+
+  return 1;
+}
+
+int send_cached_response(session *s, unsigned int id, const char *data, 
+    size_t size) {
+  int r = 1;
+  for (size_t sent = 0; sent < size && r > 0; sent += STREAM_BUFFER_SIZE) {
+    r = session_send_chunk(s, id, data + sent, 
+        MIN(size - sent, STREAM_BUFFER_SIZE), (time_t) res_timeout);
   }
-  return NULL;
+  if (r > 0) {
+    r = session_end_response(s, id, (time_t) res_timeout);
+  }
+
+  return r;
 }
 
-int request_cmp(shm_request *a, shm_request *b) {
-  if (a->pid > b->pid) {
+void print_deadline_stats(FILE *stream) {
+  fprintf(stream, "Echéances : %lu requête(s) expirée(s) avant exécution, "
+      "%lu commande(s) interrompue(s)\n", atomic_load(&expired_before_start),
+      atomic_load(&expired_during_run));
+}
+
+void print_cache_stats(FILE *stream) {
+  cache_stats stats;
+  if (cache == NULL || cache_get_stats(cache, &stats) < 0) {
+    return;
+  }
+  fprintf(stream, "Cache des réponses : %lu succès, %lu échec(s), %lu "
+      "éviction(s), %lu invalidation(s), %zu entrée(s) pour %zu octets\n", 
+      stats.hits, stats.misses, stats.evictions, stats.invalidations, 
+      stats.entries, stats.bytes);
+}
+
+void print_flight_stats(FILE *stream) {
+  flight_stats stats;
+  if (flights == NULL || flight_get_stats(flights, &stats) < 0) {
+    return;
+  }
+  fprintf(stream, "Exécutions partagées : %lu commande(s) lancée(s), %lu "
+      "requête(s) rattachée(s), %lu abandon(s)\n", stats.leaders, 
+      stats.followers, stats.aborted);
+}
+
+void print_worker_stats(FILE *stream) {
+  for (size_t i = 0; i < pool_size; ++i) {
+    worker *w = &pool[i];
+    pthread_mutex_lock(&w->mutex);
+    fprintf(stream, "Worker %zu : %lu client(s) traité(s) dont %lu volé(s), "
+        "file de %zu (max %zu), inactif %llu ms\n", i, w->tasks, w->steals, 
+        w->length, w->max_length, w->idle_ns / 1000000);
+    pthread_mutex_unlock(&w->mutex);
+  }
+}
+
+int configure_lanes(void) {
+  size_t nb_lanes = get_nb_lanes(server_q);
+  char spec[LANE_SPEC_MAX];
+  // Poids : un entier par voie, 1 par défaut
+  unsigned int weights[MAX_LANES];
+  for (size_t i = 0; i < nb_lanes; ++i) {
+    weights[i] = 1;
+  }
+  if (get(config, "lane_weights", spec) > 0) {
+    char *p = spec;
+    for (size_t i = 0; i < nb_lanes; ++i) {
+      char *end;
+      unsigned long w = strtoul(p, &end, 10);
+      if (end == p) {
+        break;
+      }
+      weights[i] = (unsigned int) MIN(w, UINT_MAX);
+      p = end;
+    }
+  }
+  if (set_lane_weights(server_q, weights, nb_lanes) < 0) {
+    return -1;
+  }
+  // Règles : paires <identifiant> <voie>, les utilisateurs d'abord
+  lane_rule rules[MAX_LANE_RULES];
+  size_t nb_rules = 0;
+  const char *keys[] = { "lane_uids", "lane_gids" };
+  const int kinds[] = { LANE_RULE_UID, LANE_RULE_GID };
+  for (size_t k = 0; k < 2; ++k) {
+    if (get(config, keys[k], spec) <= 0) {
+      continue;
+    }
+    char *p = spec;
+    while (nb_rules < MAX_LANE_RULES) {
+      char *end;
+      unsigned long id = strtoul(p, &end, 10);
+      if (end == p) {
+        break;
+      }
+      p = end;
+      unsigned long lane = strtoul(p, &end, 10);
+      if (end == p) {
+        errno = EINVAL;
+        return -1;
+      }
+      p = end;
+      rules[nb_rules++] = (lane_rule) { 
+        .kind = kinds[k], 
+        .id = (unsigned int) id, 
+        .lane = (size_t) lane 
+      };
+    }
+  }
+
+  return set_lane_rules(server_q, rules, nb_rules, 
+      default_lane < 0 ? 0 : (size_t) default_lane);
+}
+
+int stream_output(session *s, unsigned int id, int fd, ssize_t limit, 
+    const struct timespec *deadline, output_capture *capture) {
+  size_t sent = 0;
+  while (limit < 0 || sent < (size_t) limit) {
+    size_t remaining = limit < 0 ? SIZE_MAX : (size_t) limit - sent;
+    size_t n;
+    int r;
+    if ((r = wait_output(fd, deadline)) < 0) {
+      if (r != REQUEST_EXPIRED) {
+        perror("Erreur lors de l'attente de la sortie ");
+      }
+      return r;
+    }
+    if (capture != NULL && !capture->overflow) {
+      // La sortie passe par le serveur pour en garder une copie
+      r = capture_chunk(s, id, fd, remaining, &n, capture);
+    } else if (memfd_threshold >= 0 && sent >= (size_t) memfd_threshold 
+        && session_can_send_fd(s)) {
+      // Sortie volumineuse : la suite est confiée au client par fichiers de
+      // taille bornée, qu'il projette sans recopie
+      r = session_spool_chunk(s, id, fd, 
+          MIN(remaining, (size_t) MAX(memfd_max, 1)), &n, deadline, 
+          (time_t) res_timeout);
+    } else {
+      r = session_forward_chunk(s, id, fd, remaining, &n, 
+          (time_t) res_timeout);
+    }
+    if (r <= 0) {
+      if (r < 0 && r != REQUEST_EXPIRED) {
+        perror("Erreur lors de la transmission de la sortie ");
+      }
+      return r;
+    }
+    if (n == 0) {
+      return 1;
+    }
+    sent += n;
+  }
+  // Vide la sortie au-delà de la limite pour ne pas bloquer la commande
+  char buffer[STREAM_BUFFER_SIZE];
+  ssize_t n;
+  int r;
+  while ((r = wait_output(fd, deadline)) > 0 
+      && ((n = read(fd, buffer, STREAM_BUFFER_SIZE)) > 0 
+      || (n < 0 && errno == EINTR))) {
+  }
+
+  return r == REQUEST_EXPIRED ? r : 1;
+}
+
+int serve_custom_command(session *s, shm_request *req, unsigned int id, 
+    const char *cmd, ssize_t res_max, cache_pending *pending, flight *f) {
+  // La sortie est écrite dans un tampon extensible
+  char *data = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&data, &size);
+  if (out == NULL) {
+    perror("open_memstream ");
+    session_send_response(s, id, "Erreur lors de l'exécution de la "
+        "commande\n", res_max, (time_t) res_timeout);
+    if (pending != NULL) {
+      cache_commit(cache, pending, NULL, 0);
+    }
+    if (f != NULL) {
+      flight_abort(flights, f);
+    }
+    return -1;
+  }
+  if (exec_custom_cmd(cmd, req, out) < 0) {
+    fprintf(out, "Erreur lors de l'exécution de la commande.\n");
+  }
+  int r = -1;
+  if (fclose(out) != 0) {
+    perror("Impossible de construire la sortie de la commande ");
+    session_send_response(s, id, "Erreur lors de l'exécution de la "
+        "commande\n", res_max, (time_t) res_timeout);
+  } else if ((r = send_cached_response(s, id, data, 
+      res_max >= 0 ? MIN(size, (size_t) res_max) : size)) < 0) {
+    perror("Impossible d'envoyer la réponse au client ");
+  }
+  if (pending != NULL) {
+    cache_commit(cache, pending, r > 0 ? data : NULL, size);
+  }
+  if (f != NULL && r > 0 && size <= coalesce_max) {
+    // Les requêtes rattachées partagent le tampon sans le dupliquer
+    flight_complete(flights, f, data, size);
+    data = NULL;
+  } else if (f != NULL) {
+    flight_abort(flights, f);
+  }
+  free(data);
+
+  return r;
+}
+
+int capture_chunk(session *s, unsigned int id, int fd, size_t limit, 
+    size_t *forwarded, output_capture *capture) {
+  *forwarded = 0;
+  char buffer[STREAM_BUFFER_SIZE];
+  ssize_t k;
+  while ((k = read(fd, buffer, MIN(limit, STREAM_BUFFER_SIZE))) < 0) {
+    if (errno != EINTR) {
+      return PIPE_ERROR;
+    }
+  }
+  if (k == 0) {
     return 1;
   }
-  return a->pid == b->pid ? 0 : -1;
+  if (capture->size + (size_t) k > capture->max) {
+    // Trop volumineuse pour le cache : la suite n'est plus copiée
+    capture->overflow = 1;
+  } else {
+    if (capture->size + (size_t) k > capture->capacity) {
+      size_t capacity = MAX(capture->capacity * 2, capture->size + (size_t) k);
+      char *p = realloc(capture->data, MIN(capacity, capture->max));
+      if (p == NULL) {
+        capture->overflow = 1;
+      } else {
+        capture->data = p;
+        capture->capacity = MIN(capacity, capture->max);
+      }
+    }
+    if (!capture->overflow) {
+      memcpy(capture->data + capture->size, buffer, (size_t) k);
+      capture->size += (size_t) k;
+    }
+  }
+  int r = session_send_chunk(s, id, buffer, (size_t) k, (time_t) res_timeout);
+  if (r > 0) {
+    *forwarded = (size_t) k;
+  }
+
+  return r;
+}
+
+int wait_output(int fd, const struct timespec *deadline) {
+  if (deadline == NULL) {
+    return 1;
+  }
+  struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+  while (1) {
+    long long ms = remaining_ms(deadline);
+    if (ms <= 0) {
+      return REQUEST_EXPIRED;
+    }
+    int r = poll(&pfd, 1, (int) MIN(ms, INT_MAX));
+    if (r > 0) {
+      return 1;
+    }
+    if (r < 0 && errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+long long remaining_ms(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long ns = (long long) (deadline->tv_sec - now.tv_sec) * 1000000000LL 
+      + (deadline->tv_nsec - now.tv_nsec);
+
+  // Arrondi supérieur : poll ne doit pas se réveiller juste avant l'échéance
+  return ns <= 0 ? ns : (ns + 999999) / 1000000;
+}
+
+int request_cmp(shm_request *a, shm_request *b) {
+  if (a->pid != b->pid) {
+    return a->pid > b->pid ? 1 : -1;
+  }
+  // Un même processus peut ouvrir plusieurs sessions
+  int r = strcmp(a->request_pipe, b->request_pipe);
+  if (r == 0) {
+    r = strcmp(a->session_shm, b->session_shm);
+  }
+  if (r == 0) {
+    r = strcmp(a->socket_path, b->socket_path);
+  }
+  return r;
 }
 
 void sig_free(int signum) {
+  if (signum == SIGPIPE) {
+    return;
+  }
+  // Seules les fonctions async-signal-safe sont permises ici
+  shutdown_signal = signum;
+  sem_post(&shutdown_sem);
+}
+
+void *run_shutdown(void *arg) {
+  (void) arg;
+  while (sem_wait(&shutdown_sem) < 0) {
+    continue;
+  }
+  int signum = shutdown_signal;
   int status = EXIT_SUCCESS;
   if (signum == SIGINT || signum == SIGQUIT || signum == SIGTERM) {
     fprintf(stderr, "\nInterruption du serveur suite à un signal émis.\n");
-  } else if (signum == SIGPIPE) {
-    return;
   } else {
     fprintf(stderr, 
         "Interruption du serveur suite à un signal innatendu : %d\n", signum);
   }
+  print_batch_stats(stderr);
+  print_wait_stats(stderr);
+  print_lane_stats(stderr);
+  print_load_stats(stderr);
+  print_deadline_stats(stderr);
+  print_cache_stats(stderr);
+  print_flight_stats(stderr);
+  print_worker_stats(stderr);
   int r = list_apply(client_list, (int (*)(void *, int)) free_online_clients);
   if (r < 0) {
     fprintf(stderr, "Tous les clients n'ont pas pu être libérés\n");
@@ -370,9 +2136,229 @@ void sig_free(int signum) {
 }
 
 int free_online_clients(shm_request *req, int acc) {
-  if (kill(req->pid, SIGUSR1) < 0) {
+  if (!(req->capabilities & CAPABILITY_NO_SIGNALS) 
+      && kill(req->pid, SIGUSR1) < 0) {
     acc = -1;
   }
 
   return acc < 0 ? -1 : 1;
 }
+
+void sig_restart(int signum) {
+  (void) signum;
+  // Seules les fonctions async-signal-safe sont permises ici
+  sem_post(&restart_sem);
+}
+
+void *run_restart(void *arg) {
+  (void) arg;
+  while (1) {
+    if (sem_wait(&restart_sem) < 0) {
+      continue;
+    }
+    fprintf(stderr, "Redémarrage à chaud de %s\n", server_path);
+    hot_restart();
+    perror("Echec du redémarrage à chaud, le serveur reprend ");
+  }
+
+  return NULL;
+}
+
+int hot_restart(void) {
+  int state = -1;
+  // Suspend l'acceptation des connexions puis réveille les threads en 
+  // attente d'une requête ou d'un client, qui s'endorment un à un
+  atomic_store(&handing_over, 1);
+  pause_fetching(server_q, 1);
+  uint64_t one = 1;
+  if (write(handover_fd, &one, sizeof(one)) != (ssize_t) sizeof(one)) {
+    goto abort;
+  }
+  pthread_mutex_lock(&sessions_mutex);
+  pthread_cond_broadcast(&sessions_cond);
+  pthread_mutex_unlock(&sessions_mutex);
+  pthread_mutex_lock(&pool_mutex);
+  pthread_cond_broadcast(&pool_cond);
+  pthread_mutex_unlock(&pool_mutex);
+  // Les requêtes en cours disposent du timeout de réponse pour se terminer
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 2 * res_timeout + 1;
+  pthread_mutex_lock(&handover_mutex);
+  int timed_out = 0;
+  while (parked_threads < parkable_threads && !timed_out) {
+    timed_out = pthread_cond_timedwait(&handover_cond, &handover_mutex, 
+        &deadline) == ETIMEDOUT;
+  }
+  pthread_mutex_unlock(&handover_mutex);
+  if (timed_out) {
+    errno = ETIMEDOUT;
+    goto abort;
+  }
+  // Plus aucun thread ne sert de requête : l'état est transmis dans un 
+  // fichier anonyme hérité par le nouveau programme
+  if ((state = memfd_create("server_handover", 0)) < 0) {
+    goto abort;
+  }
+  pthread_mutex_lock(&clients_mutex);
+  handover_header header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.shm_name, queue_name);
+  for (event_client *c = live_clients; c != NULL; c = c->live_next) {
+    ++header.nb_clients;
+  }
+  int written = write(state, &header, sizeof(header)) 
+      == (ssize_t) sizeof(header);
+  for (event_client *c = live_clients; c != NULL && written; 
+      c = c->live_next) {
+    handover_record record;
+    memset(&record, 0, sizeof(record));
+    record.req = *c->req;
+    record.started = c->started;
+    record.opened = c->s != NULL;
+    record.fds[0] = record.fds[1] = -1;
+    written = (!record.opened || session_export(c->s, record.fds) > 0) 
+        && write(state, &record, sizeof(record)) == (ssize_t) sizeof(record);
+  }
+  pthread_mutex_unlock(&clients_mutex);
+  if (!written || lseek(state, 0, SEEK_SET) < 0) {
+    goto abort;
+  }
+  char value[32];
+  snprintf(value, sizeof(value), "%d", state);
+  if (setenv(HANDOVER_ENV, value, 1) < 0) {
+    goto abort;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  execl(server_path, server_path, (char *) NULL);
+  unsetenv(HANDOVER_ENV);
+
+abort:
+  {
+    int err = errno;
+    if (state >= 0) {
+      close(state);
+    }
+    // Les descripteurs des sessions ne doivent plus être hérités par les 
+    // commandes
+    pthread_mutex_lock(&clients_mutex);
+    for (event_client *c = live_clients; c != NULL; c = c->live_next) {
+      int fds[2];
+      if (c->s != NULL && session_export(c->s, fds) > 0) {
+        for (size_t i = 0; i < 2; ++i) {
+          if (fds[i] >= 0) {
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+          }
+        }
+      }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    uint64_t count;
+    if (read(handover_fd, &count, sizeof(count)) < 0) {
+      err = errno;
+    }
+    pause_fetching(server_q, 0);
+    pthread_mutex_lock(&handover_mutex);
+    atomic_store(&handing_over, 0);
+    pthread_cond_broadcast(&handover_cond);
+    pthread_mutex_unlock(&handover_mutex);
+    errno = err;
+  }
+  return -1;
+}
+
+void wait_handover(void) {
+  pthread_mutex_lock(&handover_mutex);
+  ++parked_threads;
+  pthread_cond_broadcast(&handover_cond);
+  while (atomic_load(&handing_over)) {
+    pthread_cond_wait(&handover_cond, &handover_mutex);
+  }
+  --parked_threads;
+  pthread_mutex_unlock(&handover_mutex);
+}
+
+int restore_clients(int fd, size_t nb_clients) {
+  int r = 1;
+  size_t i = 0;
+  for (; i < nb_clients; ++i) {
+    handover_record record;
+    if (read(fd, &record, sizeof(record)) != (ssize_t) sizeof(record)) {
+      r = -1;
+      break;
+    }
+    // Les sessions restent comptées dans la charge publiée par la file
+    shm_request *req = list_add(client_list, &record.req, sizeof(record.req));
+    event_client *c = req != NULL ? malloc(sizeof *c) : NULL;
+    if (c == NULL) {
+      fprintf(stderr, "Impossible de reprendre le client %d\n", 
+          record.req.pid);
+      drop_restored(&record, req);
+      continue;
+    }
+    c->req = req;
+    c->s = NULL;
+    c->started = record.started;
+    c->attach_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &c->attach_deadline);
+    c->attach_deadline.tv_sec += res_timeout;
+    if (record.opened) {
+      c->s = resume_session(req, record.fds);
+      if (c->s != NULL) {
+        // Une fois la session reprise, ses descripteurs sont fermés avec 
+        // elle
+        record.opened = 0;
+      }
+      if (c->s == NULL || prepare_client_session(c->s, req) == NULL) {
+        fprintf(stderr, "Impossible de reprendre la session du client %d\n", 
+            record.req.pid);
+        free(c);
+        drop_restored(&record, req);
+        continue;
+      }
+    }
+    pthread_mutex_lock(&clients_mutex);
+    c->live_prev = NULL;
+    c->live_next = live_clients;
+    if (live_clients != NULL) {
+      live_clients->live_prev = c;
+    }
+    live_clients = c;
+    pthread_mutex_unlock(&clients_mutex);
+    if (start_client(c) < 0) {
+      perror("Impossible de reprendre le client ");
+      free_online_clients(&record.req, 0);
+      drop_client(c);
+    }
+  }
+  if (i < nb_clients) {
+    // Les clients restants sont inconnus : seules leurs places sont rendues
+    pthread_mutex_lock(&sessions_mutex);
+    for (; i < nb_clients; ++i) {
+      remove_active_session(server_q, 0);
+    }
+    pthread_cond_broadcast(&sessions_cond);
+    pthread_mutex_unlock(&sessions_mutex);
+  }
+  close(fd);
+
+  return r;
+}
+
+void drop_restored(handover_record *record, shm_request *req) {
+  for (size_t i = 0; i < 2; ++i) {
+    if (record->opened && record->fds[i] >= 0) {
+      close(record->fds[i]);
+    }
+  }
+  free_online_clients(&record->req, 0);
+  if (req != NULL) {
+    end_session(req, NULL);
+    return;
+  }
+  pthread_mutex_lock(&sessions_mutex);
+  remove_active_session(server_q, 0);
+  pthread_cond_broadcast(&sessions_cond);
+  pthread_mutex_unlock(&sessions_mutex);
+}